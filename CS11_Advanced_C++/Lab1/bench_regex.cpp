@@ -0,0 +1,608 @@
+#include "compiled.h"
+#include "engine.h"
+#include "regexset.h"
+#include "staticregex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+
+
+/*===========================================================================
+ * BENCHMARKS
+ *
+ * Each benchmark runs over a few megabytes of generated log lines, and
+ * reports the throughput in megabytes per second.
+ */
+
+
+/* The character-class operators as they were before classes were compiled to
+ * bitmaps:  every character is looked up in the class string, so the cost of
+ * each test grows with the size of the class.  Used as the "before" case.
+ */
+class StringSubset : public RegexOperator {
+public:
+    StringSubset(const string &chars, bool exclude) :
+        chars(chars), exclude(exclude) { }
+
+    bool match(string_view s, Range &r) const {
+        if ((ptrdiff_t) s.length() > r.start && matchChar(s[r.start])) {
+            r.end = r.start + 1;
+            return true;
+        }
+        return false;
+    }
+
+    bool matchChar(char c) const {
+        return (chars.find(c) != string::npos) != exclude;
+    }
+
+private:
+    string chars;
+    bool exclude;
+};
+
+
+/* Expands a class body such as "a-zA-Z0-9_" into the list of characters it
+ * contains, for the string-based operators.
+ */
+string expandClass(const string &body) {
+    string chars;
+    for (size_t i = 0; i < body.length(); i++) {
+        if (i + 2 < body.length() && body[i + 1] == '-') {
+            for (int c = body[i]; c <= body[i + 2]; c++)
+                chars += (char) c;
+            i += 2;
+        }
+        else {
+            chars += body[i];
+        }
+    }
+    return chars;
+}
+
+
+/* Generates lines of text that look like log output, with words, numbers
+ * and punctuation, but no semicolons, so that the benchmark regexes never
+ * match and every start index has to be tried.
+ */
+vector<string> makeLines(size_t totalBytes) {
+    const string words[] = {
+        "GET", "/api/v1/users", "200", "latency_ms=", "host-17", "ERROR",
+        "timeout", "connection", "reset", "by", "peer", "user_id=9912",
+        "(retrying)", "OK", "worker-3:", "queue.depth", "0x7f3a"
+    };
+    mt19937 rng(42);
+    vector<string> lines;
+    size_t bytes = 0;
+    while (bytes < totalBytes) {
+        string line;
+        while (line.length() < 80) {
+            line += words[rng() % (sizeof(words) / sizeof(words[0]))];
+            line += ' ';
+        }
+        bytes += line.length();
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+
+/* Tests every character of every line against the operator, and returns
+ * the throughput in megabytes per second.
+ */
+double classThroughput(const RegexOperator *op, const vector<string> &lines) {
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : lines) {
+        for (int i = 0; i < (int) line.length(); i++) {
+            Range r(i, i);
+            if (op->match(line, r))
+                found++;
+        }
+        bytes += line.length();
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the tests.
+    if (found < 0)
+        cout << found;
+
+    double seconds = chrono::duration<double>(end - start).count();
+    return bytes / seconds / 1e6;
+}
+
+
+/* Runs find() with the regex over all of the lines, and returns the
+ * throughput in megabytes per second.
+ */
+double findThroughput(const vector<RegexOperator *> &regex,
+                      const vector<string> &lines) {
+    MatchContext ctx;
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : lines) {
+        if (find(regex, line, ctx).start != -1)
+            found++;
+        bytes += line.length();
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double seconds = chrono::duration<double>(end - start).count();
+    return bytes / seconds / 1e6;
+}
+
+
+/* Runs backtrackFind() with the regex over all of the lines, either trying
+ * every start index or skipping to the indexes where a match can begin, and
+ * returns the throughput in megabytes per second.
+ */
+double scanThroughput(const vector<RegexOperator *> &regex,
+                      const vector<string> &lines, bool skip) {
+    MatchContext ctx;
+    ByteScanner starts = skip ? firstCharScanner(regex) : ByteScanner();
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : lines) {
+        if (backtrackFind(regex, line, ctx, starts).start != -1)
+            found++;
+        bytes += line.length();
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double seconds = chrono::duration<double>(end - start).count();
+    return bytes / seconds / 1e6;
+}
+
+
+/* Compares trying every start index with skipping to the indexes where a
+ * match can begin, for a regex that rarely matches the generated lines.
+ */
+void benchScan(const string &expr, const vector<string> &lines) {
+    vector<RegexOperator *> regex = parseRegex(expr);
+
+    cout << left << setw(20) << expr << right << fixed << setprecision(1)
+         << setw(10) << scanThroughput(regex, lines, false)
+         << setw(10) << scanThroughput(regex, lines, true) << endl;
+
+    for (RegexOperator *op : regex)
+        delete op;
+}
+
+
+/* Runs bytecodeFind() with the regex over all of the lines, and returns the
+ * throughput in megabytes per second.
+ */
+double bytecodeThroughput(const vector<RegexOperator *> &regex,
+                          const vector<string> &lines) {
+    BytecodeProgram prog(regex);
+    BacktrackScratch scratch;
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : lines) {
+        if (bytecodeFind(prog, line, scratch).start != -1)
+            found++;
+        bytes += line.length();
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double seconds = chrono::duration<double>(end - start).count();
+    return bytes / seconds / 1e6;
+}
+
+
+/* Compares backtracking over the regex operators, with a virtual call for
+ * each character test, to backtracking over the same regex compiled to
+ * bytecode.  Both skip to the indexes where a match can begin.
+ */
+void benchBytecode(const string &expr, const vector<string> &lines) {
+    vector<RegexOperator *> regex = parseRegex(expr);
+
+    cout << left << setw(24) << expr << right << fixed << setprecision(1)
+         << setw(10) << scanThroughput(regex, lines, true)
+         << setw(10) << bytecodeThroughput(regex, lines) << endl;
+
+    for (RegexOperator *op : regex)
+        delete op;
+}
+
+
+/* Runs CompiledRegex::find() with the engine over all of the lines, and
+ * returns the throughput in megabytes per second.
+ */
+double engineThroughput(const CompiledRegex &regex, RegexEngine engine,
+                        const vector<string> &lines) {
+    MatchContext ctx;
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : lines) {
+        if (regex.find(line, ctx, engine).start != -1)
+            found++;
+        bytes += line.length();
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double seconds = chrono::duration<double>(end - start).count();
+    return bytes / seconds / 1e6;
+}
+
+
+/* Compares the engines on a compiled regex. */
+void benchEngines(const string &expr, const vector<string> &lines) {
+    CompiledRegex regex(expr);
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+
+    cout << left << setw(24) << expr << right << fixed << setprecision(1);
+    for (RegexEngine engine : engines)
+        cout << setw(11) << engineThroughput(regex, engine, lines);
+    cout << endl;
+}
+
+
+// Patterns for the compile-time regex benchmark.
+constexpr char staticWord[] = "[a-z]+_[a-z]+=[0-9]+";
+constexpr char staticHost[] = "host-[0-9]+ ERROR";
+constexpr char staticTimeout[] = "ERROR.*timeout;";
+
+
+/* Runs StaticRegex<Pattern>::find() over all of the lines, and returns the
+ * throughput in megabytes per second.
+ */
+template <const char *Pattern>
+double staticThroughput(const vector<string> &lines) {
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : lines) {
+        if (StaticRegex<Pattern>::find(line).start != -1)
+            found++;
+        bytes += line.length();
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double seconds = chrono::duration<double>(end - start).count();
+    return bytes / seconds / 1e6;
+}
+
+
+/* Compares the backtracking engine on a regex parsed at run time with the
+ * same regex parsed at compile time.  Each is run a few times, taking the
+ * best throughput, since a single run over the lines is very short.
+ */
+template <const char *Pattern>
+void benchStatic(const vector<string> &lines) {
+    CompiledRegex regex(Pattern);
+    double before = 0, after = 0;
+    for (int i = 0; i < 3; i++) {
+        before = max(before, engineThroughput(regex, ENGINE_BACKTRACK, lines));
+        after = max(after, staticThroughput<Pattern>(lines));
+    }
+
+    cout << left << setw(24) << Pattern << right << fixed << setprecision(1)
+         << setw(10) << before << setw(10) << after << endl;
+}
+
+
+/* Generates n alert patterns that rarely match the generated lines, such as
+ * "worker-[0-9]+: fail17".
+ */
+vector<string> makeAlertPatterns(int n) {
+    const string prefixes[] = {
+        "worker-[0-9]+: ", "host-[0-9]+ ", "ERROR.*", "user_id=[0-9]+ "
+    };
+    vector<string> exprs;
+    for (int i = 0; i < n; i++)
+        exprs.push_back(prefixes[i % 4] + "fail" + to_string(i));
+    return exprs;
+}
+
+
+/* Compares searching for n alert patterns one at a time, each with its own
+ * compiled regex and the DFA engine, against searching for all of them with
+ * one RegexSet.
+ */
+void benchSet(int n, const vector<string> &lines) {
+    vector<string> exprs = makeAlertPatterns(n);
+    vector<unique_ptr<CompiledRegex> > regexes;
+    for (const string &expr : exprs)
+        regexes.push_back(unique_ptr<CompiledRegex>(new CompiledRegex(expr)));
+    RegexSet set(exprs);
+
+    // Search a quarter of the lines, so that the loop over many patterns
+    // does not take too long.
+    vector<string> some(lines.begin(), lines.begin() + lines.size() / 4);
+    vector<MatchContext> contexts(n);
+    MatchContext ctx;
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &line : some) {
+        for (int i = 0; i < n; i++) {
+            if (regexes[i]->find(line, contexts[i], ENGINE_DFA).start != -1)
+                found++;
+        }
+        bytes += line.length();
+    }
+    auto mid = chrono::steady_clock::now();
+    for (const string &line : some)
+        found += (int) set.matches(line, ctx).size();
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double loopSeconds = chrono::duration<double>(mid - start).count();
+    double setSeconds = chrono::duration<double>(end - mid).count();
+    cout << left << setw(20) << n << right << fixed << setprecision(1)
+         << setw(10) << bytes / loopSeconds / 1e6
+         << setw(10) << bytes / setSeconds / 1e6 << endl;
+}
+
+
+/* Generates structured log lines such as
+ * "2024-05-17 12:04:56 ERROR worker-3: disk full", for extracting fields.
+ */
+vector<string> makeRecords(size_t totalBytes) {
+    const string levels[] = { "INFO", "WARN", "ERROR" };
+    const string messages[] = {
+        "disk full", "connection reset by peer", "timeout", "retrying"
+    };
+    mt19937 rng(7);
+    vector<string> records;
+    size_t bytes = 0;
+    while (bytes < totalBytes) {
+        string record = "2024-05-" + to_string(10 + rng() % 20) + " 12:" +
+            to_string(10 + rng() % 50) + ":" + to_string(10 + rng() % 50) +
+            " " + levels[rng() % 3] + " worker-" + to_string(rng() % 16) +
+            ": " + messages[rng() % 4];
+        bytes += record.length();
+        records.push_back(record);
+    }
+    return records;
+}
+
+
+/* Compares extracting the five fields of each record with a separate find()
+ * for each field, each on the rest of the record after the previous field,
+ * against a single pass of a CaptureRegex with five groups.
+ */
+void benchCaptures(const vector<string> &records) {
+    const string fields[] = {
+        "[0-9]+-[0-9]+-[0-9]+", "[0-9]+:[0-9]+:[0-9]+", "[A-Z]+",
+        "worker-[0-9]+", "[a-z].*"
+    };
+    vector<unique_ptr<CompiledRegex> > regexes;
+    for (const string &field : fields)
+        regexes.push_back(unique_ptr<CompiledRegex>(new CompiledRegex(field)));
+    CaptureRegex regex("([0-9]+-[0-9]+-[0-9]+) ([0-9]+:[0-9]+:[0-9]+) "
+                       "([A-Z]+) (worker-[0-9]+): ([a-z].*)");
+    MatchContext ctx;
+    vector<Range> groups;
+    size_t bytes = 0;
+    int found = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (const string &record : records) {
+        string rest = record;
+        for (const unique_ptr<CompiledRegex> &field : regexes) {
+            Range r = field->find(rest, ctx);
+            if (r.start == -1)
+                break;
+            found += r.end - r.start;
+            rest = rest.substr(r.end);
+        }
+        bytes += record.length();
+    }
+    auto mid = chrono::steady_clock::now();
+    for (const string &record : records) {
+        if (regex.find(record, groups, ctx)) {
+            for (int g = 1; g <= regex.numGroups(); g++)
+                found += groups[g].end - groups[g].start;
+        }
+    }
+    auto end = chrono::steady_clock::now();
+
+    // Keep the compiler from discarding the searches.
+    if (found < 0)
+        cout << found;
+
+    double findSeconds = chrono::duration<double>(mid - start).count();
+    double captureSeconds = chrono::duration<double>(end - mid).count();
+    cout << left << setw(20) << "5 fields" << right << fixed
+         << setprecision(1) << setw(10) << bytes / findSeconds / 1e6
+         << setw(10) << bytes / captureSeconds / 1e6 << endl;
+}
+
+
+/* Times the backtracking and NFA engines on the regex "a?" n times followed
+ * by "a" n times, against a string of n a's.  Without remembering the states
+ * it has explored, the backtracking engine tries 2^n ways to skip the
+ * optional operators.
+ */
+void benchPathological(int n) {
+    string expr;
+    for (int i = 0; i < n; i++)
+        expr += "a?";
+    expr += string(n, 'a');
+    vector<RegexOperator *> regex = parseRegex(expr);
+    string s(n, 'a');
+    MatchContext ctx;
+    const RegexEngine engines[] = { ENGINE_BACKTRACK, ENGINE_NFA };
+
+    cout << left << setw(20) << n << right << fixed << setprecision(3);
+    for (RegexEngine engine : engines) {
+        auto start = chrono::steady_clock::now();
+        Range r = find(regex, s, ctx, engine);
+        auto end = chrono::steady_clock::now();
+
+        // Keep the compiler from discarding the search.
+        if (r.end < 0)
+            cout << r.end;
+        cout << setw(12) << chrono::duration<double>(end - start).count() * 1e3;
+    }
+    cout << endl;
+
+    for (RegexOperator *op : regex)
+        delete op;
+}
+
+
+/* Compares the string-based and bitmap character classes for the class
+ * "[body]" (or "[^body]" if exclude is set), both on their own and in the
+ * regex "[body]+;", which never matches the generated lines.
+ */
+void benchClass(const string &body, bool exclude,
+                const vector<string> &lines) {
+    string cls = string(exclude ? "[^" : "[") + body + "]";
+
+    vector<RegexOperator *> before;
+    before.push_back(new StringSubset(expandClass(body), exclude));
+    before.back()->setMaxRepeat(-1);
+    before.push_back(new MatchChar(';'));
+
+    vector<RegexOperator *> after = parseRegex(cls + "+;");
+
+    cout << left << setw(20) << cls << right << fixed << setprecision(1)
+         << setw(10) << classThroughput(before[0], lines)
+         << setw(10) << classThroughput(after[0], lines)
+         << setw(10) << findThroughput(before, lines)
+         << setw(10) << findThroughput(after, lines) << endl;
+
+    for (RegexOperator *op : before)
+        delete op;
+    for (RegexOperator *op : after)
+        delete op;
+}
+
+
+int main() {
+    vector<string> lines = makeLines(4 << 20);
+
+    cout << "Throughput in MB/s, with classes as strings (before) and as"
+         << " bitmaps (after)." << endl << endl;
+    cout << left << setw(20) << "" << right << setw(20) << "class test"
+         << setw(20) << "find \"[...]+;\"" << endl;
+    cout << left << setw(20) << "class" << right
+         << setw(10) << "before" << setw(10) << "after"
+         << setw(10) << "before" << setw(10) << "after" << endl;
+
+    benchClass("abc", false, lines);
+    benchClass("a-zA-Z0-9_", false, lines);
+    benchClass("a-zA-Z0-9_./=-", false, lines);
+    benchClass(" \t,.:!?()", true, lines);
+    benchClass("0-9A-F", true, lines);
+
+    cout << endl << "Throughput in MB/s, trying every start index (before) and"
+         << " skipping to" << endl << "indexes where a match can begin"
+         << " (after)." << endl << endl;
+    cout << left << setw(20) << "regex" << right
+         << setw(10) << "before" << setw(10) << "after" << endl;
+
+    benchScan("ERROR.*timeout;", lines);
+    benchScan("x?[0-9]+;", lines);
+    benchScan("[#$%]+", lines);
+    benchScan("q*u*e*r*y*;", lines);
+
+    cout << endl << "Throughput in MB/s, backtracking over the regex operators"
+         << " (before) and" << endl << "over the regex compiled to bytecode"
+         << " (after)." << endl << endl;
+    cout << left << setw(24) << "regex" << right
+         << setw(10) << "before" << setw(10) << "after" << endl;
+
+    benchBytecode("[a-z]+_[a-z]+=[0-9]+", lines);
+    benchBytecode("h.*o.*s.*t.*-.*9", lines);
+    benchBytecode("[^ ]*[^ ]*[^ ]*;", lines);
+    benchBytecode("x?[0-9]+;", lines);
+
+    cout << endl << "Throughput in MB/s of each engine on a compiled regex."
+         << endl << endl;
+    cout << left << setw(24) << "regex" << right << setw(11) << "backtrack"
+         << setw(11) << "nfa" << setw(11) << "dfa" << setw(11) << "shift-and"
+         << endl;
+
+    benchEngines("ERROR.*timeout;", lines);
+    benchEngines("[a-z]+_[a-z]+=[0-9]+", lines);
+    benchEngines("h.*o.*s.*t.*-.*9", lines);
+    benchEngines("[^ ]*[^ ]*[^ ]*;", lines);
+
+    cout << endl << "Throughput in MB/s, searching for each pattern in turn"
+         << " (before) and" << endl << "for all of them with a RegexSet"
+         << " (after)." << endl << endl;
+    cout << left << setw(20) << "patterns" << right
+         << setw(10) << "before" << setw(10) << "after" << endl;
+
+    benchSet(10, lines);
+    benchSet(100, lines);
+    benchSet(400, lines);
+
+    cout << endl << "Throughput in MB/s of the backtracking engine (before) and"
+         << " a regex" << endl << "parsed at compile time (after)." << endl
+         << endl;
+    cout << left << setw(24) << "regex" << right
+         << setw(10) << "before" << setw(10) << "after" << endl;
+
+    benchStatic<staticWord>(lines);
+    benchStatic<staticHost>(lines);
+    benchStatic<staticTimeout>(lines);
+
+    cout << endl << "Throughput in MB/s, extracting fields with a find() for"
+         << " each (before) and" << endl << "with the groups of one"
+         << " CaptureRegex (after)." << endl << endl;
+    cout << left << setw(20) << "fields" << right
+         << setw(10) << "before" << setw(10) << "after" << endl;
+
+    benchCaptures(makeRecords(1 << 20));
+
+    cout << endl << "Time in ms to match (a?)^n a^n against a^n." << endl
+         << endl;
+    cout << left << setw(20) << "n" << right << setw(12) << "backtrack"
+         << setw(12) << "nfa" << endl;
+
+    benchPathological(25);
+    benchPathological(50);
+    benchPathological(100);
+    benchPathological(200);
+    benchPathological(400);
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include "bytecode.h"
+
+#include <algorithm>
+
+
+/* Compile a vector of regex operators into a bytecode program.  Each
+ * operator is classified by the set of characters it accepts, so that any
+ * operator can be compiled, not only the ones that parseRegex() creates.
+ */
+BytecodeProgram::BytecodeProgram(const vector<RegexOperator *> &regex)
+    : starts(firstCharScanner(regex)), givesBack(::givesBack(regex)) {
+    for (const RegexOperator *op : regex) {
+        CharSet set = op->charSet();
+        int count = set.count();
+
+        BytecodeInst inst = {BytecodeInst::CLASS, 0, -1,
+                             op->getMinRepeat(), op->getMaxRepeat(),
+                             op->isPossessive()};
+        if (count == 256) {
+            inst.opcode = BytecodeInst::ANY;
+        }
+        else if (count == 1) {
+            inst.opcode = BytecodeInst::CHAR;
+            while (!set.contains(inst.ch))
+                inst.ch++;
+        }
+        else {
+            inst.cls = (int) classes.size();
+            classes.push_back(set);
+        }
+        insts.push_back(inst);
+    }
+}
+
+
+/* Returns the number of instructions in the program. */
+int BytecodeProgram::size() const {
+    return (int) insts.size();
+}
+
+
+/* Returns true if a search of a string with the given length would need to
+ * remember more than BACKTRACK_MEMO_MAX_STATES states, and so could take
+ * exponential time without them.
+ */
+bool BytecodeProgram::outgrowsMemo(size_t length) const {
+    return givesBack &&
+        (length + 1) * insts.size() > BACKTRACK_MEMO_MAX_STATES;
+}
+
+
+/* Initialize all of the counters to zero. */
+MatchStats::MatchStats()
+    : searches(0), starts(0), steps(0), backtracks(0), maxDepth(0),
+      bytesScanned(0) { }
+
+
+/* Add the counters of other to these counters.  The maximum depth is the
+ * larger of the two.
+ */
+void MatchStats::add(const MatchStats &other) {
+    searches += other.searches;
+    starts += other.starts;
+    steps += other.steps;
+    backtracks += other.backtracks;
+    maxDepth = max(maxDepth, other.maxDepth);
+    bytesScanned += other.bytesScanned;
+}
+
+
+/* Initialize limits that allow a search any amount of work. */
+MatchLimits::MatchLimits()
+    : maxSteps(ULONG_MAX), maxBacktracks(ULONG_MAX), hasDeadline(false) { }
+
+
+/* Set the deadline to the given time from now. */
+void MatchLimits::setTimeout(chrono::steady_clock::duration timeout) {
+    hasDeadline = true;
+    deadline = chrono::steady_clock::now() + timeout;
+}
+
+
+/* Initialize empty scratch space.  Its buffers grow as needed. */
+BacktrackScratch::BacktrackScratch()
+    : collectStats(false), visitedLow(0), visitedHigh(0) { }
+
+
+/* Prepare to remember up to numStates explored states.  Returns false if
+ * that is too many, in which case the search must not call visit().
+ */
+bool BacktrackScratch::startVisits(size_t numStates) {
+    if (numStates > BACKTRACK_MEMO_MAX_STATES)
+        return false;
+    if (visited.size() * 64 < numStates)
+        visited.resize(numStates / 64 + 1, 0);
+    return true;
+}
+
+
+/* Marks the state as explored.  Returns true if it already was. */
+bool BacktrackScratch::visit(size_t state) {
+    uint64_t bit = (uint64_t) 1 << (state & 63);
+    size_t word = state >> 6;
+    bool seen = (visited[word] & bit) != 0;
+    visited[word] |= bit;
+    visitedLow = min(visitedLow, word);
+    visitedHigh = max(visitedHigh, word + 1);
+    return seen;
+}
+
+
+/* Clears the bits of all of the explored states. */
+void BacktrackScratch::clearVisited() {
+    if (visitedLow < visitedHigh)
+        fill(visited.begin() + visitedLow, visited.begin() + visitedHigh, 0);
+    visitedLow = visited.size();
+    visitedHigh = 0;
+}
+
+
+/* Returns how many times in a row, up to max (or without limit if max is -1),
+ * the instruction accepts the characters of s starting at the index pos.
+ */
+static inline ptrdiff_t countRepeats(const BytecodeProgram &prog,
+                                     const BytecodeInst &inst, const char *s,
+                                     ptrdiff_t length, ptrdiff_t pos) {
+    ptrdiff_t limit = length - pos;
+    if (inst.maxRepeat != -1 && inst.maxRepeat < limit)
+        limit = inst.maxRepeat;
+
+    ptrdiff_t count = 0;
+    switch (inst.opcode) {
+        case BytecodeInst::CHAR:
+            while (count < limit && (unsigned char) s[pos + count] == inst.ch)
+                count++;
+            break;
+        case BytecodeInst::ANY:
+            count = limit;
+            break;
+        case BytecodeInst::CLASS: {
+            const CharSet &set = prog.classes[inst.cls];
+            while (count < limit &&
+                   set.contains((unsigned char) s[pos + count]))
+                count++;
+            break;
+        }
+    }
+    return count;
+}
+
+
+/* Run the bytecode program from the index start of s, with the same
+ * backtracking order as findAtIndex():  each instruction first takes as many
+ * repetitions as it can, and gives them back one at a time, latest
+ * instruction first, when the rest of the program fails.  Instead of a range
+ * for each repetition, a choice point records only the count.  Possessive
+ * instructions never give repetitions back, so they have no choice points.
+ *
+ * If memo is set, each (instruction, index) state that fails is remembered
+ * in the scratch space, and not explored again.  Every step and backtrack is
+ * counted against the budget, and the other work done is counted by the
+ * statistics policy.  Returns the end of the match, or -1 if there is none
+ * or the budget ran out.
+ */
+template <typename Stats>
+static ptrdiff_t runAt(const BytecodeProgram &prog, const char *s,
+                       ptrdiff_t length, ptrdiff_t start,
+                       BacktrackScratch &scratch, bool memo,
+                       MatchBudget &budget, Stats &stats) {
+    vector<BacktrackFrame> &frames = scratch.frames;
+    size_t numInsts = prog.insts.size();
+    frames.clear();
+
+    int pc = 0;
+    ptrdiff_t pos = start;
+    while (true) {
+        if (pc == (int) numInsts)
+            return pos;
+
+        if (!budget.step())
+            break;
+
+        const BytecodeInst &inst = prog.insts[pc];
+        bool failed = memo && scratch.visit(pos * numInsts + pc);
+        if (!failed) {
+            ptrdiff_t count = countRepeats(prog, inst, s, length, pos);
+            if (count >= inst.minRepeat) {
+                // Only an instruction that may give back repetitions needs
+                // a choice point.
+                if (count > inst.minRepeat && !inst.possessive)
+                    frames.push_back({pc, pos, count});
+                stats.apply(frames.size(), count);
+                pc++;
+                pos += count;
+                continue;
+            }
+        }
+
+        // Give back one repetition of the latest instruction that has more
+        // than it needs, dropping the choice points that have none to spare.
+        while (!frames.empty() &&
+               frames.back().count == prog.insts[frames.back().pc].minRepeat)
+            frames.pop_back();
+        if (frames.empty())
+            return -1;
+        if (!budget.backtrack())
+            break;
+
+        BacktrackFrame &frame = frames.back();
+        frame.count--;
+        pc = frame.pc + 1;
+        pos = frame.pos + frame.count;
+    }
+
+    // Out of budget:  drop the choice points, so that nothing of this
+    // search is left in the scratch space.
+    frames.clear();
+    return -1;
+}
+
+
+/* Find the first match of the bytecode program in the string s that starts
+ * at or after the index from, trying each index where a match can begin in
+ * turn.  The explored states are shared by all of the start indexes, since
+ * whether the rest of the program matches from a state does not depend on
+ * where the match began.  If no match is found, it returns a range of
+ * Range(-1, -1).
+ */
+Range bytecodeFind(const BytecodeProgram &prog, string_view s,
+                   BacktrackScratch &scratch, size_t from) {
+    Range matched(-1, -1);
+    bytecodeFind(prog, s, scratch, MatchLimits(), matched, from);
+    return matched;
+}
+
+
+/* Try each index of s from the index from on where a match of the program
+ * can begin, and return the first match, or Range(-1, -1) if there is none
+ * or the budget runs out.
+ */
+template <typename Stats>
+static Range findFrom(const BytecodeProgram &prog, string_view s,
+                      BacktrackScratch &scratch, bool memo,
+                      MatchBudget &budget, Stats &stats, size_t from) {
+    const char *data = s.data();
+    size_t length = s.length();
+    for (size_t i = prog.starts.next(data, from, length); i < length;
+         i = prog.starts.next(data, i + 1, length)) {
+        stats.start();
+        ptrdiff_t end = runAt(prog, data, length, i, scratch, memo, budget,
+                              stats);
+        if (end != -1)
+            return Range(i, end);
+        if (budget.exceeded)
+            break;
+    }
+    return Range(-1, -1);
+}
+
+
+/* Find the first match of the bytecode program in the string s that starts
+ * at or after the index from, doing no more work than the limits allow.
+ * Returns MATCH_FOUND and sets matched to the match's range, MATCH_NOT_FOUND
+ * if there is no match, or MATCH_BUDGET_EXCEEDED if the search gave up; in
+ * the last two cases matched is set to Range(-1, -1).  The scratch space is
+ * left ready for the next search either way.  If the scratch space collects
+ * statistics, its counters are set to the work done by this search.
+ */
+MatchStatus bytecodeFind(const BytecodeProgram &prog, string_view s,
+                         BacktrackScratch &scratch, const MatchLimits &limits,
+                         Range &matched, size_t from) {
+    bool memo = prog.givesBack &&
+        scratch.startVisits((s.length() + 1) * prog.insts.size());
+    MatchBudget budget(limits);
+
+    if (scratch.collectStats) {
+        MatchStats &stats = scratch.stats;
+        stats = MatchStats();
+        CountMatchStats counter{stats};
+        matched = findFrom(prog, s, scratch, memo, budget, counter, from);
+        stats.searches = 1;
+        stats.steps = budget.steps;
+        stats.backtracks = budget.backtracks;
+    }
+    else {
+        NoMatchStats none;
+        matched = findFrom(prog, s, scratch, memo, budget, none, from);
+    }
+
+    if (memo)
+        scratch.clearVisited();
+    if (budget.exceeded)
+        return MATCH_BUDGET_EXCEEDED;
+    return matched.start != -1 ? MATCH_FOUND : MATCH_NOT_FOUND;
+}
@@ -0,0 +1,363 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "regex.h"
+#include "scan.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+
+// The largest number of (operator, string index) states that the
+// backtracking engines remember.  A longer string is searched by the NFA
+// instead, unless the regex needs backtracking, in which case it is searched
+// without remembering them.
+#define BACKTRACK_MEMO_MAX_STATES (1 << 27)
+
+// How many steps a search with a deadline takes between looks at the clock.
+#define MATCH_DEADLINE_CHECK_STEPS 1024
+
+
+/* The outcome of a search that may give up:  a match was found, there is no
+ * match, or the search exceeded its limits before it could tell which.
+ */
+enum MatchStatus {
+    MATCH_FOUND,
+    MATCH_NOT_FOUND,
+    MATCH_BUDGET_EXCEEDED
+};
+
+
+/* Limits on the work that one search by a backtracking engine may do, for
+ * patterns that cannot be trusted not to take exponential time.  A step is
+ * one application of an operator, and a backtrack is one repetition given
+ * back; both are counted over all of the start indexes a search tries.  By
+ * default there are no limits.
+ */
+struct MatchLimits {
+    // The most steps and backtracks a search may take.
+    unsigned long maxSteps;
+    unsigned long maxBacktracks;
+
+    // The time by which the search must finish, if hasDeadline is set.
+    bool hasDeadline;
+    chrono::steady_clock::time_point deadline;
+
+    MatchLimits();
+
+    void setTimeout(chrono::steady_clock::duration timeout);
+};
+
+
+/* The work done so far by one search, checked against its limits.  Once a
+ * limit is exceeded, exceeded is set and every later check fails, so that the
+ * search unwinds without doing more work.
+ */
+class MatchBudget {
+    const MatchLimits &limits;
+
+public:
+    unsigned long steps, backtracks;
+    bool exceeded;
+
+    MatchBudget(const MatchLimits &limits)
+        : limits(limits), steps(0), backtracks(0), exceeded(false) { }
+
+    // Count a step.  Returns false if the search must give up.
+    bool step() {
+        if (++steps > limits.maxSteps)
+            exceeded = true;
+        else if (limits.hasDeadline &&
+                 steps % MATCH_DEADLINE_CHECK_STEPS == 0 &&
+                 chrono::steady_clock::now() > limits.deadline)
+            exceeded = true;
+        return !exceeded;
+    }
+
+    // Count a backtrack.  Returns false if the search must give up.
+    bool backtrack() {
+        if (++backtracks > limits.maxBacktracks)
+            exceeded = true;
+        return !exceeded;
+    }
+};
+
+
+/* Counters of the work done by the backtracking engines, so that the
+ * patterns that use the most time can be found.  A search with statistics
+ * enabled sets them for that one search; CompiledRegex adds them up over all
+ * of its searches.
+ */
+struct MatchStats {
+    // The searches counted, and the start indexes they tried.
+    unsigned long searches;
+    unsigned long starts;
+
+    // Operators applied, and repetitions given back.
+    unsigned long steps;
+    unsigned long backtracks;
+
+    // The most choice points held at once.
+    unsigned long maxDepth;
+
+    // The characters matched by the operators applied, counting a character
+    // again each time it is matched again after backtracking.
+    unsigned long bytesScanned;
+
+    MatchStats();
+
+    void add(const MatchStats &other);
+};
+
+
+/* The statistics policies that the backtracking engines are templates over.
+ * NoMatchStats counts nothing, so a search without statistics compiles to
+ * the same code as one with no counters at all; CountMatchStats adds to a
+ * MatchStats.  The steps and backtracks are taken from the search's budget.
+ */
+struct NoMatchStats {
+    void start() { }
+    void apply(size_t depth, ptrdiff_t count) { }
+};
+
+struct CountMatchStats {
+    MatchStats &stats;
+
+    void start() {
+        stats.starts++;
+    }
+
+    void apply(size_t depth, ptrdiff_t count) {
+        stats.bytesScanned += count;
+        if (depth > stats.maxDepth)
+            stats.maxDepth = depth;
+    }
+};
+
+
+/* A single instruction of a bytecode program:  one regex operator, with its
+ * repeat counts.  CHAR accepts the character ch, ANY accepts any character,
+ * and CLASS accepts the characters in the program's class with index cls.
+ * A possessive instruction never gives back its repetitions.  Instructions
+ * are plain data, so a whole program is one contiguous array.
+ */
+struct BytecodeInst {
+    enum Opcode { CHAR, ANY, CLASS };
+
+    Opcode opcode;
+    unsigned char ch;
+    int cls;
+    int minRepeat;
+    int maxRepeat;
+    bool possessive;
+};
+
+
+/* A regex compiled into a flat array of instructions, one per operator, and
+ * the character classes that its CLASS instructions refer to.  Running a
+ * program needs no virtual calls and no pointers to separately allocated
+ * operators.
+ */
+class BytecodeProgram {
+public:
+    vector<BytecodeInst> insts;
+    vector<CharSet> classes;
+
+    // Finds the indexes where a match can begin.
+    ByteScanner starts;
+
+    // True if some instruction can give back repetitions, so that a search
+    // needs to remember the states it has explored; see givesBack().
+    bool givesBack;
+
+    BytecodeProgram(const vector<RegexOperator *> &regex);
+
+    int size() const;
+    bool outgrowsMemo(size_t length) const;
+};
+
+
+/* A choice point of a backtracking engine:  the instruction (or operator)
+ * at pc was applied count times, starting at the index pos.
+ */
+struct BacktrackFrame {
+    int pc;
+    ptrdiff_t pos;
+    ptrdiff_t count;
+};
+
+
+/* Scratch space for the backtracking engines, so that repeated searches do
+ * not have to allocate again.
+ */
+struct BacktrackScratch {
+    BacktrackScratch();
+
+    // The choice points of findAtIndex() or the bytecode backtracker.
+    vector<BacktrackFrame> frames;
+
+    // If collectStats is set, each search sets stats to the work it did.
+    bool collectStats;
+    MatchStats stats;
+
+    // A bit for each (string index, operator) state that has already been
+    // explored without finding a match, and the range of words that may have
+    // bits set:  (length + 1) * operators bits for a string, allocated only
+    // for a regex that can give back repetitions.  All bits are clear
+    // between searches.
+    vector<uint64_t> visited;
+    size_t visitedLow, visitedHigh;
+
+    bool startVisits(size_t numStates);
+    bool visit(size_t state);
+    void clearVisited();
+};
+
+
+Range bytecodeFind(const BytecodeProgram &prog, string_view s,
+                   BacktrackScratch &scratch, size_t from = 0);
+MatchStatus bytecodeFind(const BytecodeProgram &prog, string_view s,
+                         BacktrackScratch &scratch, const MatchLimits &limits,
+                         Range &matched, size_t from = 0);
+
+
+/* A choice point of the bytecode backtracker over an iterator range:  the
+ * instruction at pc was applied count times, starting at pos, which is index
+ * characters into the range.
+ */
+template <typename Iter>
+struct IteratorFrame {
+    int pc;
+    Iter pos;
+    ptrdiff_t index;
+    ptrdiff_t count;
+};
+
+
+/* Returns how many times in a row, up to the instruction's maximum and at
+ * most limit times, the instruction accepts the characters from pos on, and
+ * moves pos past them.
+ */
+template <typename Iter>
+ptrdiff_t iteratorRepeats(const BytecodeProgram &prog,
+                          const BytecodeInst &inst, Iter &pos,
+                          ptrdiff_t limit) {
+    if (inst.maxRepeat != -1 && inst.maxRepeat < limit)
+        limit = inst.maxRepeat;
+
+    ptrdiff_t count = 0;
+    switch (inst.opcode) {
+        case BytecodeInst::CHAR:
+            while (count < limit && (unsigned char) *pos == inst.ch) {
+                ++pos;
+                count++;
+            }
+            break;
+        case BytecodeInst::ANY:
+            advance(pos, limit);
+            count = limit;
+            break;
+        case BytecodeInst::CLASS: {
+            const CharSet &set = prog.classes[inst.cls];
+            while (count < limit && set.contains((unsigned char) *pos)) {
+                ++pos;
+                count++;
+            }
+            break;
+        }
+    }
+    return count;
+}
+
+
+/* Run the bytecode program from start, which is index characters into a
+ * range of length characters, in the same order as the backtracker for
+ * strings.  Returns the index where the match ends, or -1 if there is none.
+ */
+template <typename Iter>
+ptrdiff_t iteratorRunAt(const BytecodeProgram &prog, Iter start,
+                        ptrdiff_t index, ptrdiff_t length,
+                        vector<IteratorFrame<Iter> > &frames,
+                        BacktrackScratch &scratch, bool memo) {
+    size_t numInsts = prog.insts.size();
+    frames.clear();
+
+    int pc = 0;
+    Iter pos = start;
+    while (true) {
+        if (pc == (int) numInsts)
+            return index;
+
+        const BytecodeInst &inst = prog.insts[pc];
+        bool failed = memo && scratch.visit(index * numInsts + pc);
+        if (!failed) {
+            Iter end = pos;
+            ptrdiff_t count = iteratorRepeats(prog, inst, end, length - index);
+            if (count >= inst.minRepeat) {
+                if (count > inst.minRepeat && !inst.possessive)
+                    frames.push_back({pc, pos, index, count});
+                pc++;
+                pos = end;
+                index += count;
+                continue;
+            }
+        }
+
+        while (!frames.empty() &&
+               frames.back().count == prog.insts[frames.back().pc].minRepeat)
+            frames.pop_back();
+        if (frames.empty())
+            return -1;
+
+        IteratorFrame<Iter> &frame = frames.back();
+        frame.count--;
+        pc = frame.pc + 1;
+        pos = next(frame.pos, frame.count);
+        index = frame.index + frame.count;
+    }
+}
+
+
+/* Find the first match of the bytecode program in the characters
+ * [first, last), with the indexes of the match counted from first, so that
+ * text kept in a deque or a rope can be searched without copying it into a
+ * string.  Backtracking reads characters again, so the iterators must be at
+ * least forward iterators, and giving back a repetition takes constant time
+ * only for random-access ones.  A contiguous range is searched as a
+ * string_view instead, with the fast paths that only work on memory.
+ */
+template <typename Iter>
+Range bytecodeFind(const BytecodeProgram &prog, Iter first, Iter last,
+                   BacktrackScratch &scratch) {
+    static_assert(IsMultiPassIterator<Iter>::value,
+                  "backtracking needs a forward iterator");
+    if constexpr (IsContiguousIterator<Iter>::value) {
+        return bytecodeFind(prog, contiguousView(first, last), scratch);
+    }
+    else {
+        ptrdiff_t length = distance(first, last);
+        bool memo = prog.givesBack &&
+            scratch.startVisits((length + 1) * prog.insts.size());
+        vector<IteratorFrame<Iter> > frames;
+
+        Range matched(-1, -1);
+        ptrdiff_t i = 0;
+        for (Iter start = first; i < length; ++start, i++) {
+            if (!prog.starts.contains(*start))
+                continue;
+            ptrdiff_t end = iteratorRunAt(prog, start, i, length, frames,
+                                          scratch, memo);
+            if (end != -1) {
+                matched = Range(i, end);
+                break;
+            }
+        }
+
+        if (memo)
+            scratch.clearVisited();
+        return matched;
+    }
+}
+
+#endif // BYTECODE_H
@@ -0,0 +1,96 @@
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+
+/* A set of byte values, stored as a 256-bit bitmap so that testing whether a
+ * character is in the set takes constant time, no matter how many characters
+ * the set contains.  Sets can be built in constant expressions, for regexes
+ * that are parsed at compile time.
+ */
+class CharSet {
+    uint64_t bits[4];
+
+public:
+    // Initialize an empty set.
+    constexpr CharSet() : bits{0, 0, 0, 0} { }
+
+    // Add the character c to the set.
+    constexpr void add(unsigned char c) {
+        bits[c >> 6] |= (uint64_t) 1 << (c & 63);
+    }
+
+    // Add every character from lo to hi, inclusive, to the set.
+    constexpr void addRange(unsigned char lo, unsigned char hi) {
+        for (int c = lo; c <= hi; c++)
+            add((unsigned char) c);
+    }
+
+    // Add every character of the string s to the set.
+    void addAll(const string &s) {
+        for (char c : s)
+            add((unsigned char) c);
+    }
+
+    // Add every character of the set other to this set.
+    constexpr void addAll(const CharSet &other) {
+        for (int i = 0; i < 4; i++)
+            bits[i] |= other.bits[i];
+    }
+
+    // Replace the set with its complement.
+    constexpr void invert() {
+        for (int i = 0; i < 4; i++)
+            bits[i] = ~bits[i];
+    }
+
+    // Returns true if the character c is in the set.
+    constexpr bool contains(unsigned char c) const {
+        return (bits[c >> 6] >> (c & 63)) & 1;
+    }
+
+    // Returns true if any character is in both this set and the set other.
+    constexpr bool intersects(const CharSet &other) const {
+        for (int i = 0; i < 4; i++) {
+            if (bits[i] & other.bits[i])
+                return true;
+        }
+        return false;
+    }
+
+    // Returns true if the two sets hold the same characters.
+    constexpr bool operator==(const CharSet &other) const {
+        for (int i = 0; i < 4; i++) {
+            if (bits[i] != other.bits[i])
+                return false;
+        }
+        return true;
+    }
+
+    constexpr bool operator!=(const CharSet &other) const {
+        return !(*this == other);
+    }
+
+    // Returns the number of characters in the set.
+    int count() const {
+        int n = 0;
+        for (int i = 0; i < 4; i++)
+            n += __builtin_popcountll(bits[i]);
+        return n;
+    }
+
+    // Returns the smallest character in the set, or -1 if it is empty.
+    int first() const {
+        for (int i = 0; i < 4; i++) {
+            if (bits[i])
+                return 64 * i + __builtin_ctzll(bits[i]);
+        }
+        return -1;
+    }
+};
+
+#endif // CHARSET_H
@@ -0,0 +1,375 @@
+#include "compiled.h"
+
+
+/* Initialize all of the totals to zero. */
+AtomicMatchStats::AtomicMatchStats()
+    : searches(0), starts(0), steps(0), backtracks(0), maxDepth(0),
+      bytesScanned(0) { }
+
+
+/* Add the statistics of a search to the totals.  Each counter is updated on
+ * its own, so a reader may see a search partly added.
+ */
+void AtomicMatchStats::add(const MatchStats &stats) {
+    searches.fetch_add(stats.searches, memory_order_relaxed);
+    starts.fetch_add(stats.starts, memory_order_relaxed);
+    steps.fetch_add(stats.steps, memory_order_relaxed);
+    backtracks.fetch_add(stats.backtracks, memory_order_relaxed);
+    bytesScanned.fetch_add(stats.bytesScanned, memory_order_relaxed);
+
+    unsigned long depth = maxDepth.load(memory_order_relaxed);
+    while (stats.maxDepth > depth &&
+           !maxDepth.compare_exchange_weak(depth, stats.maxDepth,
+                                           memory_order_relaxed)) { }
+}
+
+
+/* Returns a copy of the totals. */
+MatchStats AtomicMatchStats::load() const {
+    MatchStats stats;
+    stats.searches = searches.load(memory_order_relaxed);
+    stats.starts = starts.load(memory_order_relaxed);
+    stats.steps = steps.load(memory_order_relaxed);
+    stats.backtracks = backtracks.load(memory_order_relaxed);
+    stats.maxDepth = maxDepth.load(memory_order_relaxed);
+    stats.bytesScanned = bytesScanned.load(memory_order_relaxed);
+    return stats;
+}
+
+
+/* Set all of the totals back to zero. */
+void AtomicMatchStats::reset() {
+    searches = 0;
+    starts = 0;
+    steps = 0;
+    backtracks = 0;
+    maxDepth = 0;
+    bytesScanned = 0;
+}
+
+
+/* Parse and compile the regex expr. */
+CompiledRegex::CompiledRegex(const string &expr)
+    : expr(expr), ops(parseRegex(expr)), code(ops), prog(ops),
+      required(requiredLiteral(ops)),
+      backtrackOnly(needsBacktracking(ops) || !prog.complete()),
+      id(newRegexId()) {
+    if (ShiftAndMatcher::supports(ops))
+        shiftAnd.reset(new ShiftAndMatcher(ops));
+    if (!backtrackOnly) {
+        dense.reset(new DenseMatcher(ops));
+        if (!dense->complete())
+            dense.reset();
+    }
+}
+
+
+/* Delete the regex operators owned by the compiled regex. */
+CompiledRegex::~CompiledRegex() {
+    for (RegexOperator *op : ops)
+        delete op;
+}
+
+
+/* Returns the pattern text the regex was compiled from. */
+const string & CompiledRegex::pattern() const {
+    return expr;
+}
+
+
+/* Returns the parsed regex operators. */
+const vector<RegexOperator *> & CompiledRegex::operators() const {
+    return ops;
+}
+
+
+/* Returns the NFA program compiled from the regex operators. */
+const NFAProgram & CompiledRegex::program() const {
+    return prog;
+}
+
+
+/* Returns an estimate of the number of bytes the compiled regex occupies,
+ * including its operators and programs.  The DFAs built in match contexts
+ * are not counted, since they belong to the contexts.
+ */
+size_t CompiledRegex::memoryUsage() const {
+    size_t bytes = sizeof(CompiledRegex) + expr.capacity();
+
+    // Every operator is counted as the largest kind of operator.
+    bytes += ops.capacity() * sizeof(RegexOperator *) +
+        ops.size() * sizeof(MatchFromSubset);
+    bytes += code.insts.capacity() * sizeof(BytecodeInst) +
+        code.classes.capacity() * sizeof(CharSet);
+    bytes += prog.insts.capacity() * sizeof(NFAInst);
+    bytes += required.literal().capacity();
+    if (shiftAnd)
+        bytes += sizeof(ShiftAndMatcher);
+    if (dense)
+        bytes += dense->memoryUsage();
+    return bytes;
+}
+
+
+/* Returns the totals of the statistics collected by searches for the regex.
+ * Only the backtracking engine collects statistics.
+ */
+MatchStats CompiledRegex::stats() const {
+    return totals.load();
+}
+
+
+/* Set the regex's statistics back to zero. */
+void CompiledRegex::resetStats() const {
+    totals.reset();
+}
+
+
+/* Returns the lazily built DFA for this regex in the context, building a new
+ * one if the context's DFA was built for a different regex.
+ */
+LazyDFA & CompiledRegex::contextDFA(MatchContext &ctx) const {
+    if (ctx.dfaOwner != id || !ctx.dfa) {
+        ctx.dfa.reset(new LazyDFA(ops));
+        ctx.dfaOwner = id;
+    }
+    return *ctx.dfa;
+}
+
+
+/* Find the first match of the regex in the string s, using the calling
+ * thread's match context.
+ */
+Range CompiledRegex::find(string_view s, RegexEngine engine) const {
+    return find(s, threadMatchContext(), engine);
+}
+
+
+/* Find the first match of the regex in the string s, using the scratch state
+ * in ctx.  Strings that do not contain the required literal are rejected
+ * without running the engine.  If no match is found, it returns a range of
+ * Range(-1, -1).
+ */
+Range CompiledRegex::find(string_view s, MatchContext &ctx,
+                          RegexEngine engine) const {
+    return findFrom(s, 0, ctx, engine);
+}
+
+
+/* Find the first match of the regex in the string s that starts at or after
+ * the index from, using the scratch state in ctx.  Only the part of the
+ * string from that index on is checked for the required literal.  If no
+ * match is found, it returns a range of Range(-1, -1).
+ */
+Range CompiledRegex::findFrom(string_view s, size_t from, MatchContext &ctx,
+                              RegexEngine engine) const {
+    Range matched(-1, -1);
+    findFrom(s, from, ctx, MatchLimits(), matched, engine);
+    return matched;
+}
+
+
+/* Find the first match of the regex in the string s, doing no more work than
+ * the limits allow.  See findFrom() for the result.
+ */
+MatchStatus CompiledRegex::find(string_view s, MatchContext &ctx,
+                                const MatchLimits &limits, Range &matched,
+                                RegexEngine engine) const {
+    return findFrom(s, 0, ctx, limits, matched, engine);
+}
+
+
+/* Find the first match of the regex in the string s that starts at or after
+ * the index from, doing no more work than the limits allow.  Only the
+ * backtracking engine can exceed them, since the other engines take time
+ * linear in the length of the string.  A string too long for the
+ * backtracker to remember the states it explores is searched by the NFA,
+ * unless the regex needs backtracking.  Returns MATCH_FOUND and sets matched
+ * to the match's range; otherwise sets matched to Range(-1, -1), and returns
+ * MATCH_NOT_FOUND, or MATCH_BUDGET_EXCEEDED if the search gave up.  If the
+ * context collects statistics, they are added to the regex's totals.
+ */
+MatchStatus CompiledRegex::findFrom(string_view s, size_t from,
+                                    MatchContext &ctx,
+                                    const MatchLimits &limits,
+                                    Range &matched,
+                                    RegexEngine engine) const {
+    size_t length = s.length();
+    matched = Range(-1, -1);
+    if (from >= length)
+        return MATCH_NOT_FOUND;
+    if (required.find(s.data(), from, length) == length)
+        return MATCH_NOT_FOUND;
+    if (backtrackOnly)
+        engine = ENGINE_BACKTRACK;
+    else if (engine == ENGINE_BACKTRACK && code.outgrowsMemo(length))
+        engine = ENGINE_NFA;
+
+    if (engine == ENGINE_BACKTRACK) {
+        MatchStatus status = bytecodeFind(code, s, ctx.backtrack, limits,
+                                          matched, from);
+        if (ctx.backtrack.collectStats)
+            totals.add(ctx.backtrack.stats);
+        return status;
+    }
+
+    if (engine == ENGINE_SHIFTAND && shiftAnd)
+        matched = shiftAnd->find(s, from);
+    else if (engine == ENGINE_NFA || engine == ENGINE_SHIFTAND)
+        matched = nfaFind(prog, s, ctx.nfa, from);
+    else if (dense)
+        matched = dense->find(s, from);
+    else
+        matched = contextDFA(ctx).find(s, from);
+    return matched.start != -1 ? MATCH_FOUND : MATCH_NOT_FOUND;
+}
+
+
+/* Check if a string exactly matches the regex with all characters consumed,
+ * using the calling thread's match context.
+ */
+bool CompiledRegex::match(string_view s, RegexEngine engine) const {
+    return match(s, threadMatchContext(), engine);
+}
+
+
+/* Check if a string exactly matches the regex with all characters consumed,
+ * using the scratch state in ctx.
+ */
+bool CompiledRegex::match(string_view s, MatchContext &ctx,
+                          RegexEngine engine) const {
+    if (!required.occursIn(s))
+        return false;
+    if (backtrackOnly)
+        engine = ENGINE_BACKTRACK;
+    if (engine == ENGINE_DFA && dense)
+        return dense->match(s);
+    if (engine == ENGINE_DFA)
+        return contextDFA(ctx).match(s);
+    if (engine == ENGINE_SHIFTAND && shiftAnd)
+        return shiftAnd->match(s);
+
+    Range range = find(s, ctx, engine);
+    return range.start == 0 && (size_t) range.end == s.length();
+}
+
+
+/* Returns true if the regex can be searched over a single-pass input
+ * iterator as it is read:  one without possessive operators, which the NFA
+ * can run.  Other regexes read all of the input into memory first.
+ */
+bool CompiledRegex::supportsSinglePass() const {
+    return !backtrackOnly;
+}
+
+
+/* Count the non-overlapping matches of the regex in the string s, without
+ * building a list of them.
+ */
+int CompiledRegex::countMatches(string_view s, MatchContext &ctx,
+                                RegexEngine engine) const {
+    return findAll(s, ctx, [](const Range &) { }, engine);
+}
+
+
+/* Parse and compile the regex expr.  The result can be shared freely between
+ * threads.
+ */
+shared_ptr<const CompiledRegex> compileRegex(const string &expr) {
+    return make_shared<const CompiledRegex>(expr);
+}
+
+
+/* Parse the regex expr, with its groups and alternatives, and compile it for
+ * the Pike VM.
+ */
+CaptureRegex::CaptureRegex(const string &expr)
+    : expr(expr), prog(compileTree(expr)) { }
+
+
+/* Parse the regex expr into a syntax tree, and compile the tree. */
+PikeProgram CaptureRegex::compileTree(const string &expr) {
+    int numGroups = 0;
+    bool parsed = true;
+    RegexNode tree = parseRegexTree(expr, numGroups, parsed);
+    return PikeProgram(tree, numGroups, parsed);
+}
+
+
+/* Returns the pattern text the regex was compiled from. */
+const string & CaptureRegex::pattern() const {
+    return expr;
+}
+
+
+/* Returns the number of groups in the regex, not counting the whole match. */
+int CaptureRegex::numGroups() const {
+    return prog.numGroups;
+}
+
+
+/* Returns false if the regex was too large to compile, and so never matches.
+ */
+bool CaptureRegex::complete() const {
+    return prog.complete();
+}
+
+
+/* Find the first match of the regex in the string s, using the calling
+ * thread's match context.
+ */
+bool CaptureRegex::find(string_view s, vector<Range> &groups) const {
+    return find(s, groups, threadMatchContext());
+}
+
+
+/* Find the first match of the regex in the string s, using the scratch state
+ * in ctx.  groups is set to numGroups() + 1 ranges:  the whole match, then
+ * each group in turn, with a range of Range(-1, -1) for a group that took no
+ * part in the match.  Returns false if there is no match.
+ */
+bool CaptureRegex::find(string_view s, vector<Range> &groups,
+                        MatchContext &ctx) const {
+    return pikeFind(prog, s, ctx.pike, groups);
+}
+
+
+/* Check if a string exactly matches the regex with all characters consumed,
+ * using the calling thread's match context.
+ */
+bool CaptureRegex::match(string_view s, vector<Range> &groups) const {
+    return match(s, groups, threadMatchContext());
+}
+
+
+/* Check if a string exactly matches the regex with all characters consumed,
+ * using the scratch state in ctx, and set groups as find() does.  Unlike a
+ * search, this may choose a later alternative over an earlier one, if only
+ * the later one reaches the end of the string.
+ */
+bool CaptureRegex::match(string_view s, vector<Range> &groups,
+                         MatchContext &ctx) const {
+    return pikeMatch(prog, s, ctx.pike, groups);
+}
+
+
+/* Start iterating over the matches of the regex in the string s. */
+MatchIterator::MatchIterator(const CompiledRegex &regex, string_view s,
+                             MatchContext &ctx, RegexEngine engine)
+    : regex(regex), s(s), ctx(ctx), engine(engine), from(0) { }
+
+
+/* Find the next match, and store its range in r.  Returns false once there
+ * are no more matches.
+ */
+bool MatchIterator::next(Range &r) {
+    Range found = regex.findFrom(s, from, ctx, engine);
+    if (found.start == -1) {
+        from = s.length();
+        return false;
+    }
+
+    r = found;
+    from = (found.end > found.start) ? found.end : found.end + 1;
+    return true;
+}
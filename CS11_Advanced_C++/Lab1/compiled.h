@@ -0,0 +1,253 @@
+#ifndef COMPILED_H
+#define COMPILED_H
+
+#include "engine.h"
+
+#include <atomic>
+
+
+/* Totals of the statistics of many searches, which any number of threads may
+ * add to at once.  Each search counts its own work in its context, and adds
+ * it here once, when it is done.
+ */
+class AtomicMatchStats {
+public:
+    AtomicMatchStats();
+
+    void add(const MatchStats &stats);
+    MatchStats load() const;
+    void reset();
+
+private:
+    atomic<unsigned long> searches, starts, steps, backtracks, maxDepth,
+        bytesScanned;
+};
+
+
+/* A regex that has been parsed and compiled once, so that it can be used for
+ * any number of searches.  A CompiledRegex is never modified after it is
+ * constructed:  all of the state needed during a search lives in a
+ * MatchContext, so one CompiledRegex can be shared by many threads without
+ * locking, as long as each thread uses its own context.  The calls that do
+ * not take a context use one that is local to the calling thread.
+ *
+ * Searches with a context that collects statistics add them to the regex's
+ * totals, so that the regexes that take the most work can be found.
+ *
+ * The CompiledRegex owns its regex operators, and deletes them when it is
+ * destroyed.
+ */
+class CompiledRegex {
+public:
+    CompiledRegex(const string &expr);
+    ~CompiledRegex();
+
+    CompiledRegex(const CompiledRegex &) = delete;
+    CompiledRegex & operator=(const CompiledRegex &) = delete;
+
+    const string & pattern() const;
+    const vector<RegexOperator *> & operators() const;
+    const NFAProgram & program() const;
+    size_t memoryUsage() const;
+    MatchStats stats() const;
+    void resetStats() const;
+
+    Range find(string_view s, RegexEngine engine = ENGINE_BACKTRACK) const;
+    Range find(string_view s, MatchContext &ctx,
+               RegexEngine engine = ENGINE_BACKTRACK) const;
+    Range findFrom(string_view s, size_t from, MatchContext &ctx,
+                   RegexEngine engine = ENGINE_BACKTRACK) const;
+    MatchStatus find(string_view s, MatchContext &ctx,
+                     const MatchLimits &limits, Range &matched,
+                     RegexEngine engine = ENGINE_BACKTRACK) const;
+    MatchStatus findFrom(string_view s, size_t from, MatchContext &ctx,
+                         const MatchLimits &limits, Range &matched,
+                         RegexEngine engine = ENGINE_BACKTRACK) const;
+    bool match(string_view s, RegexEngine engine = ENGINE_BACKTRACK) const;
+    bool match(string_view s, MatchContext &ctx,
+               RegexEngine engine = ENGINE_BACKTRACK) const;
+
+    template <typename Iter>
+    Range find(Iter first, Iter last,
+               RegexEngine engine = ENGINE_BACKTRACK) const;
+    template <typename Iter>
+    Range find(Iter first, Iter last, MatchContext &ctx,
+               RegexEngine engine = ENGINE_BACKTRACK) const;
+    bool supportsSinglePass() const;
+
+    template <typename Callback>
+    int findAll(string_view s, MatchContext &ctx, Callback callback,
+                RegexEngine engine = ENGINE_BACKTRACK) const;
+    int countMatches(string_view s, MatchContext &ctx,
+                     RegexEngine engine = ENGINE_BACKTRACK) const;
+
+private:
+    // The pattern text this regex was compiled from.
+    string expr;
+
+    // The parsed regex operators, and the bytecode and NFA programs built
+    // from them.
+    vector<RegexOperator *> ops;
+    BytecodeProgram code;
+    NFAProgram prog;
+
+    // The literal that every match must contain.
+    LiteralSearcher required;
+
+    // The bit-parallel matcher, if the regex is simple enough for one.
+    unique_ptr<ShiftAndMatcher> shiftAnd;
+
+    // The minimized DFAs that ENGINE_DFA runs, if they were small enough to
+    // build; otherwise each context builds a LazyDFA.
+    unique_ptr<DenseMatcher> dense;
+
+    // Set if the regex has possessive operators that only the backtracking
+    // engine can run, in which case it is used whatever engine is asked for.
+    bool backtrackOnly;
+
+    // A unique id, so that match contexts can tell which regex their cached
+    // DFA was built for.
+    unsigned long id;
+
+    // The statistics of all of the searches that collected them.  They are
+    // not part of the regex's value, so searching does not count as
+    // modifying the regex.
+    mutable AtomicMatchStats totals;
+
+    LazyDFA & contextDFA(MatchContext &ctx) const;
+};
+
+
+shared_ptr<const CompiledRegex> compileRegex(const string &expr);
+
+
+/* A regex that may use groups, "(...)", and alternation, "a|b", and that
+ * reports the range of each group in a match as well as the whole match.
+ * Groups are numbered from 1 in the order of their opening parentheses, and
+ * may be repeated like any other operator; a repeated group reports its last
+ * repetition.  Matches are found by the Pike VM, which scans the string once
+ * however many groups there are.
+ *
+ * A pattern with more than REGEX_MAX_GROUPS groups, with groups nested more
+ * than REGEX_MAX_DEPTH deep, or with possessive repeats such as "*+", which
+ * the Pike VM cannot run, is rejected, as is one whose counted repeats
+ * expand past PIKE_MAX_INSTS instructions or PIKE_MAX_SLOTS capture slots:
+ * complete() returns false, and it never matches.
+ *
+ * Like a CompiledRegex, a CaptureRegex is never modified after it is
+ * constructed, so it can be shared by threads that use their own contexts.
+ */
+class CaptureRegex {
+public:
+    CaptureRegex(const string &expr);
+
+    const string & pattern() const;
+    int numGroups() const;
+    bool complete() const;
+
+    bool find(string_view s, vector<Range> &groups) const;
+    bool find(string_view s, vector<Range> &groups,
+              MatchContext &ctx) const;
+    bool match(string_view s, vector<Range> &groups) const;
+    bool match(string_view s, vector<Range> &groups,
+               MatchContext &ctx) const;
+
+private:
+    // The pattern text this regex was compiled from.
+    string expr;
+
+    // The Pike VM program built from the pattern's syntax tree.
+    PikeProgram prog;
+
+    static PikeProgram compileTree(const string &expr);
+};
+
+
+/* Steps through all of the non-overlapping matches of a compiled regex in a
+ * string, from left to right.  Each search resumes where the previous match
+ * ended, so the string is scanned once in total, and the engine keeps its
+ * state in the given context between matches instead of starting over.  An
+ * empty match is followed by a search from the next index, so that the
+ * iterator always makes progress.
+ *
+ * The regex, string and context must outlive the iterator.
+ */
+class MatchIterator {
+public:
+    MatchIterator(const CompiledRegex &regex, string_view s,
+                  MatchContext &ctx, RegexEngine engine = ENGINE_BACKTRACK);
+
+    bool next(Range &r);
+
+private:
+    const CompiledRegex &regex;
+    string_view s;
+    MatchContext &ctx;
+    RegexEngine engine;
+
+    // The index to resume searching from.
+    size_t from;
+};
+
+
+/* Calls callback(r) with the range r of each non-overlapping match of the
+ * regex in the string s, from left to right, and returns the number of
+ * matches.  No list of matches is built, so the memory used does not grow
+ * with the number of matches.
+ */
+template <typename Callback>
+int CompiledRegex::findAll(string_view s, MatchContext &ctx,
+                           Callback callback, RegexEngine engine) const {
+    MatchIterator iter(*this, s, ctx, engine);
+    int count = 0;
+    Range r(-1, -1);
+    while (iter.next(r)) {
+        callback(r);
+        count++;
+    }
+    return count;
+}
+
+
+/* Find the first match of the regex in the characters [first, last), using
+ * the calling thread's match context.
+ */
+template <typename Iter>
+Range CompiledRegex::find(Iter first, Iter last, RegexEngine engine) const {
+    return find(first, last, threadMatchContext(), engine);
+}
+
+
+/* Find the first match of the regex in the characters [first, last), using
+ * the scratch state in ctx, with the indexes of the match counted from first.
+ * A contiguous range is searched as a string_view, like any string.  Text in
+ * other containers, such as a deque or a rope, is searched in place:  by the
+ * bytecode backtracker if the engine is ENGINE_BACKTRACK or the regex needs
+ * it, and by the NFA otherwise, since the DFA and Shift-And engines need the
+ * text in memory.  A single-pass input iterator, such as an
+ * istreambuf_iterator, is searched by the NFA as it is read, if the regex
+ * supports that.  Otherwise the backtracker has to read characters again,
+ * so all of [first, last) is read into a string and searched there.
+ */
+template <typename Iter>
+Range CompiledRegex::find(Iter first, Iter last, MatchContext &ctx,
+                          RegexEngine engine) const {
+    if constexpr (IsContiguousIterator<Iter>::value) {
+        return find(contiguousView(first, last), ctx, engine);
+    }
+    else if constexpr (IsMultiPassIterator<Iter>::value) {
+        if (backtrackOnly || (engine == ENGINE_BACKTRACK &&
+                              !code.outgrowsMemo(distance(first, last))))
+            return bytecodeFind(code, first, last, ctx.backtrack);
+        return nfaFind(prog, first, last, ctx.nfa);
+    }
+    else {
+        if (!supportsSinglePass()) {
+            string text(first, last);
+            return find(string_view(text), ctx, engine);
+        }
+        return nfaFind(prog, first, last, ctx.nfa);
+    }
+}
+
+#endif // COMPILED_H
@@ -0,0 +1,416 @@
+#include "densedfa.h"
+
+#include <algorithm>
+#include <map>
+
+
+/* Compute the byte classes of a regex, by splitting the classes with the
+ * set of characters of each operator in turn.
+ */
+ByteClasses::ByteClasses(const vector<RegexOperator *> &regex) : count(1) {
+    fill(classOf, classOf + 256, 0);
+
+    for (const RegexOperator *op : regex) {
+        // Move the bytes of each class that are in the set to a new class,
+        // then number the classes again in the order of their first bytes,
+        // since a class may have moved to a new one as a whole.
+        CharSet set = op->charSet();
+        int split[256], ids[256], renumber[512];
+        fill(split, split + 256, -1);
+        int next = count;
+        for (int c = 0; c < 256; c++) {
+            int k = classOf[c];
+            if (set.contains((unsigned char) c)) {
+                if (split[k] == -1)
+                    split[k] = next++;
+                ids[c] = split[k];
+            }
+            else {
+                ids[c] = k;
+            }
+        }
+
+        fill(renumber, renumber + 512, -1);
+        count = 0;
+        for (int c = 0; c < 256; c++) {
+            if (renumber[ids[c]] == -1)
+                renumber[ids[c]] = count++;
+            classOf[c] = (unsigned char) renumber[ids[c]];
+        }
+    }
+
+    for (int c = 255; c >= 0; c--)
+        representative[classOf[c]] = (unsigned char) c;
+}
+
+
+/* Build the DFA for an NFA program, for an anchored search, or for an
+ * unanchored one that restarts the NFA at every index.  The classes must be
+ * those of the operators the program was compiled from.
+ */
+DenseDFA::DenseDFA(const NFAProgram &prog, const ByteClasses &classes,
+                   bool unanchored)
+    : classes(classes), states(0), startState(0), matchStates(0),
+      built(false) {
+    vector<int> next;
+    vector<bool> accepting;
+    if (prog.complete() && determinize(prog, unanchored, next, accepting)) {
+        minimize(next, accepting);
+        built = true;
+    }
+}
+
+
+/* Returns false if the DFA had too many states to be built. */
+bool DenseDFA::complete() const {
+    return built;
+}
+
+
+/* Returns the number of states of the minimized DFA. */
+int DenseDFA::numStates() const {
+    return states;
+}
+
+
+/* Returns the number of byte classes, which is the number of columns of the
+ * transition table.
+ */
+int DenseDFA::numClasses() const {
+    return classes.count;
+}
+
+
+/* Returns the number of bytes the DFA occupies. */
+size_t DenseDFA::memoryUsage() const {
+    return sizeof(DenseDFA) + table.capacity() * sizeof(uint16_t);
+}
+
+
+/* Returns the index of the state for the sorted NFA instructions insts,
+ * adding it to sets if it is new.
+ */
+static int stateFor(const vector<int> &insts, map<vector<int>, int> &index,
+                    vector<vector<int> > &sets) {
+    auto iter = index.find(insts);
+    if (iter != index.end())
+        return iter->second;
+
+    sets.push_back(insts);
+    index[insts] = (int) sets.size() - 1;
+    return (int) sets.size() - 1;
+}
+
+
+/* Returns the sorted instructions of the threads. */
+static vector<int> threadInsts(const vector<NFAThread> &threads) {
+    vector<int> insts;
+    for (const NFAThread &t : threads)
+        insts.push_back(t.pc);
+    sort(insts.begin(), insts.end());
+    return insts;
+}
+
+
+/* Build every state of the DFA that can be reached from the start, as sets
+ * of NFA instructions, the way a LazyDFA builds them one at a time.  next is
+ * set to the transition table, with a row for each state and a column for
+ * each byte class, and accepting to whether each state contains a MATCH
+ * instruction.  State 0 is the dead state, with no instructions.  Returns
+ * false if the DFA is too large.
+ */
+bool DenseDFA::determinize(const NFAProgram &prog, bool unanchored,
+                           vector<int> &next, vector<bool> &accepting) {
+    map<vector<int>, int> index;
+    vector<vector<int> > sets;
+    vector<NFAThread> threads;
+    vector<ptrdiff_t> onList(prog.size(), -1);
+    vector<int> stack;
+    ptrdiff_t generation = 0;
+    size_t totalInsts = 0;
+
+    stateFor(vector<int>(), index, sets);
+    addThread(prog, threads, onList, stack, generation, 0, 0);
+    startState = stateFor(threadInsts(threads), index, sets);
+
+    for (size_t s = 0; s < sets.size(); s++) {
+        totalInsts += sets[s].size();
+        if (sets.size() > DENSE_DFA_MAX_STATES ||
+            totalInsts > DENSE_DFA_MAX_INSTS)
+            return false;
+
+        bool isMatch = false;
+        for (int pc : sets[s]) {
+            if (prog.insts[pc].opcode == NFAInst::MATCH)
+                isMatch = true;
+        }
+        accepting.push_back(isMatch);
+
+        for (int k = 0; k < classes.count; k++) {
+            // The dead state stays dead, even in an unanchored DFA.
+            if (s == DENSE_DFA_DEAD) {
+                next.push_back(DENSE_DFA_DEAD);
+                continue;
+            }
+
+            char c = (char) classes.representative[k];
+            generation++;
+            threads.clear();
+            for (int pc : sets[s]) {
+                const NFAInst &inst = prog.insts[pc];
+                if (inst.opcode == NFAInst::CHAR && inst.op->matchChar(c))
+                    addThread(prog, threads, onList, stack, generation,
+                              pc + 1, 0);
+            }
+            if (unanchored)
+                addThread(prog, threads, onList, stack, generation, 0, 0);
+            next.push_back(stateFor(threadInsts(threads), index, sets));
+        }
+    }
+    return true;
+}
+
+
+/* Merge the equivalent states of the DFA with Hopcroft's algorithm, and
+ * build the table of the minimized DFA.  The states start out split into
+ * the match states and the rest, and a block of states is split whenever
+ * some of its states lead into a block on a byte class and others do not.
+ * Each time a block is split, only the smaller half needs to be used to
+ * split other blocks, so the algorithm takes O(n log n) steps for each class.
+ */
+void DenseDFA::minimize(const vector<int> &next,
+                        const vector<bool> &accepting) {
+    int n = (int) accepting.size();
+    int k = classes.count;
+
+    // The states that lead to each state on each class.
+    vector<vector<int> > from(n * k);
+    for (int s = 0; s < n; s++) {
+        for (int c = 0; c < k; c++)
+            from[next[s * k + c] * k + c].push_back(s);
+    }
+
+    vector<vector<int> > blocks(1);
+    vector<int> blockOf(n, 0);
+    for (int s = 0; s < n; s++) {
+        if (accepting[s]) {
+            if (blocks.size() == 1)
+                blocks.push_back(vector<int>());
+            blockOf[s] = 1;
+        }
+        blocks[blockOf[s]].push_back(s);
+    }
+
+    // The blocks still to be used as splitters.
+    vector<int> work;
+    vector<bool> pending(blocks.size(), false);
+    if (blocks.size() == 2) {
+        work.push_back(blocks[1].size() < blocks[0].size() ? 1 : 0);
+        pending[work.back()] = true;
+    }
+
+    vector<bool> isMarked(n, false);
+    vector<int> markCount(blocks.size(), 0);
+    while (!work.empty()) {
+        int a = work.back();
+        work.pop_back();
+        pending[a] = false;
+        vector<int> splitter = blocks[a];
+
+        for (int c = 0; c < k; c++) {
+            // Mark the states that lead into the splitter on this class.
+            vector<int> marked;
+            for (int t : splitter) {
+                for (int s : from[t * k + c]) {
+                    if (!isMarked[s]) {
+                        isMarked[s] = true;
+                        marked.push_back(s);
+                    }
+                }
+            }
+
+            vector<int> touched;
+            for (int s : marked) {
+                if (markCount[blockOf[s]]++ == 0)
+                    touched.push_back(blockOf[s]);
+            }
+
+            // Move the marked states of each block that has unmarked ones
+            // too to a new block.
+            for (int b : touched) {
+                if (markCount[b] < (int) blocks[b].size()) {
+                    int split = (int) blocks.size();
+                    blocks.push_back(vector<int>());
+                    vector<int> kept;
+                    for (int s : blocks[b]) {
+                        if (isMarked[s]) {
+                            blocks[split].push_back(s);
+                            blockOf[s] = split;
+                        }
+                        else {
+                            kept.push_back(s);
+                        }
+                    }
+                    blocks[b].swap(kept);
+                    markCount.push_back(0);
+                    pending.push_back(false);
+
+                    int add = split;
+                    if (!pending[b] && blocks[b].size() < blocks[split].size())
+                        add = b;
+                    pending[add] = true;
+                    work.push_back(add);
+                }
+                markCount[b] = 0;
+            }
+
+            for (int s : marked)
+                isMarked[s] = false;
+        }
+    }
+
+    // Number the blocks with the dead state's block first and the match
+    // states' blocks last.
+    vector<int> number(blocks.size(), -1);
+    states = 0;
+    number[blockOf[DENSE_DFA_DEAD]] = states++;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (number[b] == -1 && !accepting[blocks[b][0]])
+            number[b] = states++;
+    }
+    matchStates = states;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (number[b] == -1)
+            number[b] = states++;
+    }
+
+    table.assign(states * k, DENSE_DFA_DEAD);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        int s = blocks[b][0];
+        for (int c = 0; c < k; c++)
+            table[number[b] * k + c] = number[blockOf[next[s * k + c]]];
+    }
+    startState = number[blockOf[startState]];
+}
+
+
+/* Returns the NFA program of the regex with its operators in reverse
+ * order.
+ */
+static NFAProgram reversedProgram(const vector<RegexOperator *> &regex) {
+    vector<RegexOperator *> reversed(regex.rbegin(), regex.rend());
+    return NFAProgram(reversed);
+}
+
+
+/* Build the three DFAs for the regex. */
+DenseMatcher::DenseMatcher(const vector<RegexOperator *> &regex)
+    : starts(firstCharScanner(regex)), classes(regex),
+      unanchored(NFAProgram(regex), classes, true),
+      forward(NFAProgram(regex), classes, false),
+      backward(reversedProgram(regex), classes, false) {
+    assert(!needsBacktracking(regex));
+}
+
+
+/* Returns false if any of the DFAs was too large to build, in which case
+ * the matcher must not be used.
+ */
+bool DenseMatcher::complete() const {
+    return unanchored.complete() && forward.complete() &&
+        backward.complete();
+}
+
+
+/* Returns the number of bytes the matcher occupies. */
+size_t DenseMatcher::memoryUsage() const {
+    return sizeof(DenseMatcher) - 3 * sizeof(DenseDFA) +
+        unanchored.memoryUsage() + forward.memoryUsage() +
+        backward.memoryUsage();
+}
+
+
+/* Returns the end of the longest match starting at the index start, or -1
+ * if no match starts there.
+ */
+ptrdiff_t DenseMatcher::longestFrom(string_view s, ptrdiff_t start) const {
+    ptrdiff_t length = (ptrdiff_t) s.length();
+    int state = forward.start();
+    ptrdiff_t end = forward.isMatch(state) ? start : -1;
+
+    for (ptrdiff_t i = start; i < length; i++) {
+        state = forward.step(state, (unsigned char) s[i]);
+        if (state == DENSE_DFA_DEAD)
+            break;
+        if (forward.isMatch(state))
+            end = i + 1;
+    }
+    return end;
+}
+
+
+/* Find the first match of the regex in the string s that starts at or after
+ * the index from.  If no match is found, it returns a range of
+ * Range(-1, -1).
+ */
+Range DenseMatcher::find(string_view s, size_t from) const {
+    const char *data = s.data();
+    size_t length = s.length();
+    if (from >= length)
+        return Range(-1, -1);
+
+    // A regex that matches the empty string always matches at once.
+    if (forward.isMatch(forward.start()))
+        return Range(from, longestFrom(s, from));
+
+    // Find the earliest end of any match.
+    int start = unanchored.start();
+    int state = start;
+    ptrdiff_t earliestEnd = -1;
+    for (size_t i = from; i < length; ) {
+        if (state == start) {
+            i = starts.next(data, i, length);
+            if (i >= length)
+                break;
+        }
+        state = unanchored.step(state, (unsigned char) data[i++]);
+        if (unanchored.isMatch(state)) {
+            earliestEnd = i;
+            break;
+        }
+    }
+    if (earliestEnd == -1)
+        return Range(-1, -1);
+
+    // Run the reversed regex backward from there.  The leftmost start of a
+    // match ending there is also the leftmost start of any match.
+    ptrdiff_t matchStart = -1;
+    state = backward.start();
+    for (ptrdiff_t i = earliestEnd - 1; i >= (ptrdiff_t) from; i--) {
+        state = backward.step(state, (unsigned char) data[i]);
+        if (state == DENSE_DFA_DEAD)
+            break;
+        if (backward.isMatch(state))
+            matchStart = i;
+    }
+    assert(matchStart != -1);
+
+    return Range(matchStart, longestFrom(s, matchStart));
+}
+
+
+/* Check if a string exactly matches the regex with all characters
+ * consumed.
+ */
+bool DenseMatcher::match(string_view s) const {
+    if (s.empty())
+        return false;
+
+    int state = forward.start();
+    for (char c : s) {
+        state = forward.step(state, (unsigned char) c);
+        if (state == DENSE_DFA_DEAD)
+            return false;
+    }
+    return forward.isMatch(state);
+}
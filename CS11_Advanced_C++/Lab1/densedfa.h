@@ -0,0 +1,121 @@
+#ifndef DENSEDFA_H
+#define DENSEDFA_H
+
+#include "nfa.h"
+
+#include <cstdint>
+
+
+// The most states a DenseDFA may have before it is minimized, and the most
+// NFA instructions those states may hold in all.  Regexes whose DFA would be
+// larger are left to the LazyDFA.
+#define DENSE_DFA_MAX_STATES 4096
+#define DENSE_DFA_MAX_INSTS (1 << 16)
+
+// The state of a DenseDFA from which no match is possible.
+#define DENSE_DFA_DEAD 0
+
+
+/* A partition of the 256 byte values into classes of bytes that no operator
+ * of a regex can tell apart:  two bytes are in the same class if every
+ * operator accepts both or neither.  A DFA for the regex only needs a
+ * transition for each class instead of one for each byte.
+ */
+struct ByteClasses {
+    // The class of each byte, and the number of classes.
+    unsigned char classOf[256];
+    int count;
+
+    // A byte of each class.
+    unsigned char representative[256];
+
+    ByteClasses(const vector<RegexOperator *> &regex);
+};
+
+
+/* A DFA built in full from an NFA program, over the byte classes of the
+ * program's operators, then minimized with Hopcroft's
+ * algorithm, so that equivalent states are merged and all of the states from
+ * which no match is possible become the one dead state, DENSE_DFA_DEAD.  The
+ * transitions are a dense table with a row for each state and a column for
+ * each byte class, so running the DFA costs two table lookups per byte and no
+ * hashing or allocation.  For typical regexes the whole table is a few
+ * hundred bytes.
+ *
+ * The states are numbered so that the match states come last, so isMatch()
+ * is a single comparison.  If the DFA would be larger than
+ * DENSE_DFA_MAX_STATES states or DENSE_DFA_MAX_INSTS NFA instructions before
+ * minimization, it is not built, and complete() returns false.
+ *
+ * A DenseDFA is not modified by searching, so it is thread-safe.
+ */
+class DenseDFA {
+public:
+    DenseDFA(const NFAProgram &prog, const ByteClasses &classes,
+             bool unanchored);
+
+    bool complete() const;
+    int numStates() const;
+    int numClasses() const;
+    size_t memoryUsage() const;
+
+    // The start state.
+    int start() const {
+        return startState;
+    }
+
+    // Returns the state reached from the given state on the byte c.
+    int step(int state, unsigned char c) const {
+        return table[state * classes.count + classes.classOf[c]];
+    }
+
+    // Returns true if the state contains a match.
+    bool isMatch(int state) const {
+        return state >= matchStates;
+    }
+
+private:
+    ByteClasses classes;
+    vector<uint16_t> table;
+    int states;
+    int startState;
+    int matchStates;
+    bool built;
+
+    bool determinize(const NFAProgram &prog, bool unanchored,
+                     vector<int> &next, vector<bool> &accepting);
+    void minimize(const vector<int> &next, const vector<bool> &accepting);
+};
+
+
+/* A matcher that runs three minimized DFAs for a regex, in the same three
+ * passes as a LazyDFA:  an unanchored pass forward to the earliest end of a
+ * match, an anchored pass over the reversed regex backward from there to the
+ * leftmost start, and an anchored pass forward from that start to the end of
+ * the longest match.  While the first pass is in its start state, it skips
+ * ahead to the next byte that can begin a match.
+ *
+ * Since the DFAs are built in full when the matcher is constructed, the
+ * matcher is never modified by searching, and one matcher can be shared by
+ * any number of threads.  complete() is false if any of the DFAs was too
+ * large to build.  The regex must not need backtracking.
+ */
+class DenseMatcher {
+public:
+    DenseMatcher(const vector<RegexOperator *> &regex);
+
+    bool complete() const;
+    size_t memoryUsage() const;
+
+    Range find(string_view s, size_t from = 0) const;
+    bool match(string_view s) const;
+
+private:
+    ByteScanner starts;
+    ByteClasses classes;
+    DenseDFA unanchored, forward, backward;
+
+    ptrdiff_t longestFrom(string_view s, ptrdiff_t start) const;
+};
+
+#endif // DENSEDFA_H
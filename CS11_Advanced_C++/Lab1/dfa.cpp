@@ -0,0 +1,320 @@
+#include "dfa.h"
+
+#include <algorithm>
+
+
+/* Initialize the DFA for the given regex, and the DFA for the regex with its
+ * operators in reverse order.  No states are built until the DFA is used to
+ * search a string.
+ */
+LazyDFA::LazyDFA(const vector<RegexOperator *> &regex, size_t cacheBytes)
+    : LazyDFA(NFAProgram(regex), cacheBytes) {
+    vector<RegexOperator *> reversed(regex.rbegin(), regex.rend());
+    reverse.reset(new LazyDFA(NFAProgram(reversed), cacheBytes));
+}
+
+
+/* Initialize the DFA for an NFA program, which may have been compiled from
+ * several regexes.
+ */
+LazyDFA::LazyDFA(const NFAProgram &prog, size_t cacheBytes)
+    : prog(prog), cacheBytes(cacheBytes), usedBytes(0), flushes(0),
+      onList(prog.size(), -1), generation(0), startFlushes(0) {
+    startStates[0] = startStates[1] = -1;
+    addThread(prog, threads, onList, stack, generation, 0, 0);
+    nullable = false;
+    for (const NFAThread &t : threads) {
+        startInsts.push_back(t.pc);
+        if (prog.insts[t.pc].opcode == NFAInst::MATCH)
+            nullable = true;
+    }
+    sort(startInsts.begin(), startInsts.end());
+}
+
+
+/* Returns the number of states currently in the cache. */
+int LazyDFA::numStates() const {
+    return (int) states.size();
+}
+
+
+/* Returns the number of times the cache has been flushed. */
+int LazyDFA::numFlushes() const {
+    return flushes;
+}
+
+
+/* Discards all of the cached states. */
+void LazyDFA::flush() {
+    states.clear();
+    stateIndex.clear();
+    usedBytes = 0;
+    flushes++;
+}
+
+
+/* Returns the index of the state for the given set of NFA instructions,
+ * adding it to the cache if it is not there yet.  If the new state would
+ * take the cache over its memory budget, the cache is flushed first.
+ */
+int LazyDFA::addState(const vector<int> &insts, bool unanchored) {
+    auto key = make_pair(unanchored, insts);
+    auto iter = stateIndex.find(key);
+    if (iter != stateIndex.end())
+        return iter->second;
+
+    DFAState state;
+    state.insts = insts;
+    state.unanchored = unanchored;
+    state.isMatch = false;
+    for (int pc : insts) {
+        if (prog.insts[pc].opcode == NFAInst::MATCH) {
+            state.isMatch = true;
+            state.matches.push_back(prog.insts[pc].x);
+        }
+    }
+    state.isStart = unanchored && insts == startInsts;
+    fill(state.next, state.next + 256, DFA_UNKNOWN);
+
+    // Count the state itself, and the copy of the instructions in the key.
+    size_t cost = sizeof(DFAState) +
+        (2 * insts.size() + state.matches.size()) * sizeof(int);
+    if (usedBytes + cost > cacheBytes && states.size() > 1)
+        flush();
+
+    states.push_back(state);
+    stateIndex[key] = (int) states.size() - 1;
+    usedBytes += cost;
+    return (int) states.size() - 1;
+}
+
+
+/* Returns the start state for an anchored or unanchored search. */
+int LazyDFA::startState(bool unanchored) {
+    if (startFlushes != flushes)
+        startStates[0] = startStates[1] = -1;
+    if (startStates[unanchored] != -1)
+        return startStates[unanchored];
+
+    generation++;
+    threads.clear();
+    addThread(prog, threads, onList, stack, generation, 0, 0);
+
+    vector<int> insts;
+    for (const NFAThread &t : threads)
+        insts.push_back(t.pc);
+    sort(insts.begin(), insts.end());
+
+    int state = addState(insts, unanchored);
+    startFlushes = flushes;
+    startStates[unanchored] = state;
+    return state;
+}
+
+
+/* Computes the transition out of the state on the byte c, by stepping each
+ * of the state's NFA instructions over c.  Unanchored states also restart
+ * the NFA at the next index.
+ */
+int LazyDFA::computeNext(int state, unsigned char c) {
+    bool unanchored = states[state].unanchored;
+
+    generation++;
+    threads.clear();
+    for (int pc : states[state].insts) {
+        const NFAInst &inst = prog.insts[pc];
+        if (inst.opcode == NFAInst::CHAR && inst.op->matchChar((char) c))
+            addThread(prog, threads, onList, stack, generation, pc + 1, 0);
+    }
+    if (unanchored)
+        addThread(prog, threads, onList, stack, generation, 0, 0);
+
+    if (threads.empty()) {
+        states[state].next[c] = DFA_DEAD;
+        return DFA_DEAD;
+    }
+
+    vector<int> insts;
+    for (const NFAThread &t : threads)
+        insts.push_back(t.pc);
+    sort(insts.begin(), insts.end());
+
+    // If adding the next state flushes the cache, the current state must be
+    // added back so that the transition can be recorded.
+    vector<int> current = states[state].insts;
+    int before = flushes;
+    int next = addState(insts, unanchored);
+    if (flushes != before)
+        state = addState(current, unanchored);
+
+    states[state].next[c] = next;
+    return next;
+}
+
+
+/* Returns the state reached from the given state on the byte c. */
+inline int LazyDFA::step(int state, unsigned char c) {
+    int next = states[state].next[c];
+    if (next == DFA_UNKNOWN)
+        next = computeNext(state, c);
+    return next;
+}
+
+
+/* Run the anchored DFA from the index start, and return the end of the
+ * longest match starting there, or -1 if there is no match.
+ */
+ptrdiff_t LazyDFA::longestAt(string_view s, ptrdiff_t start) {
+    ptrdiff_t length = (ptrdiff_t) s.length();
+    int state = startState(false);
+    ptrdiff_t end = states[state].isMatch ? start : -1;
+
+    for (ptrdiff_t i = start; i < length; i++) {
+        state = step(state, (unsigned char) s[i]);
+        if (state == DFA_DEAD)
+            break;
+        if (states[state].isMatch)
+            end = i + 1;
+    }
+    return end;
+}
+
+
+/* Run the anchored DFA backward over s, from the index end down to the index
+ * from, and return the smallest index where a match of the DFA's regex
+ * starts, or -1 if there is none.  On the DFA of a reversed regex, this is
+ * the smallest index where a match of the original regex that ends at the
+ * index end starts.
+ */
+ptrdiff_t LazyDFA::longestBefore(string_view s, ptrdiff_t end,
+                                 ptrdiff_t from) {
+    int state = startState(false);
+    ptrdiff_t start = states[state].isMatch ? end : -1;
+
+    for (ptrdiff_t i = end - 1; i >= from; i--) {
+        state = step(state, (unsigned char) s[i]);
+        if (state == DFA_DEAD)
+            break;
+        if (states[state].isMatch)
+            start = i;
+    }
+    return start;
+}
+
+
+/* Find the first match of the regex in the string s that starts at or after
+ * the index from.
+ *
+ * An unanchored pass over the string finds the earliest index where any
+ * match ends, so strings without a match are rejected in a single pass.
+ * Otherwise, the reversed DFA is run backward from that index, to find the
+ * leftmost start of a match that ends there.  That is also the start of the
+ * leftmost match, since each operator consumes exactly one character:  a
+ * match that starts further left but ends later can be cut over to the match
+ * that ends first, where the two cross.  A last anchored pass from the start
+ * finds the longest match.  Each pass is linear in the length of the
+ * string, however many indexes a match could start at.
+ *
+ * Without a reversed DFA, the anchored DFA is run from each candidate start
+ * index up to the earliest end in turn instead.
+ *
+ * If no match is found, the range (-1, -1) is returned.
+ */
+Range LazyDFA::find(string_view s, size_t from) {
+    size_t length = s.length();
+    if (from >= length)
+        return Range(-1, -1);
+
+    // A regex that matches the empty string always matches at once.
+    if (nullable)
+        return Range(from, longestAt(s, from));
+
+    int state = startState(true);
+    ptrdiff_t earliestEnd = -1;
+    for (size_t i = from; i < length; i++) {
+        state = step(state, (unsigned char) s[i]);
+        if (states[state].isMatch) {
+            earliestEnd = i + 1;
+            break;
+        }
+    }
+    if (earliestEnd == -1)
+        return Range(-1, -1);
+
+    if (reverse) {
+        ptrdiff_t start = reverse->longestBefore(s, earliestEnd, from);
+        assert(start != -1);
+        return Range(start, longestAt(s, start));
+    }
+
+    for (ptrdiff_t start = from; start < earliestEnd; start++) {
+        ptrdiff_t end = longestAt(s, start);
+        if (end != -1)
+            return Range(start, end);
+    }
+
+    // The match ending at earliestEnd must have been found above.
+    assert(false);
+    return Range(-1, -1);
+}
+
+
+/* For a DFA built from several regexes, find which of them have a match in
+ * the string s, in a single pass over the string.  matched must have an
+ * element for each regex, all false; the element for each regex that
+ * matches is set to true.  The pass stops early once every regex has
+ * matched.  Returns the number of regexes that matched.
+ */
+int LazyDFA::findMatching(string_view s, vector<bool> &matched) {
+    size_t length = s.length();
+    int remaining = (int) matched.size();
+    int found = 0;
+    if (length == 0)
+        return 0;
+
+    // The last state whose matches were recorded, so that a run of the same
+    // match state is only recorded once.
+    int marked = -1;
+    int markedFlushes = flushes;
+
+    int state = startState(true);
+    size_t i = 0;
+    while (remaining > 0) {
+        const DFAState &current = states[state];
+        if (current.isMatch && (state != marked || markedFlushes != flushes)) {
+            for (int index : current.matches) {
+                if (!matched[index]) {
+                    matched[index] = true;
+                    found++;
+                    remaining--;
+                }
+            }
+            marked = state;
+            markedFlushes = flushes;
+        }
+
+        if (current.isStart)
+            i = prog.starts.next(s.data(), i, length);
+        if (i >= length)
+            break;
+        state = step(state, (unsigned char) s[i++]);
+    }
+    return found;
+}
+
+
+/* Check if a string exactly matches the regex with all characters
+ * consumed.
+ */
+bool LazyDFA::match(string_view s) {
+    if (s.empty())
+        return false;
+
+    int state = startState(false);
+    for (char c : s) {
+        state = step(state, (unsigned char) c);
+        if (state == DFA_DEAD)
+            return false;
+    }
+    return states[state].isMatch;
+}
@@ -0,0 +1,115 @@
+#ifndef DFA_H
+#define DFA_H
+
+#include "nfa.h"
+
+#include <map>
+#include <memory>
+
+
+// The default amount of memory that a LazyDFA may use for its state cache.
+#define DEFAULT_DFA_CACHE_BYTES (1 << 20)
+
+// Special values for DFA transitions:  the transition has not been computed
+// yet, or it leads to a state from which no match is possible.
+#define DFA_UNKNOWN -2
+#define DFA_DEAD -1
+
+
+/* A state of a lazily built DFA:  the set of NFA instructions that the NFA
+ * simulation would have active, and the transitions out of the state that
+ * have been computed so far.
+ */
+struct DFAState {
+    // The sorted NFA instructions (CHAR and MATCH only) in this state.
+    vector<int> insts;
+
+    // True if the state restarts the NFA at every index, for unanchored
+    // searches.
+    bool unanchored;
+
+    // True if the state contains a MATCH instruction, and the indexes of the
+    // regexes whose MATCH instructions it contains.
+    bool isMatch;
+    vector<int> matches;
+
+    // True if the state is the unanchored start state, where a search can
+    // skip ahead to the next character that can begin a match.
+    bool isStart;
+
+    // The next state for each input byte, or one of the special values
+    // DFA_UNKNOWN and DFA_DEAD.
+    int next[256];
+};
+
+
+/* A DFA that is built from an NFA program one state at a time, as the states
+ * are reached by the input.  The states are kept in a cache, so that repeated
+ * searches with the same DFA cost about one table lookup per character.  The
+ * cache is limited to a fixed number of bytes; when it fills up, it is
+ * flushed and the states are built again as needed.
+ *
+ * Since every regex operator consumes exactly one character, the leftmost
+ * match that find() reports is also the longest match from its start index,
+ * so the DFA only needs to track sets of NFA states and not their priority.
+ *
+ * A LazyDFA built from a regex's operators also builds a DFA for the
+ * reversed regex, with a cache of its own, which find() runs backward over
+ * the string to locate where a match starts.
+ *
+ * A LazyDFA is not thread-safe, since searching modifies its cache.
+ */
+class LazyDFA {
+public:
+    LazyDFA(const vector<RegexOperator *> &regex,
+            size_t cacheBytes = DEFAULT_DFA_CACHE_BYTES);
+    LazyDFA(const NFAProgram &prog,
+            size_t cacheBytes = DEFAULT_DFA_CACHE_BYTES);
+
+    Range find(string_view s, size_t from = 0);
+    bool match(string_view s);
+    int findMatching(string_view s, vector<bool> &matched);
+
+    int numStates() const;
+    int numFlushes() const;
+
+private:
+    NFAProgram prog;
+    size_t cacheBytes;
+    size_t usedBytes;
+    int flushes;
+
+    vector<DFAState> states;
+    map<pair<bool, vector<int> >, int> stateIndex;
+
+    // Scratch space for computing NFA closures.
+    vector<NFAThread> threads;
+    vector<ptrdiff_t> onList;
+    vector<int> stack;
+    ptrdiff_t generation;
+
+    // True if the regex can match the empty string.
+    bool nullable;
+
+    // The NFA instructions of the start state.
+    vector<int> startInsts;
+
+    // The anchored and unanchored start states, once they have been built
+    // since the last flush, or -1.
+    int startStates[2];
+    int startFlushes;
+
+    // The DFA for the reversed regex, if the DFA was built from a regex's
+    // operators.
+    unique_ptr<LazyDFA> reverse;
+
+    int startState(bool unanchored);
+    int addState(const vector<int> &insts, bool unanchored);
+    int computeNext(int state, unsigned char c);
+    void flush();
+    int step(int state, unsigned char c);
+    ptrdiff_t longestAt(string_view s, ptrdiff_t start);
+    ptrdiff_t longestBefore(string_view s, ptrdiff_t end, ptrdiff_t from);
+};
+
+#endif // DFA_H
@@ -1,12 +1,157 @@
 #include "engine.h"
 
-#include <iostream>
+#include <atomic>
 
 
-// Set this to 1 if you need to see the output of the regular expression
-// matching engine as it attempts to match.  You should not need to do this
-// for the assignment, only if you decide to play with the engine itself.
-#define VERBOSE 0
+/* Initialize an empty match context.  Its buffers grow as needed. */
+MatchContext::MatchContext() : dfaOwner(0) { }
+
+
+/* Returns the match context used by the calls that do not take one.  Each
+ * thread gets its own, so those calls are safe to make from many threads.
+ */
+MatchContext & threadMatchContext() {
+    thread_local MatchContext ctx;
+    return ctx;
+}
+
+
+/* Returns a new id for a compiled regex or regex set, so that match contexts
+ * can tell which one their cached DFA was built for.  Zero is never
+ * returned, so that it can mean "no regex" in a MatchContext.
+ */
+unsigned long newRegexId() {
+    static atomic<unsigned long> nextRegexId(1);
+    return nextRegexId++;
+}
+
+
+/* Prepare the context to remember the states that a
+ * search for regex in s explores:  one bit for each
+ * operator at each index of the string.  Returns false if
+ * the search should not remember them, because the regex
+ * never gives back a repetition or the string is too long.
+ */
+static bool startVisits(const vector<RegexOperator *> &regex,
+                        string_view s, MatchContext &ctx) {
+    return givesBack(regex) &&
+        ctx.backtrack.startVisits((s.length() + 1) * regex.size());
+}
+
+/* Returns true if a search for regex in s by one of the
+ * backtracking engines could not remember the states it
+ * explores, and the NFA can run the regex instead.
+ */
+static bool nfaInsteadOfMemo(const vector<RegexOperator *> &regex,
+                             string_view s) {
+    return givesBack(regex) &&
+        (s.length() + 1) * regex.size() > BACKTRACK_MEMO_MAX_STATES &&
+        !needsBacktracking(regex) && NFAProgram::supports(regex);
+}
+
+/* Returns true if the keys describe the operators of
+ * regex, as they are now.
+ */
+static bool sameOperators(const vector<RegexOperator *> &regex,
+                          const vector<OperatorKey> &keys) {
+    if (keys.size() != regex.size())
+        return false;
+
+    for (size_t i = 0; i < regex.size(); i++) {
+        const OperatorKey &key = keys[i];
+        if (key.op != regex[i] ||
+            key.minRepeat != regex[i]->getMinRepeat() ||
+            key.maxRepeat != regex[i]->getMaxRepeat() ||
+            key.possessive != regex[i]->isPossessive() ||
+            key.chars != regex[i]->charSet())
+            return false;
+    }
+    return true;
+}
+
+/* Set the keys to describe the operators of regex, as
+ * they are now.
+ */
+static void setOperators(const vector<RegexOperator *> &regex,
+                         vector<OperatorKey> &keys) {
+    keys.clear();
+    for (const RegexOperator *op : regex) {
+        keys.push_back({op, op->charSet(), op->getMinRepeat(),
+                        op->getMaxRepeat(), op->isPossessive()});
+    }
+}
+
+/* Returns the lazily built DFA for regex in ctx, building
+ * a new one if the context's DFA was built for anything
+ * else, so that repeated searches for a regex keep the
+ * states they have built.
+ */
+static LazyDFA & operatorDFA(const vector<RegexOperator *> &regex,
+                             MatchContext &ctx) {
+    if (!ctx.dfa || ctx.dfaOwner != 0 ||
+        !sameOperators(regex, ctx.dfaOperators)) {
+        ctx.dfa.reset(new LazyDFA(regex));
+        ctx.dfaOwner = 0;
+        setOperators(regex, ctx.dfaOperators);
+    }
+    return *ctx.dfa;
+}
+
+/* Drop the programs that ctx holds for find() if they
+ * were built for anything but the operators of regex, so
+ * that repeated searches for a regex reuse its programs
+ * and the shift table of its required literal.
+ */
+static void useOperators(const vector<RegexOperator *> &regex,
+                         MatchContext &ctx) {
+    if (!sameOperators(regex, ctx.findOperators)) {
+        ctx.literal.reset();
+        ctx.code.reset();
+        ctx.prog.reset();
+        ctx.shiftAnd.reset();
+        setOperators(regex, ctx.findOperators);
+    }
+}
+
+/* Returns the searcher for the required literal of regex
+ * in ctx, once useOperators() has been called for it.
+ */
+static const LiteralSearcher & requiredSearcher(
+    const vector<RegexOperator *> &regex, MatchContext &ctx) {
+    if (!ctx.literal)
+        ctx.literal.reset(new LiteralSearcher(requiredLiteral(regex)));
+    return *ctx.literal;
+}
+
+/* Returns the bytecode program for regex in ctx, once
+ * useOperators() has been called for it.
+ */
+static const BytecodeProgram & operatorCode(
+    const vector<RegexOperator *> &regex, MatchContext &ctx) {
+    if (!ctx.code)
+        ctx.code.reset(new BytecodeProgram(regex));
+    return *ctx.code;
+}
+
+/* Returns the NFA program for regex in ctx, once
+ * useOperators() has been called for it.
+ */
+static const NFAProgram & operatorProgram(
+    const vector<RegexOperator *> &regex, MatchContext &ctx) {
+    if (!ctx.prog)
+        ctx.prog.reset(new NFAProgram(regex));
+    return *ctx.prog;
+}
+
+/* Returns the Shift-And matcher for regex in ctx, once
+ * useOperators() has been called for it.
+ */
+static const ShiftAndMatcher & operatorShiftAnd(
+    const vector<RegexOperator *> &regex, MatchContext &ctx) {
+    if (!ctx.shiftAnd)
+        ctx.shiftAnd.reset(new ShiftAndMatcher(regex));
+    return *ctx.shiftAnd;
+}
 
 
 /* This helper function implements the core of the regular-expression matching
@@ -15,122 +160,107 @@
  * finds it is unable to achieve matches.
  *
  * The function will attempt to find a match starting at the specific index
- * start.
+ * start.  The ranges matched by each operator are recorded in the context,
+ * rather than in the operators, so that the regex is not modified.
+ *
+ * Whether the operators from opIndex on can match starting at a given index
+ * of the string does not depend on how that index was reached, so once that
+ * state has been explored without finding a match, it is never explored
+ * again; each (operator, index) state is expanded at most once, instead of
+ * once per path that leads to it.  The states remain valid for other start
+ * indexes in the same string, so if keepVisited is set they are kept for the
+ * next call, and the caller must clear them once it is done with s.  memo is
+ * false if the states are not to be remembered:  if the regex never gives
+ * back a repetition, so that no state is reached twice, or if the string is
+ * too long for the memo.
+ *
+ * Every operator applied and every repetition given back is counted against
+ * the budget, and the other work done is counted by the statistics policy.
+ * If the budget runs out, the search is abandoned, and no choice points or
+ * explored states are left behind in the context.
  *
  * If the function cannot generate a match, it will return the range (-1, -1).
  */
-Range findAtIndex(vector<RegexOperator *> regex, const string &s, int start) {
-    if (VERBOSE) {
-        cout << string(78, '-') << endl;
-        cout << "Find regex in \"" << s << "\", starting at index " << start
-             << endl;
-    }
-    
+template <typename Stats>
+static Range findAtIndex(const vector<RegexOperator *> &regex,
+                         string_view s, ptrdiff_t start, MatchContext &ctx,
+                         bool memo, bool keepVisited, MatchBudget &budget,
+                         Stats &stats) {
     Range matched(start, start);
     // Keep track of the parts of the regex we have applied, so that we can
-    // figure out what needs backtracking.
-    vector<RegexOperator *> applied;
+    // figure out what needs backtracking.  Operators [0, opIndex) have been
+    // applied, and each one has a choice point in ctx.backtrack.frames with
+    // the index it started at and the number of times it was applied.
+    // Every repetition matches a single character, so the count is all
+    // that is needed to give repetitions back, one at a time.
+    vector<BacktrackFrame> &frames = ctx.backtrack.frames;
+    frames.clear();
+
+    // One bit for each operator at each index of the string.
+    size_t numOps = regex.size();
+
     int opIndex = 0;
     while (opIndex < (int) regex.size()) {
-        assert(opIndex == (int) applied.size());
-        
+        if (!budget.step())
+            break;
+
         // Get the next operator to apply.
-        RegexOperator *op = regex[opIndex];
-        op->clearMatches();
-        
-        Range currentOp(matched.end, matched.end);
+        const RegexOperator *op = regex[opIndex];
 
-        if (VERBOSE)
-            cout << "Attempting to apply operator " << opIndex << endl;
+        // If this operator has already been tried at this index, it failed
+        // there, since a match would have ended the search.
+        bool seen = memo && ctx.backtrack.visit(matched.end * numOps + opIndex);
 
         // Apply the operator as many times as possible, up to the maximum
-        // number of repetitions allowed.
-        int numMatches = 0;
-        while (op->getMaxRepeat() == -1 || numMatches < op->getMaxRepeat()) {
-            Range iter(currentOp.end, currentOp.end);
-            // If we get a match, record the range that we match on, so that
-            // we can backtrack if needed.
-            if (op->match(s, iter)) {
-                op->pushMatch(iter);
-
-                if (VERBOSE) {
-                    cout << " * Matched range [" << iter.start << ", "
-                         << iter.end << ")" << endl;
-                }
-
-                currentOp.end = iter.end;
-                numMatches++;
-            }
-            else {
-                break;
-            }
-        }
+        // number of repetitions allowed, with one scan over the run of
+        // characters it matches.
+        ptrdiff_t numMatches = 0;
+        if (!seen)
+            numMatches = op->matchRun(s, matched.end, op->getMaxRepeat());
 
         // If we applied the operator at least as many times as required, then
         // we are good!
-        if (numMatches >= op->getMinRepeat()) {
-            // Successfully matched this operator!
-
-            if (VERBOSE)
-                cout << " * Success" << endl;
-
-            // Record that the operator was applied, and update the
-            // "matched range"
-            applied.push_back(op);
-            matched.end = currentOp.end;
+        if (!seen && numMatches >= op->getMinRepeat()) {
+            // Successfully matched this operator!  Record that the operator
+            // was applied, and update the "matched range"
+            frames.push_back({opIndex, matched.end, numMatches});
+            stats.apply(frames.size(), numMatches);
+            matched.end += numMatches;
             opIndex++;
         }
         else {
             // Match failure.  Need to backtrack.  If I backtrack to the very
             // beginning, match failed.
-            
-            if (VERBOSE) {
-                cout << " * Failed to match at least " << op->getMinRepeat()
-                     << " time(s)" << endl;
-                
-                cout << "Backtracking" << endl;
-            }
-            
-            while (!applied.empty()) {
-                RegexOperator *btOp = applied.back();
-                if (btOp->numMatches() > btOp->getMinRepeat()) {
-                    // The current operator has been applied more than the
-                    // minimum number of times.  Remove one application of
-                    // this operation, and retry from that point.
-                    
-                    if (VERBOSE) {
-                        cout << " * Operator " << (opIndex - 1)
-                             << " has been applied " << btOp->numMatches()
-                             << " times (" << btOp->getMinRepeat()
-                             << " required); trying one less" << endl;
-                    }
-
-                    Range popped = btOp->popMatch();
-                    currentOp.end = popped.start;
-                    matched.end = popped.start;
+            while (!frames.empty()) {
+                BacktrackFrame &frame = frames.back();
+                const RegexOperator *btOp = regex[frame.pc];
+                if (frame.count > btOp->getMinRepeat() &&
+                    !btOp->isPossessive()) {
+                    // The operator has been applied more than the minimum
+                    // number of times, and may give some back.  Remove one
+                    // application of this operation, and retry from that
+                    // point.
+                    if (!budget.backtrack())
+                        break;
+
+                    frame.count--;
+                    matched.end = frame.pos + frame.count;
+                    opIndex = frame.pc + 1;
 
                     break;
                 }
                 else {
                     // The operator has been applied only the minimum number of
-                    // times, but maybe we can't apply the operation at all
-                    // yet.  Remove it from the sequence and try again.
-                    
-                    applied.pop_back();
-                    opIndex--;
-
-                    if (VERBOSE)
-                        cout << " * Un-applying operator " << opIndex << endl;
+                    // times, or is possessive, but maybe we can't apply the
+                    // operation at all yet.  Remove it from the sequence and
+                    // try again.
+                    frames.pop_back();
                 }
             }
             
-            if (applied.empty()) {
+            if (frames.empty() || budget.exceeded) {
                 // We backtracked all the way to the beginning.  Total match
                 // failure; nothing we do will achieve a match.
-                
-                if (VERBOSE)
-                    cout << "Match failed, giving up" << endl;
-                
                 matched.start = -1;
                 matched.end = -1;
                 break;
@@ -138,38 +268,213 @@ Range findAtIndex(vector<RegexOperator *> regex, const string &s, int start) {
         }
     }
 
-    if (VERBOSE) {
-        if (applied.size() == regex.size()) {
-            cout << "Match succeeded on range [" << matched.start << ", "
-                 << matched.end << ")" << endl;
-        }
-        
-        // cout << string(78, '-') << endl;
+    if (budget.exceeded) {
+        // Out of budget:  leave nothing of this search behind.
+        frames.clear();
+        matched.start = -1;
+        matched.end = -1;
     }
+
+    if (memo && !keepVisited)
+        ctx.backtrack.clearVisited();
     
     return matched;
 }
 
-/* Find the first match of regex in the string s
+/* Attempt to find a match starting at the index start,
+ * with no limit on the work done.  See the function
+ * above for details.
+ */
+Range findAtIndex(const vector<RegexOperator *> &regex, string_view s,
+                  ptrdiff_t start, MatchContext &ctx, bool keepVisited) {
+    MatchLimits limits;
+    MatchBudget budget(limits);
+    NoMatchStats none;
+    bool memo = startVisits(regex, s, ctx);
+    return findAtIndex(regex, s, start, ctx, memo, keepVisited, budget,
+                       none);
+}
+
+/* Returns a short, human-readable name for the engine. */
+const char * engineName(RegexEngine engine) {
+    switch (engine) {
+        case ENGINE_BACKTRACK:
+            return "backtrack";
+        case ENGINE_NFA:
+            return "nfa";
+        case ENGINE_DFA:
+            return "dfa";
+        case ENGINE_SHIFTAND:
+            return "shift-and";
+    }
+    return "unknown";
+}
+
+/* Find the first match of regex in the string s by
+ * backtracking over the regex operators themselves,
+ * starting at or after the index from.  ENGINE_BACKTRACK
+ * runs the same algorithm on a bytecode program instead.
  *
- * This function iterates through each index in string
- * and checks for a match starting at that index. If
- * no match is found, it returns a range of Range(-1, -1).
- */
-Range find(vector<RegexOperator *> regex, const string &s) {
-    for (size_t i = 0; i < s.length(); i++) {
-        auto range = findAtIndex(regex, s, i);
-        if (range.start != -1 && range.end != -1) {
+ * This function calls findAtIndex() at each index in
+ * the string where the scanner finds a character that
+ * can begin a match, skipping all of the other indexes.
+ * If no match is found, it returns Range(-1, -1).
+ */
+Range backtrackFind(const vector<RegexOperator *> &regex, string_view s,
+                    MatchContext &ctx, const ByteScanner &starts,
+                    size_t from) {
+    Range matched(-1, -1);
+    backtrackFind(regex, s, ctx, starts, MatchLimits(), matched, from);
+    return matched;
+}
+
+/* Call findAtIndex() at each index of s, from the index
+ * from on, where a match can begin, and return the first
+ * match, or Range(-1, -1) if there is none or the budget
+ * runs out.
+ */
+template <typename Stats>
+static Range backtrackFrom(const vector<RegexOperator *> &regex,
+                           string_view s, MatchContext &ctx,
+                           const ByteScanner &starts, MatchBudget &budget,
+                           Stats &stats, size_t from) {
+    size_t length = s.length();
+    bool memo = startVisits(regex, s, ctx);
+    for (size_t i = starts.next(s.data(), from, length); i < length;
+         i = starts.next(s.data(), i + 1, length)) {
+        stats.start();
+        auto range = findAtIndex(regex, s, i, ctx, memo, true, budget,
+                                 stats);
+        if (range.start != -1 && range.end != -1)
             return range;
-        }
+        if (budget.exceeded)
+            break;
     }
     return Range(-1, -1);
 }
 
+/* Find the first match of regex in the string s by
+ * backtracking over the regex operators, doing no more
+ * work than the limits allow.  The limits cover all of
+ * the start indexes tried.  Returns MATCH_FOUND and sets
+ * matched, or sets matched to Range(-1, -1) and returns
+ * MATCH_NOT_FOUND or MATCH_BUDGET_EXCEEDED.  If the
+ * context collects statistics, they are set to the work
+ * done by this search.  A string too long for the
+ * explored states to be remembered is searched by the
+ * NFA instead, unless the regex needs backtracking.
+ */
+MatchStatus backtrackFind(const vector<RegexOperator *> &regex,
+                          string_view s, MatchContext &ctx,
+                          const ByteScanner &starts,
+                          const MatchLimits &limits, Range &matched,
+                          size_t from) {
+    if (nfaInsteadOfMemo(regex, s)) {
+        useOperators(regex, ctx);
+        matched = nfaFind(operatorProgram(regex, ctx), s, ctx.nfa, from);
+        return matched.start != -1 ? MATCH_FOUND : MATCH_NOT_FOUND;
+    }
+
+    MatchBudget budget(limits);
+    if (ctx.backtrack.collectStats) {
+        MatchStats &stats = ctx.backtrack.stats;
+        stats = MatchStats();
+        CountMatchStats counter{stats};
+        matched = backtrackFrom(regex, s, ctx, starts, budget, counter, from);
+        stats.searches = 1;
+        stats.steps = budget.steps;
+        stats.backtracks = budget.backtracks;
+    }
+    else {
+        NoMatchStats none;
+        matched = backtrackFrom(regex, s, ctx, starts, budget, none, from);
+    }
+    ctx.backtrack.clearVisited();
+
+    if (budget.exceeded)
+        return MATCH_BUDGET_EXCEEDED;
+    return matched.start != -1 ? MATCH_FOUND : MATCH_NOT_FOUND;
+}
+
+/* Find the first match of regex in the string s
+ *
+ * With the backtracking engine, this function checks
+ * for a match starting at each index in the string
+ * where a match could begin.  The NFA and DFA engines
+ * instead scan the string.  Whatever the engine, a
+ * string that does not contain the regex's required
+ * literal is rejected before the engine is run.  If no
+ * match is found, it returns a range of Range(-1, -1).
+ */
+Range find(const vector<RegexOperator *> &regex, string_view s,
+           RegexEngine engine) {
+    return find(regex, s, threadMatchContext(), engine);
+}
+
+/* Find the first match of regex in the string s, using
+ * the scratch state in ctx.
+ */
+Range find(const vector<RegexOperator *> &regex, string_view s,
+           MatchContext &ctx, RegexEngine engine) {
+    Range matched(-1, -1);
+    find(regex, s, ctx, MatchLimits(), matched, engine);
+    return matched;
+}
+
+/* Find the first match of regex in the string s, using
+ * the scratch state in ctx, and doing no more work than
+ * the limits allow.  Only the backtracking engine can
+ * exceed them; the other engines take time linear in
+ * the length of the string, and ignore the limits.
+ * Returns MATCH_FOUND and sets matched, or sets matched
+ * to Range(-1, -1) and returns MATCH_NOT_FOUND or
+ * MATCH_BUDGET_EXCEEDED.
+ */
+MatchStatus find(const vector<RegexOperator *> &regex, string_view s,
+                 MatchContext &ctx, const MatchLimits &limits,
+                 Range &matched, RegexEngine engine) {
+    // Only the backtracking engine can keep an operator from giving back
+    // what it matched, or run counted repeats too large to unroll into an
+    // automaton.
+    // The NFA in turn takes the backtracker's place for a string too long
+    // for it to remember the states it explores.
+    if (needsBacktracking(regex) || !NFAProgram::supports(regex))
+        engine = ENGINE_BACKTRACK;
+    else if (engine == ENGINE_BACKTRACK && nfaInsteadOfMemo(regex, s))
+        engine = ENGINE_NFA;
+
+    matched = Range(-1, -1);
+    useOperators(regex, ctx);
+    if (!requiredSearcher(regex, ctx).occursIn(s))
+        return MATCH_NOT_FOUND;
+
+    if (engine == ENGINE_BACKTRACK) {
+        return bytecodeFind(operatorCode(regex, ctx), s, ctx.backtrack,
+                            limits, matched);
+    }
+
+    if (engine == ENGINE_SHIFTAND && ShiftAndMatcher::supports(regex))
+        matched = operatorShiftAnd(regex, ctx).find(s);
+    else if (engine == ENGINE_NFA || engine == ENGINE_SHIFTAND)
+        matched = nfaFind(operatorProgram(regex, ctx), s, ctx.nfa);
+    else
+        matched = operatorDFA(regex, ctx).find(s);
+    return matched.start != -1 ? MATCH_FOUND : MATCH_NOT_FOUND;
+}
+
 /* Check if a string exactly matches a regex with all
  * characters consumed.
  */
-bool match(vector<RegexOperator *> regex, const string &s) {
-    auto range = find(regex, s);
+bool match(const vector<RegexOperator *> &regex, string_view s,
+           RegexEngine engine) {
+    return match(regex, s, threadMatchContext(), engine);
+}
+
+/* Check if a string exactly matches a regex with all
+ * characters consumed, using the scratch state in ctx.
+ */
+bool match(const vector<RegexOperator *> &regex, string_view s,
+           MatchContext &ctx, RegexEngine engine) {
+    auto range = find(regex, s, ctx, engine);
     return range.start == 0 && (size_t)range.end == s.length();
 }
@@ -1,6 +1,130 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "bytecode.h"
+#include "densedfa.h"
+#include "dfa.h"
+#include "literal.h"
+#include "nfa.h"
+#include "pike.h"
 #include "regex.h"
+#include "scan.h"
+#include "shiftand.h"
+
+#include <memory>
+
+
+/* The matching engines that find() and match() can use.
+ *
+ * ENGINE_BACKTRACK is a backtracking matcher, which tries each start index
+ * in turn.  It runs the regex compiled to a flat bytecode program, and
+ * remembers the states it has explored so that it never takes exponential
+ * time.
+ * ENGINE_NFA simulates the regex as a Thompson NFA, and takes time
+ * proportional to the length of the string times the size of the regex.
+ * ENGINE_DFA builds a DFA from the NFA as the string is scanned, and keeps
+ * it in the match context, so that later searches for the same regex reuse
+ * its states.  A CompiledRegex builds its minimized DFA in full instead, if
+ * it is small enough.
+ * ENGINE_SHIFTAND runs a bit-parallel automaton for regexes of up to 64
+ * operators, and falls back to the NFA engine for larger regexes.  All of
+ * the engines report the same matches.
+ *
+ * A regex whose counted repeats would unroll into more than NFA_MAX_INSTS
+ * NFA instructions is always run by ENGINE_BACKTRACK, as is one with
+ * possessive operators that change its matches.
+ */
+enum RegexEngine {
+    ENGINE_BACKTRACK,
+    ENGINE_NFA,
+    ENGINE_DFA,
+    ENGINE_SHIFTAND
+};
+
+const char * engineName(RegexEngine engine);
+
+
+/* One operator of the regex that find() built a DFA or other programs for
+ * in a MatchContext, with the characters and repeats it matched then.  The
+ * DFA's program points to the operator, so the DFA can only be reused for
+ * the same operator, and the rest of the key catches an operator that was
+ * freed and replaced by a different one at the same address, or changed
+ * since.
+ */
+struct OperatorKey {
+    const RegexOperator *op;
+    CharSet chars;
+    int minRepeat, maxRepeat;
+    bool possessive;
+};
+
+
+/* The scratch state that the engines need while searching a string.  The
+ * regex operators themselves are never modified by a search, so a regex can
+ * be shared by many threads as long as each thread searches with its own
+ * MatchContext.  A context keeps its buffers between searches, so reusing
+ * one avoids allocating on every call.
+ */
+class MatchContext {
+public:
+    MatchContext();
+
+    // Backtracking engines:  the choice points and explored states.
+    BacktrackScratch backtrack;
+
+    // NFA engine:  the thread lists.
+    NFAScratch nfa;
+
+    // Pike VM:  the thread lists and their capture slots.
+    PikeScratch pike;
+
+    // DFA engine:  the lazily built DFA for the CompiledRegex or RegexSet
+    // with the given id, if any.  An id of zero means the DFA was built by
+    // find() for the operators in dfaOperators.
+    unique_ptr<LazyDFA> dfa;
+    unsigned long dfaOwner;
+    vector<OperatorKey> dfaOperators;
+
+    // find():  the searcher for the required literal of the operators in
+    // findOperators, and the programs that the engines run for them.  Each
+    // is built the first time a search needs it.
+    vector<OperatorKey> findOperators;
+    unique_ptr<LiteralSearcher> literal;
+    unique_ptr<BytecodeProgram> code;
+    unique_ptr<NFAProgram> prog;
+    unique_ptr<ShiftAndMatcher> shiftAnd;
+
+    // RegexSet:  which of the set's regexes have matched so far.
+    vector<bool> setMatched;
+};
+
+MatchContext & threadMatchContext();
+unsigned long newRegexId();
+
+
+Range findAtIndex(const vector<RegexOperator *> &regex, string_view s,
+                  ptrdiff_t start, MatchContext &ctx,
+                  bool keepVisited = false);
 
+Range backtrackFind(const vector<RegexOperator *> &regex, string_view s,
+                    MatchContext &ctx, const ByteScanner &starts,
+                    size_t from = 0);
+MatchStatus backtrackFind(const vector<RegexOperator *> &regex,
+                          string_view s, MatchContext &ctx,
+                          const ByteScanner &starts,
+                          const MatchLimits &limits, Range &matched,
+                          size_t from = 0);
 
-Range find(vector<RegexOperator *> regex, const string &s);
-bool match(vector<RegexOperator *> regex, const string &s);
+Range find(const vector<RegexOperator *> &regex, string_view s,
+           RegexEngine engine = ENGINE_BACKTRACK);
+Range find(const vector<RegexOperator *> &regex, string_view s,
+           MatchContext &ctx, RegexEngine engine = ENGINE_BACKTRACK);
+MatchStatus find(const vector<RegexOperator *> &regex, string_view s,
+                 MatchContext &ctx, const MatchLimits &limits,
+                 Range &matched, RegexEngine engine = ENGINE_BACKTRACK);
+bool match(const vector<RegexOperator *> &regex, string_view s,
+           RegexEngine engine = ENGINE_BACKTRACK);
+bool match(const vector<RegexOperator *> &regex, string_view s,
+           MatchContext &ctx, RegexEngine engine = ENGINE_BACKTRACK);
 
+#endif // ENGINE_H
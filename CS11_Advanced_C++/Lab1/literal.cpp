@@ -0,0 +1,98 @@
+#include "literal.h"
+
+#include <cstring>
+
+
+/* Initialize a searcher for the empty literal, which occurs everywhere. */
+LiteralSearcher::LiteralSearcher() : LiteralSearcher("") { }
+
+
+/* Initialize a searcher for the literal, building its shift table. */
+LiteralSearcher::LiteralSearcher(const string &literal) : lit(literal) {
+    size_t m = lit.length();
+    for (int c = 0; c < 256; c++)
+        shift[c] = m;
+
+    // The last character of the literal is left out, so that a window
+    // ending in that character still shifts past it.
+    for (size_t i = 0; i + 1 < m; i++)
+        shift[(unsigned char) lit[i]] = m - 1 - i;
+}
+
+
+/* Returns the literal that is searched for. */
+const string & LiteralSearcher::literal() const {
+    return lit;
+}
+
+
+/* Returns the first index i in [from, length) where the literal occurs in s,
+ * or length if it does not occur.  The empty literal occurs at from.
+ */
+size_t LiteralSearcher::find(const char *s, size_t from,
+                             size_t length) const {
+    size_t m = lit.length();
+    if (m == 0)
+        return from < length ? from : length;
+
+    if (m == 1) {
+        if (from >= length)
+            return length;
+        const void *p = memchr(s + from, lit[0], length - from);
+        return p ? (const char *) p - s : length;
+    }
+
+    unsigned char last = (unsigned char) lit[m - 1];
+    for (size_t i = from; i + m <= length; ) {
+        unsigned char c = (unsigned char) s[i + m - 1];
+        if (c == last && memcmp(s + i, lit.data(), m - 1) == 0)
+            return i;
+        i += shift[c];
+    }
+    return length;
+}
+
+
+/* Returns true if the literal occurs anywhere in s. */
+bool LiteralSearcher::occursIn(string_view s) const {
+    if (lit.empty())
+        return true;
+    return find(s.data(), 0, s.length()) < s.length();
+}
+
+
+/* Find the longest literal string that every match of the regex must
+ * contain, or the empty string if there is none.
+ *
+ * A run of operators that each accept a single character contributes those
+ * characters, repeated as many times as each one is required.  An operator
+ * that may repeat a variable number of times ends the run after its required
+ * repetitions, and its last repetition may begin the next run.  Any other
+ * operator ends the run.  The longest run is the required literal; the
+ * first one is chosen if several are equally long.
+ */
+string requiredLiteral(const vector<RegexOperator *> &regex) {
+    string best, run;
+    for (const RegexOperator *op : regex) {
+        CharSet set = op->charSet();
+        if (set.count() != 1) {
+            if (run.length() > best.length())
+                best = run;
+            run = "";
+            continue;
+        }
+
+        int c = set.first();
+        run.append(op->getMinRepeat(), c);
+        if (op->getMaxRepeat() != op->getMinRepeat()) {
+            if (run.length() > best.length())
+                best = run;
+            run = "";
+            if (op->getMinRepeat() > 0)
+                run += c;
+        }
+    }
+    if (run.length() > best.length())
+        best = run;
+    return best;
+}
@@ -0,0 +1,33 @@
+#ifndef LITERAL_H
+#define LITERAL_H
+
+#include "regex.h"
+
+#include <cstddef>
+
+
+/* Searches for a literal string with the Boyer-Moore-Horspool algorithm.
+ * After a mismatch, the search shifts by an amount that depends on the last
+ * character of the current window, so that most characters of the string
+ * are never looked at when the literal is long.
+ */
+class LiteralSearcher {
+public:
+    LiteralSearcher();
+    LiteralSearcher(const string &literal);
+
+    const string & literal() const;
+    size_t find(const char *s, size_t from, size_t length) const;
+    bool occursIn(string_view s) const;
+
+private:
+    string lit;
+
+    // How far the window may shift when its last character is c.
+    size_t shift[256];
+};
+
+
+string requiredLiteral(const vector<RegexOperator *> &regex);
+
+#endif // LITERAL_H
@@ -0,0 +1,253 @@
+#include "nfa.h"
+
+
+/* Compile a vector of regex operators into a Thompson NFA program.
+ *
+ * Each operator is expanded into its required repetitions, followed by
+ * either a greedy loop (for an unlimited maximum) or a chain of greedy
+ * optional repetitions (for a limited maximum).  SPLIT instructions always
+ * prefer taking one more repetition, so that the priority of the NFA threads
+ * follows the order in which the backtracking engine tries its matches.
+ */
+NFAProgram::NFAProgram(const vector<RegexOperator *> &regex)
+    : built(supports(regex)) {
+    if (!built) {
+        insts.push_back({NFAInst::JMP, nullptr, 0, 0});
+        starts = ByteScanner(CharSet());
+        return;
+    }
+    starts = firstCharScanner(regex);
+    compile(regex, 0);
+}
+
+
+/* Compile several regexes into one NFA program that runs all of them at
+ * once.  The program starts with a chain of SPLIT instructions that leads to
+ * each regex in turn, and the MATCH instruction of each regex records its
+ * index in the vector.  A program for no regexes never matches, and neither
+ * does one whose regexes have more than NFA_MAX_INSTS instructions in all.
+ */
+NFAProgram::NFAProgram(const vector<vector<RegexOperator *> > &regexes) {
+    size_t total = 0;
+    for (const vector<RegexOperator *> &regex : regexes)
+        total += countInsts(regex);
+    built = (total <= NFA_MAX_INSTS);
+
+    int n = (int) regexes.size();
+    if (n == 0 || !built) {
+        insts.push_back({NFAInst::JMP, nullptr, 0, 0});
+        starts = ByteScanner(CharSet());
+        return;
+    }
+
+    for (int i = 0; i < n - 1; i++)
+        insts.push_back({NFAInst::SPLIT, nullptr, 0, 0});
+
+    vector<int> entries;
+    CharSet firsts;
+    bool anyFirst = false;
+    for (int i = 0; i < n; i++) {
+        entries.push_back(size());
+        compile(regexes[i], i);
+
+        CharSet set;
+        if (!firstChars(regexes[i], set))
+            anyFirst = true;
+        firsts.addAll(set);
+    }
+
+    for (int i = 0; i < n - 1; i++) {
+        insts[i].x = entries[i];
+        insts[i].y = (i + 1 < n - 1) ? i + 1 : entries[n - 1];
+    }
+    if (!anyFirst)
+        starts = ByteScanner(firsts);
+}
+
+
+/* Append the instructions for one regex to the program, ending with a MATCH
+ * instruction for the regex with the given index.
+ */
+void NFAProgram::compile(const vector<RegexOperator *> &regex, int index) {
+    for (const RegexOperator *op : regex) {
+        // Emit the repetitions that are required.
+        for (int i = 0; i < op->getMinRepeat(); i++)
+            insts.push_back({NFAInst::CHAR, op, 0, 0});
+
+        if (op->getMaxRepeat() == -1) {
+            // L: SPLIT L+1, out;  CHAR;  JMP L
+            int loop = size();
+            insts.push_back({NFAInst::SPLIT, nullptr, loop + 1, 0});
+            insts.push_back({NFAInst::CHAR, op, 0, 0});
+            insts.push_back({NFAInst::JMP, nullptr, loop, 0});
+            insts[loop].y = size();
+        }
+        else {
+            // Each optional repetition may skip to the end of the operator.
+            vector<int> skips;
+            for (int i = op->getMinRepeat(); i < op->getMaxRepeat(); i++) {
+                skips.push_back(size());
+                insts.push_back({NFAInst::SPLIT, nullptr, size() + 1, 0});
+                insts.push_back({NFAInst::CHAR, op, 0, 0});
+            }
+            for (int pc : skips)
+                insts[pc].y = size();
+        }
+    }
+    insts.push_back({NFAInst::MATCH, nullptr, index, 0});
+}
+
+
+/* Returns the number of instructions in the program. */
+int NFAProgram::size() const {
+    return (int) insts.size();
+}
+
+
+/* Returns the number of instructions that compiling the regex would add to
+ * a program, without compiling it.
+ */
+size_t NFAProgram::countInsts(const vector<RegexOperator *> &regex) {
+    size_t count = 1;
+    for (const RegexOperator *op : regex) {
+        count += op->getMinRepeat();
+        if (op->getMaxRepeat() == -1)
+            count += 3;
+        else
+            count += 2 * (size_t) (op->getMaxRepeat() - op->getMinRepeat());
+    }
+    return count;
+}
+
+
+/* Returns true if the program for the regex would have at most
+ * NFA_MAX_INSTS instructions.
+ */
+bool NFAProgram::supports(const vector<RegexOperator *> &regex) {
+    return countInsts(regex) <= NFA_MAX_INSTS;
+}
+
+
+/* Returns false if the program was too large to build, and so never
+ * matches.
+ */
+bool NFAProgram::complete() const {
+    return built;
+}
+
+
+/* Add a thread to the list of threads, following SPLIT and JMP instructions
+ * so that only CHAR and MATCH threads end up in the list.  The onList vector
+ * records the generation in which each instruction was last added, so that
+ * each instruction is present at most once per step; the first thread to
+ * reach an instruction has the highest priority, so later ones are dropped.
+ *
+ * The instructions still to follow are kept on the given stack rather than
+ * the call stack, with the preferred branch of each SPLIT on top, so a long
+ * chain of SPLITs cannot overflow the call stack.  The stack is only scratch
+ * space, and is empty again on return.
+ */
+void addThread(const NFAProgram &prog, vector<NFAThread> &list,
+               vector<ptrdiff_t> &onList, vector<int> &stack,
+               ptrdiff_t generation, int pc, ptrdiff_t start) {
+    stack.push_back(pc);
+    while (!stack.empty()) {
+        pc = stack.back();
+        stack.pop_back();
+        if (onList[pc] == generation)
+            continue;
+        onList[pc] = generation;
+
+        const NFAInst &inst = prog.insts[pc];
+        switch (inst.opcode) {
+            case NFAInst::JMP:
+                stack.push_back(inst.x);
+                break;
+            case NFAInst::SPLIT:
+                stack.push_back(inst.y);
+                stack.push_back(inst.x);
+                break;
+            default:
+                list.push_back({pc, start});
+                break;
+        }
+    }
+}
+
+
+/* Find the first match of the NFA program in the string s.
+ *
+ * This simulates all of the NFA threads in lock-step over the string, so
+ * that the running time is proportional to the length of the string times
+ * the size of the program, regardless of how much backtracking the same
+ * regex would require.  Threads are kept in priority order, with threads
+ * that started earlier in the string ahead of threads that started later,
+ * so the result is the same leftmost match that find() reports.  As with
+ * find(), matches may only start at indexes inside the string.  While no
+ * threads are running, the search skips ahead to the next index where a
+ * match could begin.
+ *
+ * If no match is found, the range (-1, -1) is returned.
+ */
+Range nfaFind(const NFAProgram &prog, string_view s) {
+    NFAScratch scratch;
+    return nfaFind(prog, s, scratch);
+}
+
+
+/* Find the first match of the NFA program in the string s that starts at or
+ * after the index from, using the thread lists in scratch instead of
+ * allocating new ones.
+ */
+Range nfaFind(const NFAProgram &prog, string_view s, NFAScratch &scratch,
+              size_t from) {
+    ptrdiff_t length = (ptrdiff_t) s.length();
+    vector<NFAThread> &clist = scratch.clist;
+    vector<NFAThread> &nlist = scratch.nlist;
+    vector<ptrdiff_t> &onList = scratch.onList;
+    vector<int> &stack = scratch.stack;
+    clist.clear();
+    nlist.clear();
+    onList.assign(prog.size(), -1);
+    Range matched(-1, -1);
+
+    for (ptrdiff_t i = from; i <= length; i++) {
+        if (clist.empty() && matched.start == -1)
+            i = (ptrdiff_t) prog.starts.next(s.data(), i, length);
+
+        // Start a new, lowest-priority thread at this index, unless a match
+        // has already been found from an earlier index.
+        if (matched.start == -1 && i < length)
+            addThread(prog, clist, onList, stack, i, 0, i);
+
+        if (clist.empty() && (matched.start != -1 || i >= length))
+            break;
+
+        for (const NFAThread &t : clist) {
+            const NFAInst &inst = prog.insts[t.pc];
+            if (inst.opcode == NFAInst::MATCH) {
+                // All lower-priority threads are cut off by this match.
+                matched = Range(t.start, i);
+                break;
+            }
+
+            if (i < length && inst.op->matchChar(s[i]))
+                addThread(prog, nlist, onList, stack, i + 1, t.pc + 1,
+                          t.start);
+        }
+
+        clist.swap(nlist);
+        nlist.clear();
+    }
+
+    return matched;
+}
+
+
+/* Check if a string exactly matches the NFA program with all characters
+ * consumed.
+ */
+bool nfaMatch(const NFAProgram &prog, string_view s) {
+    Range range = nfaFind(prog, s);
+    return range.start == 0 && range.end == (ptrdiff_t) s.length();
+}
@@ -0,0 +1,152 @@
+#ifndef NFA_H
+#define NFA_H
+
+#include "regex.h"
+#include "scan.h"
+
+
+// The most instructions an NFAProgram may have once the repeats of its
+// operators are unrolled, the same limit as for a PikeProgram.  Regexes with
+// larger counted repeats are left to the backtracking engine, which counts
+// repetitions instead of unrolling them.
+#define NFA_MAX_INSTS (1 << 20)
+
+/* A single instruction of a Thompson NFA program.
+ *
+ * CHAR consumes one character accepted by the operator op, and continues at
+ * the next instruction.  SPLIT continues at both x and y, preferring x; this
+ * is how the greedy repeat operators are expressed.  JMP continues at x, and
+ * MATCH reports that the whole regex has been matched; x is the index of the
+ * regex, for programs compiled from several.
+ */
+struct NFAInst {
+    enum Opcode { CHAR, SPLIT, JMP, MATCH };
+
+    Opcode opcode;
+    const RegexOperator *op;
+    int x, y;
+};
+
+
+/* A Thompson NFA compiled from a vector of regex operators, or from several
+ * of them at once.  Instruction 0 is the start state.
+ *
+ * The size of the program is known before it is built.  A regex whose
+ * program would have more than NFA_MAX_INSTS instructions is not built:
+ * the program never matches instead, and complete() returns false.  The
+ * DFAs built from NFA programs share the limit.
+ */
+class NFAProgram {
+public:
+    vector<NFAInst> insts;
+
+    // Finds the indexes where a match can begin.
+    ByteScanner starts;
+
+    NFAProgram(const vector<RegexOperator *> &regex);
+    NFAProgram(const vector<vector<RegexOperator *> > &regexes);
+
+    static size_t countInsts(const vector<RegexOperator *> &regex);
+    static bool supports(const vector<RegexOperator *> &regex);
+
+    int size() const;
+    bool complete() const;
+
+private:
+    bool built;
+
+
+    void compile(const vector<RegexOperator *> &regex, int index);
+};
+
+
+/* A thread of the NFA simulation:  the instruction it is about to run, and
+ * the index in the string where its match began.
+ */
+struct NFAThread {
+    int pc;
+    ptrdiff_t start;
+};
+
+
+/* Scratch space for the NFA simulation, so that repeated searches do not
+ * have to allocate their thread lists again.
+ */
+struct NFAScratch {
+    vector<NFAThread> clist, nlist;
+    vector<ptrdiff_t> onList;
+    vector<int> stack;
+};
+
+
+void addThread(const NFAProgram &prog, vector<NFAThread> &list,
+               vector<ptrdiff_t> &onList, vector<int> &stack,
+               ptrdiff_t generation, int pc, ptrdiff_t start);
+
+Range nfaFind(const NFAProgram &prog, string_view s);
+Range nfaFind(const NFAProgram &prog, string_view s, NFAScratch &scratch,
+              size_t from = 0);
+bool nfaMatch(const NFAProgram &prog, string_view s);
+
+
+/* Find the first match of the NFA program in the characters [first, last),
+ * as nfaFind() does for a string, with the indexes of the match counted from
+ * first.  Each character is read once, in order, and the search stops as
+ * soon as the match is known, so any input iterator will do, including an
+ * istreambuf_iterator over a stream that is never held in memory.  A
+ * contiguous range is searched as a string_view instead, so that the search
+ * can skip ahead to where a match can begin.
+ */
+template <typename Iter>
+Range nfaFind(const NFAProgram &prog, Iter first, Iter last,
+              NFAScratch &scratch) {
+    if constexpr (IsContiguousIterator<Iter>::value) {
+        return nfaFind(prog, contiguousView(first, last), scratch);
+    }
+    else {
+        vector<NFAThread> &clist = scratch.clist;
+        vector<NFAThread> &nlist = scratch.nlist;
+        vector<ptrdiff_t> &onList = scratch.onList;
+        vector<int> &stack = scratch.stack;
+        clist.clear();
+        nlist.clear();
+        onList.assign(prog.size(), -1);
+        Range matched(-1, -1);
+
+        for (ptrdiff_t i = 0; ; i++) {
+            bool atEnd = (first == last);
+            char c = atEnd ? '\0' : *first;
+
+            // Start a new, lowest-priority thread here, unless a match has
+            // already been found from an earlier index, or none can begin
+            // here.
+            if (matched.start == -1 && !atEnd && prog.starts.contains(c))
+                addThread(prog, clist, onList, stack, i, 0, i);
+
+            if (clist.empty() && atEnd)
+                break;
+
+            for (const NFAThread &t : clist) {
+                const NFAInst &inst = prog.insts[t.pc];
+                if (inst.opcode == NFAInst::MATCH) {
+                    matched = Range(t.start, i);
+                    break;
+                }
+
+                if (!atEnd && inst.op->matchChar(c))
+                    addThread(prog, nlist, onList, stack, i + 1, t.pc + 1,
+                              t.start);
+            }
+
+            clist.swap(nlist);
+            nlist.clear();
+            if (atEnd || (clist.empty() && matched.start != -1))
+                break;
+            ++first;
+        }
+
+        return matched;
+    }
+}
+
+#endif // NFA_H
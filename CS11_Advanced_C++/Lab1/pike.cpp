@@ -0,0 +1,337 @@
+#include "pike.h"
+
+#include <algorithm>
+
+
+/* Compile the syntax tree of a regex with numGroups groups into a Pike VM
+ * program.  The whole regex is wrapped in the slots of group 0.  If the
+ * tree was not parsed completely, or the program is too large, it is
+ * replaced by one whose only character class is empty, so that no thread
+ * ever starts.
+ */
+PikeProgram::PikeProgram(const RegexNode &tree, int numGroups, bool parsed)
+    : numGroups(numGroups),
+      maxInsts(min(PIKE_MAX_INSTS, PIKE_MAX_SLOTS / numSlots())) {
+    insts.push_back({PikeInst::SAVE, 0, 0});
+    if (parsed)
+        compile(tree);
+    built = parsed && size() <= maxInsts;
+    if (!built) {
+        insts.clear();
+        classes.clear();
+        insts.push_back({PikeInst::SAVE, 0, 0});
+        insts.push_back({PikeInst::CHARS, 0, 0});
+        classes.push_back(CharSet());
+        insts.shrink_to_fit();
+        classes.shrink_to_fit();
+    }
+    insts.push_back({PikeInst::SAVE, 1, 0});
+    insts.push_back({PikeInst::MATCH, 0, 0});
+
+    if (addFirstChars(firsts))
+        starts = ByteScanner(firsts);
+    else
+        firsts.addRange(0, 255);
+}
+
+
+/* Returns the number of instructions in the program. */
+int PikeProgram::size() const {
+    return (int) insts.size();
+}
+
+
+/* Returns the number of capture slots that each thread needs. */
+int PikeProgram::numSlots() const {
+    return 2 * (numGroups + 1);
+}
+
+
+/* Returns false if the program was too large to compile, and so never
+ * matches.
+ */
+bool PikeProgram::complete() const {
+    return built;
+}
+
+
+/* Compile a node with its repeats, the same way as NFAProgram does:  the
+ * required copies of the node, followed by a greedy loop for an unlimited
+ * maximum or a chain of greedy optional copies for a limited one.  Each copy
+ * checks the size of the program first, and stops once it is past the
+ * limit.
+ */
+void PikeProgram::compile(const RegexNode &node) {
+    for (int i = 0; i < node.minRepeat; i++) {
+        if (size() > maxInsts)
+            return;
+        compileOnce(node);
+    }
+    if (size() > maxInsts)
+        return;
+
+    if (node.maxRepeat == -1) {
+        // L: SPLIT L+1, out;  node;  JMP L
+        int loop = size();
+        insts.push_back({PikeInst::SPLIT, loop + 1, 0});
+        compileOnce(node);
+        insts.push_back({PikeInst::JMP, loop, 0});
+        insts[loop].y = size();
+    }
+    else {
+        // Each optional copy may skip to the end of the node.
+        vector<int> skips;
+        for (int i = node.minRepeat; i < node.maxRepeat; i++) {
+            if (size() > maxInsts)
+                return;
+            skips.push_back(size());
+            insts.push_back({PikeInst::SPLIT, size() + 1, 0});
+            compileOnce(node);
+        }
+        for (int pc : skips)
+            insts[pc].y = size();
+    }
+}
+
+
+/* Compile a single copy of a node, ignoring its repeats. */
+void PikeProgram::compileOnce(const RegexNode &node) {
+    switch (node.kind) {
+        case RegexNode::CHARS:
+            insts.push_back({PikeInst::CHARS, (int) classes.size(), 0});
+            classes.push_back(node.chars);
+            break;
+
+        case RegexNode::CONCAT:
+            for (const RegexNode &child : node.children)
+                compile(child);
+            break;
+
+        case RegexNode::ALTERNATE: {
+            // SPLIT L1, next;  child 1;  JMP out;  next: SPLIT L2, ...
+            vector<int> jumps;
+            for (size_t i = 0; i < node.children.size(); i++) {
+                int split = -1;
+                if (i + 1 < node.children.size()) {
+                    split = size();
+                    insts.push_back({PikeInst::SPLIT, split + 1, 0});
+                }
+                compile(node.children[i]);
+                if (split != -1) {
+                    jumps.push_back(size());
+                    insts.push_back({PikeInst::JMP, 0, 0});
+                    insts[split].y = size();
+                }
+            }
+            for (int pc : jumps)
+                insts[pc].x = size();
+            break;
+        }
+
+        case RegexNode::GROUP:
+            insts.push_back({PikeInst::SAVE, 2 * node.group, 0});
+            compile(node.children[0]);
+            insts.push_back({PikeInst::SAVE, 2 * node.group + 1, 0});
+            break;
+    }
+}
+
+
+/* Add the characters that can be consumed first from the start of the
+ * program to the set, following SPLIT, JMP and SAVE instructions with a
+ * stack of the instructions still to visit.  Returns false if MATCH can be
+ * reached without consuming anything, in which case any index can begin a
+ * match.
+ */
+bool PikeProgram::addFirstChars(CharSet &set) const {
+    vector<bool> seen(insts.size(), false);
+    vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        int pc = stack.back();
+        stack.pop_back();
+        if (seen[pc])
+            continue;
+        seen[pc] = true;
+
+        const PikeInst &inst = insts[pc];
+        switch (inst.opcode) {
+            case PikeInst::CHARS:
+                set.addAll(classes[inst.x]);
+                break;
+            case PikeInst::SPLIT:
+                stack.push_back(inst.y);
+                stack.push_back(inst.x);
+                break;
+            case PikeInst::JMP:
+                stack.push_back(inst.x);
+                break;
+            case PikeInst::SAVE:
+                stack.push_back(pc + 1);
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+
+/* Add a thread at pc to the list, with the capture slots in caps, following
+ * SPLIT, JMP and SAVE instructions so that only CHARS and MATCH threads end
+ * up in the list.  SAVE records the index i in caps while its branch is
+ * added, and restores the old value afterwards, so a single caps array
+ * serves the whole search.  As in addThread() for the NFA, the first thread
+ * to reach an instruction in a step has the highest priority, so later ones
+ * are dropped.
+ *
+ * The instructions are followed with the given stack instead of recursion,
+ * so that a deeply repeated group cannot overflow the call stack.  A SAVE
+ * pushes a frame that restores its slot beneath the rest of its branch.
+ */
+static void addThread(const PikeProgram &prog, PikeThreadList &list,
+                      vector<ptrdiff_t> &onList, vector<PikeFrame> &stack,
+                      ptrdiff_t generation, int pc, ptrdiff_t *caps,
+                      ptrdiff_t i) {
+    stack.push_back({pc, -1, 0});
+    while (!stack.empty()) {
+        PikeFrame frame = stack.back();
+        stack.pop_back();
+        if (frame.slot != -1) {
+            caps[frame.slot] = frame.old;
+            continue;
+        }
+
+        pc = frame.pc;
+        if (onList[pc] == generation)
+            continue;
+        onList[pc] = generation;
+
+        const PikeInst &inst = prog.insts[pc];
+        switch (inst.opcode) {
+            case PikeInst::JMP:
+                stack.push_back({inst.x, -1, 0});
+                break;
+            case PikeInst::SPLIT:
+                stack.push_back({inst.y, -1, 0});
+                stack.push_back({inst.x, -1, 0});
+                break;
+            case PikeInst::SAVE:
+                stack.push_back({pc, inst.x, caps[inst.x]});
+                stack.push_back({pc + 1, -1, 0});
+                caps[inst.x] = i;
+                break;
+            default: {
+                int numSlots = prog.numSlots();
+                ptrdiff_t *slots = &list.slots[list.pcs.size() * numSlots];
+                copy(caps, caps + numSlots, slots);
+                list.pcs.push_back(pc);
+                break;
+            }
+        }
+    }
+}
+
+
+/* Run the Pike VM over the string s from the index from, and store the
+ * ranges of the groups of the match it finds in groups.
+ *
+ * All of the threads run in lock-step over the string, so each character is
+ * looked at once, whatever the regex.  Threads are kept in priority order:
+ * those that started earlier come first, and among those that started
+ * together, the one that took the preferred branch of each SPLIT comes
+ * first.  Each thread carries its own capture slots.
+ *
+ * For a search, a new thread starts at each index until a match is found,
+ * and the first thread to reach MATCH cuts off all of the threads with a
+ * lower priority.  For a full match, only one thread starts, at index 0,
+ * and only a thread that reaches MATCH at the end of the string counts.
+ */
+static bool pikeRun(const PikeProgram &prog, string_view s,
+                    PikeScratch &scratch, vector<Range> &groups,
+                    ptrdiff_t from, bool fullMatch) {
+    ptrdiff_t length = (ptrdiff_t) s.length();
+    int numSlots = prog.numSlots();
+    PikeThreadList &clist = scratch.clist;
+    PikeThreadList &nlist = scratch.nlist;
+    vector<ptrdiff_t> &caps = scratch.caps;
+    clist.pcs.clear();
+    nlist.pcs.clear();
+    scratch.onList.assign(prog.size(), -1);
+
+    // A list holds at most one thread per instruction, so the slots never
+    // need to grow during the search.
+    clist.slots.resize(prog.size() * numSlots);
+    nlist.slots.resize(prog.size() * numSlots);
+
+    bool matched = false;
+    vector<ptrdiff_t> best(numSlots, -1);
+
+    for (ptrdiff_t i = from; i <= length; i++) {
+        if (clist.pcs.empty() && !matched && !fullMatch)
+            i = (ptrdiff_t) prog.starts.next(s.data(), i, length);
+
+        // Start a new, lowest-priority thread at this index, unless a match
+        // has already been found from an earlier index, or none can begin
+        // here.
+        if (!matched && i < length && (!fullMatch || i == from) &&
+            prog.firsts.contains(s[i])) {
+            caps.assign(numSlots, -1);
+            addThread(prog, clist, scratch.onList, scratch.stack, i, 0,
+                      caps.data(), i);
+        }
+        if (clist.pcs.empty())
+            break;
+
+        for (size_t t = 0; t < clist.pcs.size(); t++) {
+            const PikeInst &inst = prog.insts[clist.pcs[t]];
+            ptrdiff_t *slots = &clist.slots[t * numSlots];
+
+            if (inst.opcode == PikeInst::MATCH) {
+                if (fullMatch && i < length)
+                    continue;
+                // All lower-priority threads are cut off by this match.
+                copy(slots, slots + numSlots, best.begin());
+                matched = true;
+                break;
+            }
+
+            if (i < length && prog.classes[inst.x].contains(s[i])) {
+                addThread(prog, nlist, scratch.onList, scratch.stack, i + 1,
+                          clist.pcs[t] + 1, slots, i + 1);
+            }
+        }
+
+        swap(clist, nlist);
+        nlist.pcs.clear();
+    }
+
+    groups.clear();
+    for (int g = 0; g <= prog.numGroups; g++) {
+        if (matched && best[2 * g] != -1 && best[2 * g + 1] != -1)
+            groups.push_back(Range(best[2 * g], best[2 * g + 1]));
+        else
+            groups.push_back(Range(-1, -1));
+    }
+    return matched;
+}
+
+
+/* Find the first match of the program in the string s that starts at or
+ * after the index from.  groups is set to the range of each group in the
+ * match, starting with group 0 for the whole match; a group that took no
+ * part in the match has the range (-1, -1).  Returns false if there is no
+ * match.
+ */
+bool pikeFind(const PikeProgram &prog, string_view s, PikeScratch &scratch,
+              vector<Range> &groups, size_t from) {
+    return pikeRun(prog, s, scratch, groups, from, false);
+}
+
+
+/* Check if a string exactly matches the program with all characters
+ * consumed, and set groups to the ranges of the groups in that match.
+ */
+bool pikeMatch(const PikeProgram &prog, string_view s, PikeScratch &scratch,
+               vector<Range> &groups) {
+    return pikeRun(prog, s, scratch, groups, 0, true);
+}
@@ -0,0 +1,110 @@
+#ifndef PIKE_H
+#define PIKE_H
+
+#include "regex.h"
+#include "scan.h"
+
+
+// The most instructions a PikeProgram may have once its counted repeats are
+// expanded.  Nested counted repeats multiply, so a short pattern could
+// otherwise expand into more instructions than memory can hold.
+#define PIKE_MAX_INSTS (1 << 20)
+
+// The most capture slots a thread list of a PikeProgram may need:  one set
+// of slots per instruction.  A regex with many groups is held to fewer
+// instructions, so that its thread lists stay small.
+#define PIKE_MAX_SLOTS (1 << 22)
+
+
+/* A single instruction of a Pike VM program.
+ *
+ * CHARS consumes one character from the program's class with index x.
+ * SPLIT continues at both x and y, preferring x, and JMP continues at x.
+ * SAVE records the current index in the capture slot x, and continues at
+ * the next instruction.  MATCH reports that the whole regex has matched.
+ */
+struct PikeInst {
+    enum Opcode { CHARS, SPLIT, JMP, SAVE, MATCH };
+
+    Opcode opcode;
+    int x, y;
+};
+
+
+/* A program for the Pike VM, compiled from the syntax tree of a regex with
+ * groups and alternation.  Group g is recorded in the capture slots 2g (its
+ * start) and 2g + 1 (its end); group 0 is the whole match.
+ *
+ * Compiling stops as soon as the program grows past PIKE_MAX_INSTS
+ * instructions, or past PIKE_MAX_SLOTS capture slots for each thread list.
+ * Such a program, or one for a tree that the parser could not complete, is
+ * replaced by one that never matches, and complete() returns false.
+ */
+class PikeProgram {
+public:
+    vector<PikeInst> insts;
+    vector<CharSet> classes;
+
+    // The number of groups, not counting group 0.
+    int numGroups;
+
+    // The characters that can begin a match, and a scanner that finds the
+    // indexes where a match can begin.
+    CharSet firsts;
+    ByteScanner starts;
+
+    PikeProgram(const RegexNode &tree, int numGroups, bool parsed = true);
+
+    int size() const;
+    int numSlots() const;
+    bool complete() const;
+
+private:
+    bool built;
+
+    // The most instructions the program may have.
+    int maxInsts;
+
+    void compile(const RegexNode &node);
+    void compileOnce(const RegexNode &node);
+    bool addFirstChars(CharSet &set) const;
+};
+
+
+/* The threads of one step of the Pike VM:  the instruction each thread is
+ * about to run, and its capture slots, numSlots() of them per thread.
+ */
+struct PikeThreadList {
+    vector<int> pcs;
+    vector<ptrdiff_t> slots;
+};
+
+
+/* An entry of the stack that the Pike VM follows instructions with:  an
+ * instruction to add a thread at, or, if slot is not -1, a capture slot to
+ * set back to old once the instructions after a SAVE have been followed.
+ */
+struct PikeFrame {
+    int pc;
+    int slot;
+    ptrdiff_t old;
+};
+
+
+/* Scratch space for the Pike VM, so that repeated searches do not have to
+ * allocate their thread lists again.
+ */
+struct PikeScratch {
+    PikeThreadList clist, nlist;
+    vector<ptrdiff_t> onList;
+    vector<ptrdiff_t> caps;
+    vector<PikeFrame> stack;
+};
+
+
+bool pikeFind(const PikeProgram &prog, string_view s, PikeScratch &scratch,
+              vector<Range> &groups, size_t from = 0);
+bool pikeMatch(const PikeProgram &prog, string_view s, PikeScratch &scratch,
+               vector<Range> &groups);
+
+#endif // PIKE_H
@@ -1,4 +1,5 @@
 #include "regex.h"
+#include <cctype>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -8,6 +9,7 @@
 RegexOperator::RegexOperator() {
     minRepeat = 1;
     maxRepeat = 1;
+    possessive = false;
 }
 
 
@@ -37,35 +39,47 @@ void RegexOperator::setMaxRepeat(int n) {
 }
 
 
-/* Clears the list of matches stored in the regex operator.  Typically done
- * in preparation to try to match the regex to a new string.
- */
-void RegexOperator::clearMatches() {
-    matches.clear();
+/* Returns true if the operator is possessive. */
+bool RegexOperator::isPossessive() const {
+    return possessive;
 }
 
 
-/* Records a new match of the operator in the list of matches. */
-void RegexOperator::pushMatch(const Range &r) {
-    matches.push_back(r);
+/* Sets whether the operator is possessive. */
+void RegexOperator::setPossessive(bool p) {
+    possessive = p;
 }
 
 
-/* Reports how many times the regex operator has successfully matched in the
- * string.
+/* Returns how many times in a row, up to maxCount (or without limit if
+ * maxCount is -1), the operator matches the characters of s starting at the
+ * index pos.  The operator's character set is looked up once, so the whole
+ * run costs one bitmap test per character, and nothing is recorded for each
+ * repetition.
  */
-int RegexOperator::numMatches() const {
-    return (int) matches.size();
-}
+ptrdiff_t RegexOperator::matchRun(string_view s, ptrdiff_t pos,
+                                  int maxCount) const {
+    ptrdiff_t limit = (ptrdiff_t) s.length() - pos;
+    if (maxCount != -1 && maxCount < limit)
+        limit = maxCount;
 
+    CharSet set = charSet();
+    ptrdiff_t count = 0;
+    while (count < limit && set.contains((unsigned char) s[pos + count]))
+        count++;
+    return count;
+}
 
-/* Removes the last match the operator successfully matched against.  Used for
- * backtracking by the regex engine.
+/* Returns the set of all characters the operator accepts, by testing every
+ * character with matchChar().  Subclasses that know their set override this.
  */
-Range RegexOperator::popMatch() {
-    Range r = matches.back();
-    matches.pop_back();
-    return r;
+CharSet RegexOperator::charSet() const {
+    CharSet set;
+    for (int c = 0; c < 256; c++) {
+        if (matchChar((char) c))
+            set.add((unsigned char) c);
+    }
+    return set;
 }
 
 /* Construct a MatchChar regex operator that matches c.
@@ -77,9 +91,9 @@ MatchChar::MatchChar(char c) {
 /* Match the character at s[r.start] to the operator's match
  * char. If there is a match, return true, else false.
  */
-bool MatchChar::match(const string &s, Range &r) const {
-    if ((int)s.length() > r.start) {
-        if (s[r.start] == match_char) {
+bool MatchChar::match(string_view s, Range &r) const {
+    if ((ptrdiff_t)s.length() > r.start) {
+        if (matchChar(s[r.start])) {
             r.end = r.start + 1;
             return true;
         }
@@ -87,32 +101,62 @@ bool MatchChar::match(const string &s, Range &r) const {
     return false;
 }
 
+/* Check a single character against the operator's match char. */
+bool MatchChar::matchChar(char c) const {
+    return c == match_char;
+}
+
+/* The only character accepted is the match char. */
+CharSet MatchChar::charSet() const {
+    CharSet set;
+    set.add((unsigned char) match_char);
+    return set;
+}
+
 // MatchAny definition
 MatchAny::MatchAny() { }
 
 /* Match any character as long as r points to a valid
  * index in the string s.
  */
-bool MatchAny::match(const string &s, Range &r) const {
-    if ((int)s.length() > r.start) {
+bool MatchAny::match(string_view s, Range &r) const {
+    if ((ptrdiff_t)s.length() > r.start) {
         r.end = r.start + 1;
         return true;
     }
     return false;
 }
 
+/* Any single character is accepted. */
+bool MatchAny::matchChar(char c) const {
+    return true;
+}
+
+/* Every character is accepted. */
+CharSet MatchAny::charSet() const {
+    CharSet set;
+    set.invert();
+    return set;
+}
+
 /* Construct MatchFromSubset to match the characters in s
  */
 MatchFromSubset::MatchFromSubset(string s) {
-    chars = s;
+    chars.addAll(s);
+}
+
+/* Construct MatchFromSubset to match the characters in set
+ */
+MatchFromSubset::MatchFromSubset(const CharSet &set) {
+    chars = set;
 }
 
 /* Check if character at s[r.start] is in the match subset
  * of characters, and if so return true, else false.
  */
-bool MatchFromSubset::match(const string &s, Range &r) const {
-    if ((int)s.length() > r.start) {
-        if (chars.find(s[r.start]) != string::npos) {
+bool MatchFromSubset::match(string_view s, Range &r) const {
+    if ((ptrdiff_t)s.length() > r.start) {
+        if (matchChar(s[r.start])) {
             r.end = r.start + 1;
             return true;
         }
@@ -120,20 +164,37 @@ bool MatchFromSubset::match(const string &s, Range &r) const {
     return false;
 }
 
+/* Check if the single character c is in the match subset. */
+bool MatchFromSubset::matchChar(char c) const {
+    return chars.contains((unsigned char) c);
+}
+
+/* The accepted characters are the match subset. */
+CharSet MatchFromSubset::charSet() const {
+    return chars;
+}
+
 /* Construct ExcludeFromSubset regex operator with given
  * characters in string as the set to exclude in match.
  */
 ExcludeFromSubset::ExcludeFromSubset(string s) {
-    chars = s;
+    chars.addAll(s);
+}
+
+/* Construct ExcludeFromSubset regex operator with the
+ * characters in set as the set to exclude in match.
+ */
+ExcludeFromSubset::ExcludeFromSubset(const CharSet &set) {
+    chars = set;
 }
 
 /* Check if character at s[r.start] is not in
  * the excluded subset associated with the
  * ExcludeFromSubset regex operator. 
  */
-bool ExcludeFromSubset::match(const string &s, Range &r) const {
-    if ((int)s.length() > r.start) {
-        if (chars.find(s[r.start]) == string::npos) {
+bool ExcludeFromSubset::match(string_view s, Range &r) const {
+    if ((ptrdiff_t)s.length() > r.start) {
+        if (matchChar(s[r.start])) {
             r.end = r.start + 1;
             return true;
         }
@@ -141,6 +202,107 @@ bool ExcludeFromSubset::match(const string &s, Range &r) const {
     return false;
 }
 
+/* Check that the single character c is not in the excluded subset. */
+bool ExcludeFromSubset::matchChar(char c) const {
+    return !chars.contains((unsigned char) c);
+}
+
+/* The accepted characters are those not in the excluded subset. */
+CharSet ExcludeFromSubset::charSet() const {
+    CharSet set = chars;
+    set.invert();
+    return set;
+}
+
+
+/* Parse the character class that begins with the '[' at
+ * index i of expr, adding its characters to set.  Ranges
+ * such as a-z add every character between the ends, and
+ * a ^ anywhere in the class makes it an exclude set.  A
+ * class that is not closed runs to the end of expr.
+ *
+ * Returns the index of the closing ']', or the length of
+ * expr if there is none.
+ */
+size_t parseCharClass(const string &expr, size_t i, CharSet &set,
+                      bool &exclude) {
+    exclude = false;
+    // Parse through until reaching a ] character
+    // terminating the character set definition.
+    for (i++; i < expr.length(); i++) {
+        if (expr[i] == ']') {
+            // Reached end of set definition.
+            break;
+        }
+        else if (expr[i] == '^') {
+            // This set is an exclude set.
+            exclude = true;
+        }
+        else if (i + 2 < expr.length() &&
+                 expr[i + 1] == '-' &&
+                 expr[i + 2] != ']') {
+            // A range of characters, such as a-z.
+            set.addRange(expr[i], expr[i + 2]);
+            i += 2;
+        } else {
+            // Normal character, add to set.
+            set.add(expr[i]);
+        }
+    }
+    return i;
+}
+
+/* Parse a counted repeat modifier, "{n}", "{n,}" or
+ * "{n,m}", that begins with the '{' at index i of expr,
+ * and set minRepeat and maxRepeat from it; "{n,}" has no
+ * maximum.  Counts above REGEX_MAX_REPEAT, a maximum below
+ * the minimum, and anything else that is not of one of
+ * these forms are not repeat modifiers, and leave the '{'
+ * as an ordinary character.
+ *
+ * Returns the index of the closing '}', or i if there is
+ * no repeat modifier at i.
+ */
+size_t parseRepeatCount(const string &expr, size_t i, int &minRepeat,
+                        int &maxRepeat) {
+    size_t j = i + 1;
+    int counts[2] = {0, -1};
+    for (int k = 0; k < 2; k++) {
+        if (j >= expr.length())
+            return i;
+        if (k == 1 && expr[j] == '}')
+            break;
+        if (!isdigit((unsigned char) expr[j]))
+            return i;
+
+        // Read the digits of the count.
+        counts[k] = 0;
+        for (; j < expr.length() && isdigit((unsigned char) expr[j]); j++) {
+            counts[k] = counts[k] * 10 + (expr[j] - '0');
+            if (counts[k] > REGEX_MAX_REPEAT)
+                return i;
+        }
+
+        if (k == 0) {
+            if (j < expr.length() && expr[j] == '}') {
+                // "{n}" repeats exactly n times.
+                counts[1] = counts[0];
+                break;
+            }
+            if (j >= expr.length() || expr[j] != ',')
+                return i;
+            j++;
+        }
+    }
+    if (j >= expr.length() || expr[j] != '}')
+        return i;
+    if (counts[1] != -1 && counts[1] < counts[0])
+        return i;
+
+    minRepeat = counts[0];
+    maxRepeat = counts[1];
+    return j;
+}
 
 /* Parse an input string into regex tokens.
  *
@@ -150,7 +312,12 @@ bool ExcludeFromSubset::match(const string &s, Range &r) const {
 vector<RegexOperator *> parseRegex(const string &expr) {
     vector<RegexOperator *> regex_ops {};
     bool escaped = false;
+    // Whether the previous character was a repeat modifier, so
+    // that a '+' after it makes the operator possessive.
+    bool quantified = false;
     for (size_t i = 0; i < expr.length(); i++) {
+        bool afterQuantifier = quantified;
+        quantified = false;
         if (escaped) {
             regex_ops.push_back(new MatchChar(expr[i]));
             escaped = false;
@@ -170,39 +337,51 @@ vector<RegexOperator *> parseRegex(const string &expr) {
                     regex_ops.push_back(new MatchAny());
                     break;
                 case '+':
+                    if (afterQuantifier) {
+                        // Never give back what the previous
+                        // repeat modifier matched
+                        regex_ops.back()->setPossessive(true);
+                        break;
+                    }
                     // Match previous 1 or more times
                     regex_ops.back()->setMinRepeat(1);
                     regex_ops.back()->setMaxRepeat(-1);
+                    quantified = true;
                     break;
                 case '*':
                     // Match previous 0 or more times
                     regex_ops.back()->setMinRepeat(0);
                     regex_ops.back()->setMaxRepeat(-1);
+                    quantified = true;
                     break;
                 case '?':
                     // Match previous 0 or 1 times
                     regex_ops.back()->setMinRepeat(0);
+                    quantified = true;
+                    break;
+                case '{':
+                    // Match previous a counted number of times,
+                    // or match a '{' if this is not a count.
+                    {
+                        int minRepeat = 1, maxRepeat = 1;
+                        size_t end = parseRepeatCount(expr, i, minRepeat,
+                                                      maxRepeat);
+                        if (end != i && !regex_ops.empty()) {
+                            regex_ops.back()->setMinRepeat(minRepeat);
+                            regex_ops.back()->setMaxRepeat(maxRepeat);
+                            i = end;
+                            quantified = true;
+                        } else {
+                            regex_ops.push_back(new MatchChar(c));
+                        }
+                    }
                     break;
                 case '[':
                     // Begin parsing a set of characters.
                     {
                         bool exclude = false;
-                        string char_set = "";
-                        // Parse through until reaching a ] character
-                        // terminating the character set definition.
-                        for (; i < expr.length(); i++) {
-                            if (expr[i] == ']') {
-                                // Reached end of set definition.
-                                break;
-                            }
-                            else if (expr[i] == '^') {
-                                // This set is an exclude set.
-                                exclude = true;
-                            } else {
-                                // Normal character, add to set.
-                                char_set += expr[i];
-                            }
-                        }
+                        CharSet char_set;
+                        i = parseCharClass(expr, i, char_set, exclude);
                         // Add the subset regex op.
                         if (exclude) {
                             regex_ops.push_back(new ExcludeFromSubset(char_set));   
@@ -219,13 +398,228 @@ vector<RegexOperator *> parseRegex(const string &expr) {
             }
         }
     }
+    possessify(regex_ops);
     return regex_ops;
 }
 
-/* Clear all matches for the given regex.
+/* Returns, for each operator of the regex, the set of
+ * characters that can be matched next after its
+ * repetitions:  the characters of the following operators,
+ * up to the first one that is required.  The sets are
+ * built in one pass from the end of the regex, each from
+ * the one after it, so that a long run of optional
+ * operators takes linear time.
  */
-void clearRegex(vector<RegexOperator *> regex) {
+static vector<CharSet> followingChars(const vector<RegexOperator *> &regex) {
+    vector<CharSet> sets(regex.size());
+    for (size_t i = regex.size(); i-- > 1; ) {
+        sets[i - 1] = regex[i]->charSet();
+        if (regex[i]->getMinRepeat() == 0)
+            sets[i - 1].addAll(sets[i]);
+    }
+    return sets;
+}
+
+/* Make every repeated operator possessive where that does
+ * not change what the regex matches:  where no character
+ * the operator accepts can be matched next.  Giving back a
+ * repetition would leave such a character to be matched
+ * next, so backtracking into the operator could never lead
+ * to a match, and the backtracking engines can skip it.
+ * If the operators that follow are all optional, the first
+ * attempt, with every repetition taken, always matches.
+ */
+void possessify(const vector<RegexOperator *> &regex) {
+    vector<CharSet> following = followingChars(regex);
     for (size_t i = 0; i < regex.size(); i++) {
-        regex[i]->clearMatches();
+        RegexOperator *op = regex[i];
+        if (op->isPossessive() || op->getMinRepeat() == op->getMaxRepeat())
+            continue;
+        if (!op->charSet().intersects(following[i]))
+            op->setPossessive(true);
+    }
+}
+
+/* Returns true if the regex has a possessive operator that
+ * possessify() would not have made possessive, so that it
+ * can rule out matches that the greedy operator would find.
+ * Only the backtracking engines can run such a regex; the
+ * automaton-based engines treat every operator as greedy.
+ */
+bool needsBacktracking(const vector<RegexOperator *> &regex) {
+    vector<CharSet> following = followingChars(regex);
+    for (size_t i = 0; i < regex.size(); i++) {
+        const RegexOperator *op = regex[i];
+        if (op->isPossessive() &&
+            op->getMinRepeat() != op->getMaxRepeat() &&
+            op->charSet().intersects(following[i]))
+            return true;
+    }
+    return false;
+}
+
+/* Returns true if some operator of the regex can give back
+ * repetitions it has matched:  one that is not possessive
+ * and may repeat a varying number of times.  Otherwise a
+ * backtracking search from one start index never reaches
+ * the same (operator, index) state twice, and has no need
+ * to remember the states it has explored.
+ */
+bool givesBack(const vector<RegexOperator *> &regex) {
+    for (const RegexOperator *op : regex) {
+        if (!op->isPossessive() &&
+            op->getMinRepeat() != op->getMaxRepeat())
+            return true;
+    }
+    return false;
+}
+
+/* Initialize a node of the given kind, that is matched
+ * exactly once.
+ */
+RegexNode::RegexNode(Kind kind)
+    : kind(kind), group(0), minRepeat(1), maxRepeat(1) { }
+
+static RegexNode parseAlternation(const string &expr, size_t &i,
+                                  int &numGroups, int depth,
+                                  bool &complete);
+
+/* Parse a sequence of atoms and their repeat modifiers,
+ * starting at index i of expr, up to the next '|', the
+ * ')' that closes the current group, or the end of expr.
+ * The index i is left at the character that ended the
+ * sequence.  A group past REGEX_MAX_GROUPS or nested past
+ * REGEX_MAX_DEPTH clears complete and ends the parse, as
+ * does a possessive '+' after a repeat modifier, which
+ * the Pike VM cannot run.
+ */
+static RegexNode parseSequence(const string &expr, size_t &i,
+                               int &numGroups, int depth, bool &complete) {
+    RegexNode seq(RegexNode::CONCAT);
+    // Whether the previous character ended a repeat modifier.
+    bool quantified = false;
+    while (i < expr.length()) {
+        char c = expr[i];
+        if (c == '|' || (c == ')' && depth > 0))
+            break;
+
+        if (c == '+' && quantified) {
+            complete = false;
+            i = expr.length();
+            break;
+        }
+        quantified = false;
+
+        if ((c == '+' || c == '*' || c == '?') && !seq.children.empty()) {
+            // Modify the repeats of the previous atom, as
+            // parseRegex() does.
+            RegexNode &last = seq.children.back();
+            if (c != '?')
+                last.maxRepeat = -1;
+            last.minRepeat = (c == '+') ? 1 : 0;
+            i++;
+            quantified = true;
+            continue;
+        }
+        if (c == '{' && !seq.children.empty()) {
+            RegexNode &last = seq.children.back();
+            size_t end = parseRepeatCount(expr, i, last.minRepeat,
+                                          last.maxRepeat);
+            if (end != i) {
+                i = end + 1;
+                quantified = true;
+                continue;
+            }
+        }
+
+        RegexNode atom(RegexNode::CHARS);
+        if (c == '(') {
+            if (numGroups >= REGEX_MAX_GROUPS || depth >= REGEX_MAX_DEPTH) {
+                complete = false;
+                i = expr.length();
+                break;
+            }
+
+            // A group, which may contain alternatives.
+            atom.kind = RegexNode::GROUP;
+            atom.group = ++numGroups;
+            i++;
+            atom.children.push_back(
+                parseAlternation(expr, i, numGroups, depth + 1, complete));
+            if (i < expr.length())
+                i++;
+        }
+        else if (c == '\\') {
+            // An escaped character, or nothing at the end.
+            if (i + 1 >= expr.length()) {
+                i++;
+                continue;
+            }
+            atom.chars.add(expr[i + 1]);
+            i += 2;
+        }
+        else if (c == '.') {
+            atom.chars.invert();
+            i++;
+        }
+        else if (c == '[') {
+            bool exclude = false;
+            i = parseCharClass(expr, i, atom.chars, exclude);
+            if (exclude)
+                atom.chars.invert();
+            if (i < expr.length())
+                i++;
+        }
+        else {
+            // Any other character, including a ')' with no
+            // matching '(' or a repeat modifier with nothing
+            // to repeat, matches itself.
+            atom.chars.add(c);
+            i++;
+        }
+        seq.children.push_back(atom);
+    }
+    return seq;
+}
+
+/* Parse one or more sequences separated by '|', starting
+ * at index i of expr.
+ */
+static RegexNode parseAlternation(const string &expr, size_t &i,
+                                  int &numGroups, int depth,
+                                  bool &complete) {
+    RegexNode alt(RegexNode::ALTERNATE);
+    alt.children.push_back(parseSequence(expr, i, numGroups, depth,
+                                         complete));
+    while (i < expr.length() && expr[i] == '|') {
+        i++;
+        alt.children.push_back(parseSequence(expr, i, numGroups, depth,
+                                             complete));
     }
+    if (alt.children.size() == 1)
+        return alt.children[0];
+    return alt;
+}
+
+/* Parse a regex that may contain groups in parentheses
+ * and alternatives separated by '|', into a syntax tree.
+ * Characters, classes and greedy repeat modifiers are
+ * parsed as by parseRegex(), and repeat modifiers also
+ * apply to groups.  Groups are numbered from 1, in the
+ * order of their '(' characters, and numGroups is set to
+ * the number of groups.
+ *
+ * A group that is not closed runs to the end of expr.
+ * complete is set to false if the regex has more than
+ * REGEX_MAX_GROUPS groups, nests them more than
+ * REGEX_MAX_DEPTH deep, or has a possessive repeat such
+ * as "*+", in which case the tree is only part of the
+ * regex.
+ */
+RegexNode parseRegexTree(const string &expr, int &numGroups,
+                         bool &complete) {
+    size_t i = 0;
+    numGroups = 0;
+    complete = true;
+    return parseAlternation(expr, i, numGroups, 0, complete);
 }
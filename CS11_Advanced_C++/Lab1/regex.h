@@ -1,10 +1,28 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include "charset.h"
+
 #include <cassert>
+#include <cstddef>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 using namespace std;
 
 
+// The largest count allowed in a counted repeat modifier such as "{n,m}".
+#define REGEX_MAX_REPEAT 100000
+
+// The most groups a regex parsed by parseRegexTree() may have, and the
+// deepest they may be nested.
+#define REGEX_MAX_GROUPS 256
+#define REGEX_MAX_DEPTH 64
+
+
 /* This class represents a range in a string, as a pair of indexes.  The "start"
  * index is inclusive, and the "end" index is exclusive, so that the range
  * [1, 5) represents the substring that starts at index 1 and ends at index 4;
@@ -16,18 +34,19 @@ using namespace std;
  * A range with identical "start" and "end" values indicates an empty string.
  *
  * The start and end indexes are also allowed to be -1, to indicate an invalid
- * range.
+ * range.  They are as wide as a pointer, so that a range can lie anywhere in
+ * a string or memory-mapped file of more than 2 GB.
  */
 class Range {
 public:
     // The starting index of the range (inclusive)
-    int start;
+    ptrdiff_t start;
     
     // The ending index of the range (exclusive)
-    int end;
+    ptrdiff_t end;
 
     // Initialize a Range object with the specified start and end indexes
-    Range(int start_, int end_) {
+    Range(ptrdiff_t start_, ptrdiff_t end_) {
         assert(start_ <= end_);
         assert(start_ >= -1);
         assert(end_ >= -1);
@@ -44,6 +63,48 @@ public:
 };
 
 
+/* Whether the iterator type Iter walks over characters that lie next to
+ * each other in memory, so that a range of them can be searched as a
+ * string_view.  The engines that take an iterator pair use this to send such
+ * ranges down their pointer-based paths, which can skip ahead with memchr()
+ * and SIMD scans; other iterators are walked one character at a time.
+ */
+template <typename Iter>
+struct IsContiguousIterator : false_type { };
+
+template <> struct IsContiguousIterator<char *> : true_type { };
+template <> struct IsContiguousIterator<const char *> : true_type { };
+template <> struct IsContiguousIterator<string::iterator> : true_type { };
+template <>
+struct IsContiguousIterator<string::const_iterator> : true_type { };
+template <>
+struct IsContiguousIterator<vector<char>::iterator> : true_type { };
+template <>
+struct IsContiguousIterator<vector<char>::const_iterator> : true_type { };
+
+
+/* Returns the characters [first, last) of a contiguous iterator range as a
+ * string_view.
+ */
+template <typename Iter>
+string_view contiguousView(Iter first, Iter last) {
+    static_assert(IsContiguousIterator<Iter>::value,
+                  "the iterator must be contiguous");
+    if (first == last)
+        return string_view();
+    return string_view(&*first, last - first);
+}
+
+
+/* Whether the iterator type Iter can be read more than once, as the
+ * backtracking engines need; a single-pass input iterator such as an
+ * istreambuf_iterator can only be searched by the NFA as it is read.
+ */
+template <typename Iter>
+struct IsMultiPassIterator : is_base_of<forward_iterator_tag,
+    typename iterator_traits<Iter>::iterator_category> { };
+
+
 /* A class for representing operations that can be performed in a regular
  * expression.
  */
@@ -53,9 +114,10 @@ class RegexOperator {
     // at least -1; -1 indicates "unlimited matches", and all other values
     // specify an actual maximum number of matches.
     int minRepeat, maxRepeat;
-    
-    // A vector of ranges where the regex operator has matched the test string.
-    vector<Range> matches;
+
+    // A possessive operator keeps every repetition it matches, and is never
+    // backtracked into to give some of them back.
+    bool possessive;
     
 public:
     RegexOperator();
@@ -66,13 +128,22 @@ public:
     int getMaxRepeat() const;
     void setMinRepeat(int n);
     void setMaxRepeat(int n);
+    bool isPossessive() const;
+    void setPossessive(bool p);
 
     // Operations to support backtracking
-    void clearMatches();
-    void pushMatch(const Range &r);
-    virtual bool match(const string &s, Range &r) const = 0;
-    int numMatches() const;
-    Range popMatch();
+    virtual bool match(string_view s, Range &r) const = 0;
+
+    // Counts the repetitions of the operator that match from an index, all
+    // at once.
+    ptrdiff_t matchRun(string_view s, ptrdiff_t pos, int maxCount) const;
+
+    // Reports whether the operator accepts the single character c.  Used by
+    // the automaton-based engines, which step one character at a time.
+    virtual bool matchChar(char c) const = 0;
+
+    // Returns the set of all characters the operator accepts.
+    virtual CharSet charSet() const;
 };
 
 /* Match a single given character c in a string.
@@ -80,7 +151,9 @@ public:
 class MatchChar : public RegexOperator {
 public:
     MatchChar(char c) ;
-    bool match(const string &s, Range &r) const;
+    bool match(string_view s, Range &r) const;
+    bool matchChar(char c) const;
+    CharSet charSet() const;
 private:
     char match_char;
 
@@ -91,20 +164,27 @@ private:
 class MatchAny : public RegexOperator {
 public:
     MatchAny() ;
-    bool match(const string &s, Range &r) const;
+    bool match(string_view s, Range &r) const;
+    bool matchChar(char c) const;
+    CharSet charSet() const;
 
 };
 
 /* Match any single character in a string that is
  * in the given subset of characters passed to this
- * class at construction of class.
+ * class at construction of class.  The subset is
+ * kept as a bitmap, so that a character can be
+ * tested in constant time.
  */
 class MatchFromSubset : public RegexOperator {
 public:
     MatchFromSubset(string s) ;
-    bool match(const string &s, Range &r) const;
+    MatchFromSubset(const CharSet &set) ;
+    bool match(string_view s, Range &r) const;
+    bool matchChar(char c) const;
+    CharSet charSet() const;
 private:
-    string chars;
+    CharSet chars;
 
 };
 
@@ -114,12 +194,44 @@ private:
 class ExcludeFromSubset : public RegexOperator {
 public:
     ExcludeFromSubset(string s) ;
-    bool match(const string &s, Range &r) const;
+    ExcludeFromSubset(const CharSet &set) ;
+    bool match(string_view s, Range &r) const;
+    bool matchChar(char c) const;
+    CharSet charSet() const;
 private:
-    string chars;
+    CharSet chars;
+
+};
+
+/* A node of the syntax tree of a regex that may contain groups and
+ * alternation, as produced by parseRegexTree().
+ *
+ * A CHARS node accepts one character from chars.  A CONCAT node matches its
+ * children one after another, an ALTERNATE node matches the first of its
+ * children that leads to a match, and a GROUP node matches its only child
+ * and records the range it matched as the group with the given number.  Any
+ * node may be repeated, with the same meaning as for a RegexOperator.
+ */
+struct RegexNode {
+    enum Kind { CHARS, CONCAT, ALTERNATE, GROUP };
+
+    Kind kind;
+    CharSet chars;
+    int group;
+    int minRepeat, maxRepeat;
+    vector<RegexNode> children;
 
+    RegexNode(Kind kind);
 };
 
+size_t parseRepeatCount(const string &expr, size_t i, int &minRepeat,
+                        int &maxRepeat);
+size_t parseCharClass(const string &expr, size_t i, CharSet &set,
+                      bool &exclude);
 vector<RegexOperator *> parseRegex(const string &expr);
-void clearRegex(vector<RegexOperator *> regex);
+void possessify(const vector<RegexOperator *> &regex);
+bool needsBacktracking(const vector<RegexOperator *> &regex);
+bool givesBack(const vector<RegexOperator *> &regex);
+RegexNode parseRegexTree(const string &expr, int &numGroups, bool &complete);
 
+#endif // REGEX_H
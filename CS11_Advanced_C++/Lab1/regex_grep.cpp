@@ -0,0 +1,325 @@
+#include "compiled.h"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+// The number of bytes of a file that each worker matches at a time.  Chunks
+// are extended to the end of their last line, so most are a little larger.
+#define GREP_CHUNK_BYTES (1 << 20)
+
+// How many chunks each worker may get ahead of the output, so that the
+// memory used for pending output stays bounded.
+#define GREP_CHUNKS_AHEAD 4
+
+
+/*===========================================================================
+ * REGEX-GREP
+ *
+ * Prints the lines of each file that contain a match of the regex, in the
+ * same order as they appear in the files.  Each file is memory-mapped and
+ * split into line-aligned chunks, which are matched on a pool of worker
+ * threads; the main thread writes out the results of each chunk in turn.
+ */
+
+
+/* The options given on the command line. */
+struct GrepOptions {
+    // Print the number of matching lines instead of the lines themselves.
+    bool countOnly;
+
+    // Prefix each line with the name of its file.
+    bool showNames;
+
+    // The number of worker threads.
+    int numThreads;
+
+    // The engine used to match each line.
+    RegexEngine engine;
+
+    // Print the backtracking engine's statistics when done.
+    bool showStats;
+};
+
+
+/* A line-aligned part of a file, and the result of matching its lines. */
+struct GrepChunk {
+    const char *data;
+    size_t length;
+
+    // The matching lines, ready to be written out, and how many there are.
+    string output;
+    size_t count;
+
+    bool done;
+};
+
+
+/* Splits the bytes [data, data + length) into chunks of about chunkBytes
+ * each, so that every chunk ends just after a newline or at the end of the
+ * data.
+ */
+vector<GrepChunk> splitChunks(const char *data, size_t length,
+                              size_t chunkBytes) {
+    vector<GrepChunk> chunks;
+    size_t start = 0;
+    while (start < length) {
+        size_t end = start + chunkBytes;
+        if (end >= length) {
+            end = length;
+        }
+        else {
+            const void *nl = memchr(data + end, '\n', length - end);
+            end = nl ? (const char *) nl - data + 1 : length;
+        }
+
+        GrepChunk chunk;
+        chunk.data = data + start;
+        chunk.length = end - start;
+        chunk.count = 0;
+        chunk.done = false;
+        chunks.push_back(chunk);
+        start = end;
+    }
+    return chunks;
+}
+
+
+/* Matches each line of the chunk against the regex, in place without
+ * copying it, and records the lines that contain a match.  If the regex has
+ * a required literal, the chunk is searched for the literal first, and only
+ * the lines that contain it are passed to the engine.
+ */
+void grepChunk(const CompiledRegex &regex, const LiteralSearcher &required,
+               const GrepOptions &opts, const string &prefix,
+               MatchContext &ctx, GrepChunk &chunk) {
+    const char *data = chunk.data;
+    size_t length = chunk.length;
+    bool skipLines = !required.literal().empty() &&
+        required.literal().find('\n') == string::npos;
+
+    size_t start = 0;
+    while (start < length) {
+        if (skipLines) {
+            size_t hit = required.find(data, start, length);
+            if (hit == length)
+                break;
+            // Back up to the start of the line containing the literal.
+            while (hit > start && data[hit - 1] != '\n')
+                hit--;
+            start = hit;
+        }
+
+        const void *nl = memchr(data + start, '\n', length - start);
+        size_t end = nl ? (const char *) nl - data : length;
+
+        string_view line(data + start, end - start);
+        if (regex.find(line, ctx, opts.engine).start != -1) {
+            chunk.count++;
+            if (!opts.countOnly) {
+                chunk.output += prefix;
+                chunk.output += line;
+                chunk.output += '\n';
+            }
+        }
+        start = end + 1;
+    }
+}
+
+
+/* Greps the chunks on a pool of worker threads, and writes out the results
+ * of each chunk in order as soon as it is done.  Returns the number of
+ * matching lines.
+ */
+size_t grepChunks(const CompiledRegex &regex, const GrepOptions &opts,
+                  const string &prefix, vector<GrepChunk> &chunks) {
+    LiteralSearcher required(requiredLiteral(regex.operators()));
+    atomic<size_t> nextChunk(0);
+    size_t written = 0;
+    mutex lock;
+    condition_variable chunkDone, chunkWritten;
+
+    auto worker = [&]() {
+        MatchContext ctx;
+        ctx.backtrack.collectStats = opts.showStats;
+        while (true) {
+            size_t i = nextChunk++;
+            if (i >= chunks.size())
+                break;
+
+            // Don't get too far ahead of the output.
+            {
+                unique_lock<mutex> guard(lock);
+                while (i >= written + GREP_CHUNKS_AHEAD * opts.numThreads)
+                    chunkWritten.wait(guard);
+            }
+
+            grepChunk(regex, required, opts, prefix, ctx, chunks[i]);
+
+            unique_lock<mutex> guard(lock);
+            chunks[i].done = true;
+            chunkDone.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 0; t < opts.numThreads; t++)
+        workers.push_back(thread(worker));
+
+    size_t count = 0;
+    for (GrepChunk &chunk : chunks) {
+        {
+            unique_lock<mutex> guard(lock);
+            while (!chunk.done)
+                chunkDone.wait(guard);
+        }
+
+        fwrite(chunk.output.data(), 1, chunk.output.length(), stdout);
+        count += chunk.count;
+        string().swap(chunk.output);
+
+        unique_lock<mutex> guard(lock);
+        written++;
+        chunkWritten.notify_all();
+    }
+
+    for (thread &th : workers)
+        th.join();
+    return count;
+}
+
+
+/* Memory-maps the named file and greps it.  Returns the number of matching
+ * lines, or -1 if the file could not be read.
+ */
+long grepFile(const CompiledRegex &regex, const GrepOptions &opts,
+              const char *name) {
+    int fd = open(name, O_RDONLY);
+    if (fd == -1) {
+        cerr << "regex-grep: " << name << ": " << strerror(errno) << endl;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        cerr << "regex-grep: " << name << ": " << strerror(errno) << endl;
+        close(fd);
+        return -1;
+    }
+
+    size_t length = (size_t) st.st_size;
+    const char *data = NULL;
+    if (length > 0) {
+        void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            cerr << "regex-grep: " << name << ": " << strerror(errno) << endl;
+            close(fd);
+            return -1;
+        }
+        madvise(map, length, MADV_SEQUENTIAL);
+        data = (const char *) map;
+    }
+    close(fd);
+
+    string prefix = opts.showNames ? string(name) + ":" : string();
+    vector<GrepChunk> chunks = splitChunks(data, length, GREP_CHUNK_BYTES);
+    size_t count = grepChunks(regex, opts, prefix, chunks);
+
+    if (length > 0)
+        munmap((void *) data, length);
+
+    if (opts.countOnly)
+        cout << prefix << count << endl;
+    return (long) count;
+}
+
+
+/* Prints the command-line usage and exits with an error. */
+void usage() {
+    cerr << "usage: regex-grep [-c] [-s] [-j threads] "
+         << "[-E backtrack|nfa|dfa|shift-and] regex file..." << endl;
+    exit(2);
+}
+
+
+int main(int argc, char **argv) {
+    GrepOptions opts;
+    opts.countOnly = false;
+    opts.showStats = false;
+    opts.numThreads = (int) thread::hardware_concurrency();
+    if (opts.numThreads < 1)
+        opts.numThreads = 1;
+    opts.engine = ENGINE_DFA;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "csj:E:")) != -1) {
+        if (opt == 'c') {
+            opts.countOnly = true;
+        }
+        else if (opt == 's') {
+            opts.showStats = true;
+        }
+        else if (opt == 'j') {
+            opts.numThreads = atoi(optarg);
+            if (opts.numThreads < 1)
+                usage();
+        }
+        else if (opt == 'E') {
+            const RegexEngine engines[] = {
+                ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+            };
+            bool found = false;
+            for (RegexEngine engine : engines) {
+                if (strcmp(optarg, engineName(engine)) == 0) {
+                    opts.engine = engine;
+                    found = true;
+                }
+            }
+            if (!found)
+                usage();
+        }
+        else {
+            usage();
+        }
+    }
+    if (argc - optind < 2)
+        usage();
+
+    CompiledRegex regex(argv[optind]);
+    opts.showNames = argc - optind > 2;
+
+    // Exit with 0 if any line matched, 1 if none did, and 2 on an error.
+    bool matched = false, failed = false;
+    for (int i = optind + 1; i < argc; i++) {
+        long count = grepFile(regex, opts, argv[i]);
+        if (count == -1)
+            failed = true;
+        else if (count > 0)
+            matched = true;
+        fflush(stdout);
+    }
+
+    if (opts.showStats) {
+        MatchStats stats = regex.stats();
+        cerr << "searches " << stats.searches << ", starts " << stats.starts
+             << ", steps " << stats.steps << ", backtracks "
+             << stats.backtracks << ", max depth " << stats.maxDepth
+             << ", bytes scanned " << stats.bytesScanned << endl;
+    }
+    return failed ? 2 : (matched ? 0 : 1);
+}
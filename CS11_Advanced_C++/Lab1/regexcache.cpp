@@ -0,0 +1,195 @@
+#include "regexcache.h"
+
+
+/* Initialize an empty cache with a budget of maxBytes bytes. */
+RegexCache::RegexCache(size_t maxBytes)
+    : budget(maxBytes), used(0), numHits(0), numMisses(0), numEvictions(0),
+      numRejected(0) { }
+
+
+/* Returns the compiled regex for the pattern expr, compiling it and adding
+ * it to the cache if it is not there already.  The compile happens without
+ * holding the cache's lock, so that other patterns can be looked up in the
+ * meantime; the pattern's entry is added first, so that no other thread
+ * compiles it as well.
+ */
+shared_ptr<const CompiledRegex> RegexCache::get(const string &expr) {
+    promise<shared_ptr<const CompiledRegex> > compiled;
+    unique_lock<mutex> guard(lock);
+    auto found = index.find(expr);
+    if (found != index.end()) {
+        numHits++;
+        entries.splice(entries.begin(), entries, found->second);
+        shared_future<shared_ptr<const CompiledRegex> > regex =
+            found->second->regex;
+
+        // Wait outside of the lock, in case another thread is still
+        // compiling the regex.
+        guard.unlock();
+        return regex.get();
+    }
+
+    auto large = oversized.find(expr);
+    if (large != oversized.end()) {
+        shared_ptr<const CompiledRegex> regex = large->second.lock();
+        if (regex) {
+            numHits++;
+            return regex;
+        }
+        oversized.erase(large);
+    }
+
+    numMisses++;
+    entries.push_front({expr, compiled.get_future().share(), 0});
+    index[expr] = entries.begin();
+    guard.unlock();
+
+    shared_ptr<const CompiledRegex> regex;
+    try {
+        regex = compileRegex(expr);
+    }
+    catch (...) {
+        // Let the waiting threads see the error, and forget the pattern.
+        compiled.set_exception(current_exception());
+        guard.lock();
+        found = index.find(expr);
+        if (found != index.end() && found->second->bytes == 0) {
+            entries.erase(found->second);
+            index.erase(found);
+        }
+        throw;
+    }
+    compiled.set_value(regex);
+
+    guard.lock();
+    found = index.find(expr);
+    if (found != index.end() && found->second->bytes == 0) {
+        size_t size = regex->memoryUsage();
+        if (size > budget) {
+            // Keeping the regex would flush the whole cache, and still not
+            // fit, so it is only remembered while callers hold it.  The
+            // patterns of regexes nobody holds any more are forgotten.
+            numRejected++;
+            entries.erase(found->second);
+            index.erase(found);
+            for (auto it = oversized.begin(); it != oversized.end(); ) {
+                if (it->second.expired())
+                    it = oversized.erase(it);
+                else
+                    ++it;
+            }
+            oversized[expr] = regex;
+        }
+        else {
+            found->second->bytes = size;
+            used += size;
+            evict();
+        }
+    }
+    return regex;
+}
+
+
+/* Evict the least recently used regexes until the cache is within its
+ * budget.  Regexes that are still being compiled are skipped, since their
+ * size is not known yet.  The lock must be held.
+ */
+void RegexCache::evict() {
+    auto it = entries.end();
+    while (used > budget && it != entries.begin()) {
+        --it;
+        if (it->bytes == 0)
+            continue;
+
+        used -= it->bytes;
+        numEvictions++;
+        index.erase(it->expr);
+        it = entries.erase(it);
+    }
+}
+
+
+/* Remove all of the regexes from the cache.  The counters are kept. */
+void RegexCache::clear() {
+    lock_guard<mutex> guard(lock);
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        if (it->bytes == 0) {
+            ++it;
+            continue;
+        }
+        used -= it->bytes;
+        index.erase(it->expr);
+        it = entries.erase(it);
+    }
+    oversized.clear();
+}
+
+
+/* Change the memory budget, evicting regexes if the cache is now over it.
+ * The regexes that were too large for the old budget are forgotten, so
+ * that they are compiled and kept again if they fit the new one.
+ */
+void RegexCache::setMaxBytes(size_t maxBytes) {
+    lock_guard<mutex> guard(lock);
+    budget = maxBytes;
+    oversized.clear();
+    evict();
+}
+
+
+/* Returns the memory budget in bytes. */
+size_t RegexCache::maxBytes() const {
+    lock_guard<mutex> guard(lock);
+    return budget;
+}
+
+
+/* Returns the memory used by the cached regexes, in bytes. */
+size_t RegexCache::bytes() const {
+    lock_guard<mutex> guard(lock);
+    return used;
+}
+
+
+/* Returns the number of regexes in the cache. */
+size_t RegexCache::size() const {
+    lock_guard<mutex> guard(lock);
+    return entries.size();
+}
+
+
+/* Returns the number of lookups that found their pattern in the cache. */
+unsigned long RegexCache::hits() const {
+    lock_guard<mutex> guard(lock);
+    return numHits;
+}
+
+
+/* Returns the number of lookups that had to compile their pattern. */
+unsigned long RegexCache::misses() const {
+    lock_guard<mutex> guard(lock);
+    return numMisses;
+}
+
+
+/* Returns the number of regexes evicted to stay within the budget. */
+unsigned long RegexCache::evictions() const {
+    lock_guard<mutex> guard(lock);
+    return numEvictions;
+}
+
+
+/* Returns the number of regexes that were not kept at all, because each
+ * was larger than the whole budget.
+ */
+unsigned long RegexCache::rejected() const {
+    lock_guard<mutex> guard(lock);
+    return numRejected;
+}
+
+
+/* Returns the process-wide regex cache, with the default budget. */
+RegexCache & regexCache() {
+    static RegexCache cache;
+    return cache;
+}
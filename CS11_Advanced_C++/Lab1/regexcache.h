@@ -0,0 +1,82 @@
+#ifndef REGEXCACHE_H
+#define REGEXCACHE_H
+
+#include "compiled.h"
+
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+
+// The default memory budget of a regex cache, in bytes.
+#define REGEX_CACHE_DEFAULT_BYTES (16 << 20)
+
+
+/* A thread-safe cache of compiled regexes, keyed by pattern text.  Asking
+ * for a pattern that is already in the cache returns the same CompiledRegex
+ * again, so each pattern is parsed and compiled only once, however many
+ * threads ask for it at the same time.  Threads that ask for a pattern while
+ * another thread is compiling it wait for that compile to finish.
+ *
+ * The cache holds compiled regexes up to a memory budget, measured with
+ * CompiledRegex::memoryUsage().  When it is over budget, the least recently
+ * used regexes are evicted.  An evicted regex stays alive for as long as a
+ * caller still holds a pointer to it.  A regex larger than the whole budget
+ * is returned, but not kept, and is counted as rejected rather than
+ * evicted.  The cache only remembers it weakly, so that it is returned
+ * again without compiling it while some caller still holds it.
+ */
+class RegexCache {
+public:
+    RegexCache(size_t maxBytes = REGEX_CACHE_DEFAULT_BYTES);
+
+    RegexCache(const RegexCache &) = delete;
+    RegexCache & operator=(const RegexCache &) = delete;
+
+    shared_ptr<const CompiledRegex> get(const string &expr);
+    void clear();
+
+    void setMaxBytes(size_t maxBytes);
+    size_t maxBytes() const;
+    size_t bytes() const;
+    size_t size() const;
+
+    unsigned long hits() const;
+    unsigned long misses() const;
+    unsigned long evictions() const;
+    unsigned long rejected() const;
+
+private:
+    // A cached regex.  Its size is 0 until it has finished compiling.
+    struct Entry {
+        string expr;
+        shared_future<shared_ptr<const CompiledRegex> > regex;
+        size_t bytes;
+    };
+
+    // Guards all of the other members.
+    mutable mutex lock;
+
+    // The cached regexes, most recently used first, and an index into them
+    // by pattern text.
+    list<Entry> entries;
+    unordered_map<string, list<Entry>::iterator> index;
+
+    // The regexes that were too large for the budget, which are still
+    // returned for their patterns while callers hold them.
+    unordered_map<string, weak_ptr<const CompiledRegex> > oversized;
+
+    // The memory budget, and the memory used by the cached regexes.
+    size_t budget;
+    size_t used;
+
+    unsigned long numHits, numMisses, numEvictions, numRejected;
+
+    void evict();
+};
+
+
+RegexCache & regexCache();
+
+#endif // REGEXCACHE_H
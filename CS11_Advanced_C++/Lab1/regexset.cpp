@@ -0,0 +1,117 @@
+#include "regexset.h"
+
+#include <algorithm>
+
+
+/* Parse and compile all of the regexes in exprs into one set. */
+RegexSet::RegexSet(const vector<string> &exprs)
+    : exprs(exprs), regexes(parseAll(exprs)),
+      automatonIndexes(automatonRegexes(regexes)),
+      prog(selectRegexes(regexes, automatonIndexes)), id(newRegexId()) {
+    for (int i = 0; i < (int) regexes.size(); i++) {
+        if (!binary_search(automatonIndexes.begin(), automatonIndexes.end(),
+                           i)) {
+            backtrackIndexes.push_back(i);
+            backtrackCodes.push_back(BytecodeProgram(regexes[i]));
+        }
+    }
+}
+
+
+/* Delete the regex operators owned by the set. */
+RegexSet::~RegexSet() {
+    for (vector<RegexOperator *> &regex : regexes) {
+        for (RegexOperator *op : regex)
+            delete op;
+    }
+}
+
+
+/* Parse each of the regexes in exprs. */
+vector<vector<RegexOperator *> >
+RegexSet::parseAll(const vector<string> &exprs) {
+    vector<vector<RegexOperator *> > result;
+    for (const string &expr : exprs)
+        result.push_back(parseRegex(expr));
+    return result;
+}
+
+
+/* Returns the indexes of the regexes that an automaton can run, which are
+ * all of them except those that need the backtracking engine, and those that
+ * would take the combined NFA program past NFA_MAX_INSTS instructions.
+ */
+vector<int>
+RegexSet::automatonRegexes(const vector<vector<RegexOperator *> > &regexes) {
+    vector<int> indexes;
+    size_t total = 0;
+    for (int i = 0; i < (int) regexes.size(); i++) {
+        size_t count = NFAProgram::countInsts(regexes[i]);
+        if (!needsBacktracking(regexes[i]) && total + count <= NFA_MAX_INSTS) {
+            indexes.push_back(i);
+            total += count;
+        }
+    }
+    return indexes;
+}
+
+
+/* Returns the regexes with the given indexes. */
+vector<vector<RegexOperator *> >
+RegexSet::selectRegexes(const vector<vector<RegexOperator *> > &regexes,
+                        const vector<int> &indexes) {
+    vector<vector<RegexOperator *> > result;
+    for (int i : indexes)
+        result.push_back(regexes[i]);
+    return result;
+}
+
+
+/* Returns the number of regexes in the set. */
+int RegexSet::size() const {
+    return (int) exprs.size();
+}
+
+
+/* Returns the pattern text of the regex with the given index. */
+const string & RegexSet::pattern(int index) const {
+    return exprs[index];
+}
+
+
+/* Returns the indexes of the regexes in the set that have a match in the
+ * string s, in increasing order, using the calling thread's match context.
+ */
+vector<int> RegexSet::matches(string_view s) const {
+    return matches(s, threadMatchContext());
+}
+
+
+/* Returns the indexes of the regexes in the set that have a match in the
+ * string s, in increasing order, using the scratch state in ctx.
+ */
+vector<int> RegexSet::matches(string_view s, MatchContext &ctx) const {
+    if (ctx.dfaOwner != id || !ctx.dfa) {
+        ctx.dfa.reset(new LazyDFA(prog));
+        ctx.dfaOwner = id;
+    }
+
+    vector<bool> &matched = ctx.setMatched;
+    matched.assign(automatonIndexes.size(), false);
+    int found = ctx.dfa->findMatching(s, matched);
+
+    vector<int> result;
+    for (int i = 0; found > 0 && i < (int) matched.size(); i++) {
+        if (matched[i])
+            result.push_back(automatonIndexes[i]);
+    }
+
+    if (!backtrackIndexes.empty()) {
+        for (size_t i = 0; i < backtrackIndexes.size(); i++) {
+            if (bytecodeFind(backtrackCodes[i], s, ctx.backtrack).start != -1)
+                result.push_back(backtrackIndexes[i]);
+        }
+        sort(result.begin(), result.end());
+    }
+    return result;
+}
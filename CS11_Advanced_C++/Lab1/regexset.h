@@ -0,0 +1,61 @@
+#ifndef REGEXSET_H
+#define REGEXSET_H
+
+#include "engine.h"
+
+
+/* A set of regexes that are all searched for at once.  The regexes are
+ * compiled into a single NFA program, and a lazily built DFA runs that
+ * program over the string, so each string is scanned once no matter how
+ * many regexes the set holds.  The result is the indexes of the regexes
+ * that find() would report a match for.  A regex with possessive operators
+ * that an automaton cannot express is searched for on its own, with the
+ * backtracking engine.
+ *
+ * Like a CompiledRegex, a RegexSet is never modified after it is
+ * constructed, and can be shared by many threads as long as each thread
+ * uses its own MatchContext.  The RegexSet owns its regex operators.
+ */
+class RegexSet {
+public:
+    RegexSet(const vector<string> &exprs);
+    ~RegexSet();
+
+    RegexSet(const RegexSet &) = delete;
+    RegexSet & operator=(const RegexSet &) = delete;
+
+    int size() const;
+    const string & pattern(int index) const;
+
+    vector<int> matches(string_view s) const;
+    vector<int> matches(string_view s, MatchContext &ctx) const;
+
+private:
+    // The pattern text of each regex, and its parsed operators.
+    vector<string> exprs;
+    vector<vector<RegexOperator *> > regexes;
+
+    // The indexes of the regexes that an automaton can run, and the NFA
+    // program that runs all of them at once.
+    vector<int> automatonIndexes;
+    NFAProgram prog;
+
+    // The indexes of the regexes with possessive operators that only the
+    // backtracking engine can run, and their bytecode programs.
+    vector<int> backtrackIndexes;
+    vector<BytecodeProgram> backtrackCodes;
+
+    // A unique id, so that match contexts can tell which regex set their
+    // cached DFA was built for.
+    unsigned long id;
+
+    static vector<vector<RegexOperator *> >
+        parseAll(const vector<string> &exprs);
+    static vector<int>
+        automatonRegexes(const vector<vector<RegexOperator *> > &regexes);
+    static vector<vector<RegexOperator *> >
+        selectRegexes(const vector<vector<RegexOperator *> > &regexes,
+                      const vector<int> &indexes);
+};
+
+#endif // REGEXSET_H
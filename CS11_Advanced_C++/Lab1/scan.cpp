@@ -0,0 +1,150 @@
+#include "scan.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+
+/* Initialize a scanner that accepts every character. */
+ByteScanner::ByteScanner() : mode(SCAN_ALL), numBytes(0) {
+    set.invert();
+}
+
+
+/* Initialize a scanner for the characters in set, choosing how to search
+ * based on the size of the set.
+ */
+ByteScanner::ByteScanner(const CharSet &set) : set(set), numBytes(0) {
+    int count = set.count();
+    if (count == 256) {
+        mode = SCAN_ALL;
+        return;
+    }
+
+    if (count <= MAX_SIMD_BYTES) {
+        for (int c = 0; c < 256; c++) {
+            if (set.contains((unsigned char) c))
+                bytes[numBytes++] = (unsigned char) c;
+        }
+    }
+
+    if (count == 1)
+        mode = SCAN_MEMCHR;
+#ifdef __SSE2__
+    else if (count <= MAX_SIMD_BYTES)
+        mode = SCAN_SIMD;
+#endif
+    else
+        mode = SCAN_TABLE;
+}
+
+
+/* Returns true if the scanner accepts every character, so that scanning
+ * would never skip anything.
+ */
+bool ByteScanner::scansAll() const {
+    return mode == SCAN_ALL;
+}
+
+
+/* Returns the first index i in [from, length) where s[i] is in the
+ * scanner's set, or length if there is no such index.
+ */
+size_t ByteScanner::next(const char *s, size_t from, size_t length) const {
+    if (from >= length)
+        return length;
+
+    switch (mode) {
+        case SCAN_ALL:
+            return from;
+
+        case SCAN_MEMCHR:
+            {
+                const void *p = memchr(s + from, bytes[0], length - from);
+                return p ? (const char *) p - s : length;
+            }
+
+#ifdef __SSE2__
+        case SCAN_SIMD:
+            {
+                size_t i = from;
+#ifdef __AVX2__
+                __m256i wide[MAX_SIMD_BYTES];
+                for (int b = 0; b < numBytes; b++)
+                    wide[b] = _mm256_set1_epi8((char) bytes[b]);
+                for (; i + 32 <= length; i += 32) {
+                    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+                    __m256i hits = _mm256_cmpeq_epi8(v, wide[0]);
+                    for (int b = 1; b < numBytes; b++)
+                        hits = _mm256_or_si256(hits,
+                                               _mm256_cmpeq_epi8(v, wide[b]));
+                    unsigned mask = (unsigned) _mm256_movemask_epi8(hits);
+                    if (mask)
+                        return i + __builtin_ctz(mask);
+                }
+#endif
+                __m128i needles[MAX_SIMD_BYTES];
+                for (int b = 0; b < numBytes; b++)
+                    needles[b] = _mm_set1_epi8((char) bytes[b]);
+                for (; i + 16 <= length; i += 16) {
+                    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+                    __m128i hits = _mm_cmpeq_epi8(v, needles[0]);
+                    for (int b = 1; b < numBytes; b++)
+                        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, needles[b]));
+                    unsigned mask = (unsigned) _mm_movemask_epi8(hits);
+                    if (mask)
+                        return i + __builtin_ctz(mask);
+                }
+                // Fewer than 16 characters are left.
+                return nextInTable(s, i, length);
+            }
+#endif
+
+        default:
+            return nextInTable(s, from, length);
+    }
+}
+
+
+/* Returns the first index i in [from, length) where s[i] is in the
+ * scanner's set, testing one character at a time against the bitmap.
+ */
+size_t ByteScanner::nextInTable(const char *s, size_t from,
+                                size_t length) const {
+    for (size_t i = from; i < length; i++) {
+        if (set.contains((unsigned char) s[i]))
+            return i;
+    }
+    return length;
+}
+
+
+/* Compute the set of characters that can begin a match of the regex:  the
+ * characters of each leading optional operator, up to and including the
+ * first operator that must match at least once.
+ *
+ * Returns false if every operator is optional, since then the regex can
+ * match the empty string anywhere, and any character can begin a match.
+ */
+bool firstChars(const vector<RegexOperator *> &regex, CharSet &set) {
+    set = CharSet();
+    for (const RegexOperator *op : regex) {
+        set.addAll(op->charSet());
+        if (op->getMinRepeat() > 0)
+            return true;
+    }
+    return false;
+}
+
+
+/* Returns a scanner for the characters that can begin a match of the regex.
+ * If any character can begin a match, the scanner accepts every character.
+ */
+ByteScanner firstCharScanner(const vector<RegexOperator *> &regex) {
+    CharSet set;
+    if (!firstChars(regex, set))
+        return ByteScanner();
+    return ByteScanner(set);
+}
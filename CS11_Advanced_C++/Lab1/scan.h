@@ -0,0 +1,50 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "regex.h"
+
+#include <cstddef>
+
+
+/* Finds the next index in a string where a character from a given set
+ * occurs.  The engines use this to skip over start indexes where a match
+ * cannot possibly begin.
+ *
+ * The scanner picks the fastest way to search for its set:  memchr() for a
+ * single character, SSE2 or AVX2 byte comparisons for a few characters, and
+ * a bitmap lookup per character otherwise.  A scanner for the set of all
+ * characters does no scanning at all.
+ */
+class ByteScanner {
+public:
+    ByteScanner();
+    ByteScanner(const CharSet &set);
+
+    size_t next(const char *s, size_t from, size_t length) const;
+    bool scansAll() const;
+
+    // Returns true if c is in the scanner's set, for searches that look at
+    // one character at a time instead of scanning a string.
+    bool contains(char c) const {
+        return set.contains((unsigned char) c);
+    }
+
+private:
+    enum Mode { SCAN_ALL, SCAN_MEMCHR, SCAN_SIMD, SCAN_TABLE };
+
+    // The largest set searched for with SIMD byte comparisons.
+    static const int MAX_SIMD_BYTES = 4;
+
+    Mode mode;
+    CharSet set;
+    unsigned char bytes[MAX_SIMD_BYTES];
+    int numBytes;
+
+    size_t nextInTable(const char *s, size_t from, size_t length) const;
+};
+
+
+bool firstChars(const vector<RegexOperator *> &regex, CharSet &set);
+ByteScanner firstCharScanner(const vector<RegexOperator *> &regex);
+
+#endif // SCAN_H
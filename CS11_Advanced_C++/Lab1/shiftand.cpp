@@ -0,0 +1,171 @@
+#include "shiftand.h"
+
+
+/* Build the masks for the regex. */
+void ShiftAndMasks::build(const vector<RegexOperator *> &regex) {
+    int numOps = (int) regex.size();
+    assert(numOps <= SHIFT_AND_MAX_OPS);
+
+    for (int c = 0; c < 256; c++)
+        accepts[c] = 0;
+    repeat = optional = blockBefore = blockLast = leading = last = 0;
+
+    for (int i = 0; i < numOps; i++) {
+        uint64_t bit = (uint64_t) 1 << i;
+        const RegexOperator *op = regex[i];
+
+        CharSet set = op->charSet();
+        for (int c = 0; c < 256; c++) {
+            if (set.contains((unsigned char) c))
+                accepts[c] |= bit;
+        }
+
+        if (op->getMaxRepeat() == -1)
+            repeat |= bit;
+        if (op->getMinRepeat() == 0) {
+            optional |= bit;
+
+            // Mark the start and end of each block of optional operators.
+            bool first = (i == 0 || regex[i - 1]->getMinRepeat() > 0);
+            bool final = (i == numOps - 1 || regex[i + 1]->getMinRepeat() > 0);
+            if (first)
+                blockBefore |= (i == 0) ? bit : bit >> 1;
+            if (final)
+                blockLast |= bit;
+        }
+    }
+
+    for (int i = 0; i < numOps && regex[i]->getMinRepeat() == 0; i++)
+        leading |= (uint64_t) 1 << i;
+    if (numOps > 0)
+        last = (uint64_t) 1 << (numOps - 1);
+}
+
+
+/* Carry each match of an operator through the block of optional operators
+ * that follows it, as if they had all matched the empty string.
+ *
+ * Setting the last bit of each block stops the subtraction from borrowing
+ * out of the block; subtracting the bit before the block then clears the
+ * lowest set bit in the block, and the XOR leaves exactly the bits above it.
+ */
+static inline uint64_t closeOptional(uint64_t d, const ShiftAndMasks &m) {
+    uint64_t df = d | m.blockLast;
+    return d | (m.optional & (~(df - m.blockBefore) ^ df));
+}
+
+
+/* Advance the state d over the character c.  If start is set, a new match
+ * may begin at this character.
+ */
+static inline uint64_t step(uint64_t d, unsigned char c, bool start,
+                            const ShiftAndMasks &m) {
+    if (start)
+        d |= m.leading;
+    uint64_t next = ((d << 1) | (uint64_t) start | (d & m.repeat))
+                    & m.accepts[c];
+    return closeOptional(next, m);
+}
+
+
+/* Returns true if the regex is small and simple enough for the Shift-And
+ * automaton.
+ */
+bool ShiftAndMatcher::supports(const vector<RegexOperator *> &regex) {
+    if (regex.empty() || regex.size() > SHIFT_AND_MAX_OPS)
+        return false;
+
+    for (const RegexOperator *op : regex) {
+        if (op->getMinRepeat() > 1)
+            return false;
+        if (op->getMaxRepeat() != 1 && op->getMaxRepeat() != -1)
+            return false;
+    }
+    return true;
+}
+
+
+/* Build the forward and backward automata for the regex, which must be
+ * supported.
+ */
+ShiftAndMatcher::ShiftAndMatcher(const vector<RegexOperator *> &regex) {
+    assert(supports(regex));
+
+    vector<RegexOperator *> reversed(regex.rbegin(), regex.rend());
+    forward.build(regex);
+    backward.build(reversed);
+
+    nullable = (forward.leading == ((forward.last << 1) - 1));
+}
+
+
+/* Returns the end of the longest match starting at the index start, or -1
+ * if no match starts there.
+ */
+ptrdiff_t ShiftAndMatcher::longestFrom(string_view s,
+                                       ptrdiff_t start) const {
+    ptrdiff_t length = (ptrdiff_t) s.length();
+    ptrdiff_t end = nullable ? start : -1;
+
+    uint64_t d = 0;
+    for (ptrdiff_t i = start; i < length; i++) {
+        d = step(d, (unsigned char) s[i], i == start, forward);
+        if (d == 0)
+            break;
+        if (d & forward.last)
+            end = i + 1;
+    }
+    return end;
+}
+
+
+/* Find the first match of the regex in the string s that starts at or after
+ * the index from.  If no match is found, it returns a range of
+ * Range(-1, -1).
+ */
+Range ShiftAndMatcher::find(string_view s, size_t from) const {
+    ptrdiff_t length = (ptrdiff_t) s.length();
+    ptrdiff_t first = (ptrdiff_t) from;
+    if (from >= s.length())
+        return Range(-1, -1);
+
+    // A regex that matches the empty string always matches at once.
+    if (nullable)
+        return Range(first, longestFrom(s, first));
+
+    // Find the earliest end of any match.
+    ptrdiff_t earliestEnd = -1;
+    uint64_t d = 0;
+    for (ptrdiff_t i = first; i < length; i++) {
+        d = step(d, (unsigned char) s[i], true, forward);
+        if (d & forward.last) {
+            earliestEnd = i + 1;
+            break;
+        }
+    }
+    if (earliestEnd == -1)
+        return Range(-1, -1);
+
+    // Run the reversed regex backward from there.  The leftmost start of a
+    // match ending there is also the leftmost start of any match.
+    ptrdiff_t start = -1;
+    d = 0;
+    for (ptrdiff_t i = earliestEnd - 1; i >= first; i--) {
+        d = step(d, (unsigned char) s[i], i == earliestEnd - 1, backward);
+        if (d == 0)
+            break;
+        if (d & backward.last)
+            start = i;
+    }
+    assert(start != -1);
+
+    return Range(start, longestFrom(s, start));
+}
+
+
+/* Check if a string exactly matches the regex with all characters
+ * consumed.
+ */
+bool ShiftAndMatcher::match(string_view s) const {
+    return !s.empty() && longestFrom(s, 0) == (ptrdiff_t) s.length();
+}
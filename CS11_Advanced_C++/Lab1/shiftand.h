@@ -0,0 +1,69 @@
+#ifndef SHIFTAND_H
+#define SHIFTAND_H
+
+#include "regex.h"
+
+#include <cstdint>
+
+
+// The largest number of regex operators a ShiftAndMatcher can handle.
+#define SHIFT_AND_MAX_OPS 64
+
+
+/* The bit masks of a Shift-And automaton for one direction of a regex.  Bit
+ * i of a state word is set when the first i + 1 operators have matched the
+ * text that ends at the current index.
+ */
+struct ShiftAndMasks {
+    // The operators that accept each character.
+    uint64_t accepts[256];
+
+    // The operators that may repeat, and the operators that are optional.
+    uint64_t repeat, optional;
+
+    // For each block of consecutive optional operators:  the bit just
+    // before the block (or its first bit, for a block that begins the
+    // regex), and the last bit of the block.  Used to carry a match through
+    // the optional operators that follow it.
+    uint64_t blockBefore, blockLast;
+
+    // The optional operators at the start of the regex, and the bit of the
+    // last operator.
+    uint64_t leading, last;
+
+    void build(const vector<RegexOperator *> &regex);
+};
+
+
+/* A bit-parallel matcher for regexes of up to 64 operators, where each
+ * operator is used once, or with the ?, * or + modifier.  The state of the
+ * whole automaton fits in one 64-bit word, so each character of the string
+ * costs a few shifts, ANDs and ORs no matter how much backtracking the regex
+ * would need.
+ *
+ * A search makes up to three passes over the string:  a forward pass to find
+ * the earliest index where any match ends, a backward pass over the reversed
+ * regex from that index to find the leftmost start, and a forward pass from
+ * the start to find the end of the longest match.  Since every operator
+ * consumes exactly one character, that longest match is the one the
+ * backtracking engine reports.
+ *
+ * A ShiftAndMatcher is not modified by searching, so it is thread-safe.
+ */
+class ShiftAndMatcher {
+public:
+    ShiftAndMatcher(const vector<RegexOperator *> &regex);
+
+    static bool supports(const vector<RegexOperator *> &regex);
+
+    Range find(string_view s, size_t from = 0) const;
+    bool match(string_view s) const;
+
+private:
+    ShiftAndMasks forward, backward;
+    bool nullable;
+
+    ptrdiff_t longestFrom(string_view s, ptrdiff_t start) const;
+};
+
+#endif // SHIFTAND_H
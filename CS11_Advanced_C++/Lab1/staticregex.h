@@ -0,0 +1,520 @@
+#ifndef STATICREGEX_H
+#define STATICREGEX_H
+
+#include "bytecode.h"
+#include "charset.h"
+#include "regex.h"
+
+#include <cstring>
+
+
+/*===========================================================================
+ * COMPILE-TIME REGEXES
+ *
+ * A regex whose pattern is known when the program is built can be parsed by
+ * the compiler instead of by parseRegex().  The pattern must be a constexpr
+ * character array with static storage, such as
+ *
+ *     constexpr char route[] = "/api/v[0-9]+/users";
+ *     Range r = StaticRegex<route>::find(path);
+ *
+ * Each operator of the pattern becomes a template instantiation, so the
+ * whole matcher is inlined and unrolled by the compiler, with no virtual
+ * calls.  The pattern syntax and the find() and match() results are the
+ * same as for parseRegex() and the engines.
+ *
+ * As parseRegex() does, the parser makes repeated operators possessive
+ * where that cannot change the matches.  A pattern that can still give back
+ * repetitions remembers the (operator, index) states it has explored, like
+ * the backtracking engine, so that no pattern takes exponential time.  The
+ * bitmap lives in a BacktrackScratch, either the caller's or one local to
+ * the calling thread, and only the words a search touched are cleared
+ * afterwards, so a search does not allocate or clear memory in proportion
+ * to the length of the string.
+ */
+
+
+// The longest required literal that is kept for a compile-time regex.  Any
+// part of a required literal is also required, so longer ones are cut off.
+#define STATIC_LITERAL_MAX 32
+
+
+// The kinds of operator in a compile-time regex.  Both kinds of character
+// class become a STATIC_SET, since an excluded set is simply inverted.
+enum StaticOpType {
+    STATIC_CHAR,
+    STATIC_ANY,
+    STATIC_SET
+};
+
+
+/* A regex operator parsed at compile time, along with the index in the
+ * pattern just past the operator and its repeat modifiers.
+ */
+struct StaticOp {
+    StaticOpType type;
+    char ch;
+    CharSet chars;
+    int minRepeat;
+    int maxRepeat;
+    bool possessive;
+    int next;
+};
+
+
+/* Returns true if there are no more operators in the pattern from the index
+ * pos on.  A trailing backslash escapes nothing, so it adds no operator.
+ */
+constexpr bool staticAtEnd(const char *pattern, int pos) {
+    return pattern[pos] == '\0' ||
+        (pattern[pos] == '\\' && pattern[pos + 1] == '\0');
+}
+
+
+/* Parses a counted repeat modifier that begins with the '{' at the index pos
+ * in the pattern, the same way that parseRepeatCount() does.  Returns the
+ * index of the closing '}', or pos if there is no repeat modifier there.
+ */
+constexpr int parseStaticCount(const char *pattern, int pos, int &minRepeat,
+                               int &maxRepeat) {
+    int j = pos + 1;
+    int counts[2] = {0, -1};
+    for (int k = 0; k < 2; k++) {
+        if (k == 1 && pattern[j] == '}')
+            break;
+        if (pattern[j] < '0' || pattern[j] > '9')
+            return pos;
+
+        counts[k] = 0;
+        for (; pattern[j] >= '0' && pattern[j] <= '9'; j++) {
+            counts[k] = counts[k] * 10 + (pattern[j] - '0');
+            if (counts[k] > REGEX_MAX_REPEAT)
+                return pos;
+        }
+
+        if (k == 0) {
+            if (pattern[j] == '}') {
+                counts[1] = counts[0];
+                break;
+            }
+            if (pattern[j] != ',')
+                return pos;
+            j++;
+        }
+    }
+    if (pattern[j] != '}')
+        return pos;
+    if (counts[1] != -1 && counts[1] < counts[0])
+        return pos;
+
+    minRepeat = counts[0];
+    maxRepeat = counts[1];
+    return j;
+}
+
+
+/* Parses the operator at the index pos in the pattern, and its repeat
+ * modifiers, the same way that parseRegex() does.
+ */
+constexpr StaticOp parseStaticOp(const char *pattern, int pos) {
+    StaticOp op = {STATIC_CHAR, pattern[pos], CharSet(), 1, 1, false,
+                   pos + 1};
+
+    if (pattern[pos] == '\\') {
+        op.ch = pattern[pos + 1];
+        op.next = pos + 2;
+    }
+    else if (pattern[pos] == '.') {
+        op.type = STATIC_ANY;
+    }
+    else if (pattern[pos] == '[') {
+        bool exclude = false;
+        int i = pos + 1;
+        for (; pattern[i] != '\0' && pattern[i] != ']'; i++) {
+            if (pattern[i] == '^') {
+                exclude = true;
+            }
+            else if (pattern[i + 1] == '-' && pattern[i + 2] != '\0' &&
+                     pattern[i + 2] != ']') {
+                op.chars.addRange(pattern[i], pattern[i + 2]);
+                i += 2;
+            }
+            else {
+                op.chars.add(pattern[i]);
+            }
+        }
+        if (exclude)
+            op.chars.invert();
+        op.type = STATIC_SET;
+        op.next = (pattern[i] == ']') ? i + 1 : i;
+    }
+
+    // Apply the repeat modifiers that follow the operator.  A '+' right
+    // after another repeat modifier makes the operator possessive.
+    for (bool quantified = false; ; op.next++) {
+        char c = pattern[op.next];
+        if (c == '+' && quantified) {
+            op.possessive = true;
+            quantified = false;
+            continue;
+        }
+        quantified = true;
+        if (c == '+') {
+            op.minRepeat = 1;
+            op.maxRepeat = -1;
+        }
+        else if (c == '*') {
+            op.minRepeat = 0;
+            op.maxRepeat = -1;
+        }
+        else if (c == '?') {
+            op.minRepeat = 0;
+        }
+        else if (c == '{') {
+            int end = parseStaticCount(pattern, op.next, op.minRepeat,
+                                       op.maxRepeat);
+            if (end == op.next)
+                break;
+            op.next = end;
+        }
+        else {
+            break;
+        }
+    }
+    return op;
+}
+
+
+/* Returns the set of characters that the operator accepts. */
+constexpr CharSet staticOpChars(const StaticOp &op) {
+    CharSet set;
+    if (op.type == STATIC_CHAR)
+        set.add(op.ch);
+    else if (op.type == STATIC_SET)
+        set = op.chars;
+    else
+        set.invert();
+    return set;
+}
+
+
+/* Returns the set of characters that can begin a match of the pattern from
+ * the index pos on, or every character if all of the operators from there
+ * are optional.
+ */
+constexpr CharSet staticFirstChars(const char *pattern, int pos) {
+    CharSet set;
+    while (!staticAtEnd(pattern, pos)) {
+        StaticOp op = parseStaticOp(pattern, pos);
+        set.addAll(staticOpChars(op));
+        if (op.minRepeat > 0)
+            return set;
+        pos = op.next;
+    }
+    CharSet all;
+    all.invert();
+    return all;
+}
+
+
+/* Parses the operator at the index pos in the pattern, and makes it
+ * possessive where possessify() would:  where none of the characters it
+ * accepts can be matched by the operators that follow, up to the first
+ * required one.
+ */
+constexpr StaticOp staticOpAt(const char *pattern, int pos) {
+    StaticOp op = parseStaticOp(pattern, pos);
+    if (op.possessive || op.minRepeat == op.maxRepeat)
+        return op;
+
+    CharSet following;
+    for (int i = op.next; !staticAtEnd(pattern, i); ) {
+        StaticOp next = parseStaticOp(pattern, i);
+        following.addAll(staticOpChars(next));
+        if (next.minRepeat > 0)
+            break;
+        i = next.next;
+    }
+    if (!staticOpChars(op).intersects(following))
+        op.possessive = true;
+    return op;
+}
+
+
+/* Returns the number of operators in the pattern. */
+constexpr int staticNumOps(const char *pattern) {
+    int n = 0;
+    for (int pos = 0; !staticAtEnd(pattern, pos); n++)
+        pos = parseStaticOp(pattern, pos).next;
+    return n;
+}
+
+
+/* Returns true if some operator of the pattern can give back repetitions,
+ * as givesBack() does, once the operators have been made possessive where
+ * they can be.
+ */
+constexpr bool staticGivesBack(const char *pattern) {
+    for (int pos = 0; !staticAtEnd(pattern, pos); ) {
+        StaticOp op = staticOpAt(pattern, pos);
+        if (!op.possessive && op.minRepeat != op.maxRepeat)
+            return true;
+        pos = op.next;
+    }
+    return false;
+}
+
+
+/* Returns the only character in the set, or -1 if the set does not hold
+ * exactly one character.
+ */
+constexpr int staticOnlyChar(const CharSet &set) {
+    int only = -1;
+    for (int c = 0; c < 256; c++) {
+        if (set.contains((unsigned char) c)) {
+            if (only != -1)
+                return -1;
+            only = c;
+        }
+    }
+    return only;
+}
+
+
+/* A literal string that every match of a compile-time regex must contain,
+ * with the Boyer-Moore-Horspool shift table for searching for it, as in a
+ * LiteralSearcher.
+ */
+struct StaticLiteral {
+    char chars[STATIC_LITERAL_MAX];
+    int length;
+
+    // How far the window may shift when its last character is c.
+    int shift[256];
+};
+
+
+/* Appends the character c to the literal, unless it is already full. */
+constexpr void staticAppend(StaticLiteral &lit, char c) {
+    if (lit.length < STATIC_LITERAL_MAX)
+        lit.chars[lit.length++] = c;
+}
+
+
+/* Finds the longest literal that every match of the pattern must contain,
+ * in the same way as requiredLiteral().
+ */
+constexpr StaticLiteral staticRequiredLiteral(const char *pattern) {
+    StaticLiteral best = {{}, 0, {}}, run = {{}, 0, {}};
+    for (int pos = 0; !staticAtEnd(pattern, pos); ) {
+        StaticOp op = parseStaticOp(pattern, pos);
+        pos = op.next;
+
+        int c = -1;
+        if (op.type == STATIC_CHAR)
+            c = (unsigned char) op.ch;
+        else if (op.type == STATIC_SET)
+            c = staticOnlyChar(op.chars);
+
+        if (c == -1) {
+            if (run.length > best.length)
+                best = run;
+            run.length = 0;
+            continue;
+        }
+
+        for (int i = 0; i < op.minRepeat; i++)
+            staticAppend(run, (char) c);
+        if (op.maxRepeat != op.minRepeat) {
+            if (run.length > best.length)
+                best = run;
+            run.length = 0;
+            if (op.minRepeat > 0)
+                staticAppend(run, (char) c);
+        }
+    }
+    if (run.length > best.length)
+        best = run;
+
+    for (int c = 0; c < 256; c++)
+        best.shift[c] = best.length;
+    for (int i = 0; i + 1 < best.length; i++)
+        best.shift[(unsigned char) best.chars[i]] = best.length - 1 - i;
+    return best;
+}
+
+
+/* Returns true if the literal occurs in the first length characters of s. */
+inline bool staticOccursIn(const StaticLiteral &lit, const char *s,
+                           ptrdiff_t length) {
+    ptrdiff_t m = lit.length;
+    if (m == 1)
+        return memchr(s, lit.chars[0], length) != nullptr;
+
+    unsigned char last = (unsigned char) lit.chars[m - 1];
+    for (ptrdiff_t i = 0; i + m <= length; ) {
+        unsigned char c = (unsigned char) s[i + m - 1];
+        if (c == last && memcmp(s + i, lit.chars, m - 1) == 0)
+            return true;
+        i += lit.shift[c];
+    }
+    return false;
+}
+
+
+/* The matcher for the operators of the pattern from the index Pos on, the
+ * operator with index Index and those after it.  Each instantiation matches
+ * one operator, and calls the matcher for the rest of the pattern.
+ */
+template <const char *Pattern, int Pos, int Index = 0,
+          bool End = staticAtEnd(Pattern, Pos)>
+struct StaticMatcher {
+    static constexpr StaticOp op = staticOpAt(Pattern, Pos);
+    static constexpr int numOps = staticNumOps(Pattern);
+    typedef StaticMatcher<Pattern, op.next, Index + 1> Next;
+
+    static bool matchChar(char c) {
+        if constexpr (op.type == STATIC_ANY)
+            return true;
+        else if constexpr (op.type == STATIC_CHAR)
+            return c == op.ch;
+        else
+            return op.chars.contains((unsigned char) c);
+    }
+
+    /* Match the rest of the pattern starting at the index i of s, taking as
+     * many repetitions of this operator as possible and backtracking from
+     * there, unless the operator is possessive, as the backtracking engine
+     * does.  Returns the end of the match, or -1 if there is none.  If
+     * visited is not null, it remembers each operator at each index once
+     * that state has been explored.
+     */
+    static ptrdiff_t matchAt(const char *s, ptrdiff_t length, ptrdiff_t i,
+                             BacktrackScratch *visited) {
+        // A state that was explored before failed, since a match would have
+        // ended the search.
+        if (visited != nullptr && visited->visit((size_t) i * numOps + Index))
+            return -1;
+
+        ptrdiff_t count = 0;
+        while ((op.maxRepeat == -1 || count < op.maxRepeat) &&
+               i + count < length && matchChar(s[i + count]))
+            count++;
+
+        if constexpr (op.possessive) {
+            if (count < op.minRepeat)
+                return -1;
+            return Next::matchAt(s, length, i + count, visited);
+        }
+        for (; count >= op.minRepeat; count--) {
+            ptrdiff_t end = Next::matchAt(s, length, i + count, visited);
+            if (end != -1)
+                return end;
+        }
+        return -1;
+    }
+};
+
+
+/* The end of the pattern, which matches the empty string. */
+template <const char *Pattern, int Pos, int Index>
+struct StaticMatcher<Pattern, Pos, Index, true> {
+    static ptrdiff_t matchAt(const char *s, ptrdiff_t length, ptrdiff_t i,
+                             BacktrackScratch *visited) {
+        return i;
+    }
+};
+
+
+/* A regex parsed at compile time from the constexpr character array
+ * Pattern.
+ */
+template <const char *Pattern>
+class StaticRegex {
+public:
+    /* Find the first match of the regex in the string s, using scratch
+     * space local to the calling thread.
+     */
+    static Range find(string_view s) {
+        thread_local BacktrackScratch scratch;
+        return find(s, scratch);
+    }
+
+    /* Find the first match of the regex in the string s, using the scratch
+     * space in scratch.  Strings without the required literal are rejected
+     * at once.  Otherwise only the indexes where a match can begin are
+     * tried; if there is just one character that can begin a match, memchr()
+     * skips to it.  If no match is found, it returns a range of
+     * Range(-1, -1).
+     *
+     * If the pattern can give back repetitions, the states explored from
+     * every start index are remembered in the scratch space's bitmap of
+     * (length + 1) * operators bits, unless that is more than
+     * BACKTRACK_MEMO_MAX_STATES.
+     */
+    static Range find(string_view s, BacktrackScratch &scratch) {
+        const char *data = s.data();
+        ptrdiff_t length = (ptrdiff_t) s.length();
+        if constexpr (required.length > 0) {
+            if (!staticOccursIn(required, data, length))
+                return Range(-1, -1);
+        }
+
+        BacktrackScratch *visited = nullptr;
+        if constexpr (staticGivesBack(Pattern)) {
+            size_t states = (size_t) (length + 1) *
+                StaticMatcher<Pattern, 0>::numOps;
+            if (scratch.startVisits(states))
+                visited = &scratch;
+        }
+        Range matched(-1, -1);
+        for (ptrdiff_t i = 0; i < length; i++) {
+            if constexpr (startChar != -1) {
+                const void *p = memchr(data + i, startChar, length - i);
+                if (p == nullptr)
+                    break;
+                i = (const char *) p - data;
+            }
+            else if (!starts.contains((unsigned char) data[i])) {
+                continue;
+            }
+
+            ptrdiff_t end = StaticMatcher<Pattern, 0>::matchAt(data, length,
+                                                               i, visited);
+            if (end != -1) {
+                matched = Range(i, end);
+                break;
+            }
+        }
+
+        if (visited != nullptr)
+            scratch.clearVisited();
+        return matched;
+    }
+
+    /* Check if a string exactly matches the regex with all characters
+     * consumed.
+     */
+    static bool match(string_view s) {
+        Range r = find(s);
+        return r.start == 0 && r.end == (ptrdiff_t) s.length();
+    }
+
+    /* Check if a string exactly matches the regex with all characters
+     * consumed, using the scratch space in scratch.
+     */
+    static bool match(string_view s, BacktrackScratch &scratch) {
+        Range r = find(s, scratch);
+        return r.start == 0 && r.end == (ptrdiff_t) s.length();
+    }
+
+private:
+    // The characters that can begin a match.
+    static constexpr CharSet starts = staticFirstChars(Pattern, 0);
+    static constexpr int startChar = staticOnlyChar(starts);
+
+    // The literal that every match must contain.
+    static constexpr StaticLiteral required = staticRequiredLiteral(Pattern);
+};
+
+#endif // STATICREGEX_H
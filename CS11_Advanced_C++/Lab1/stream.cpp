@@ -0,0 +1,181 @@
+#include "stream.h"
+
+
+/* Initialize a matcher for the regex, which passes each match it finds to
+ * the callback.  The regex must be supported.
+ */
+StreamMatcher::StreamMatcher(const vector<RegexOperator *> &regex,
+                             Callback callback)
+    : prog(regex), callback(callback), onList(prog.size(), -1),
+      generation(0), base(0), matchStart(-1), matchEnd(-1) {
+    assert(supports(regex));
+}
+
+
+/* Returns true if a StreamMatcher can run the regex:  one without possessive
+ * operators that an automaton cannot express, and whose NFA program is not
+ * too large.
+ */
+bool StreamMatcher::supports(const vector<RegexOperator *> &regex) {
+    return !needsBacktracking(regex) && NFAProgram::supports(regex);
+}
+
+
+/* Returns the number of bytes fed to the matcher so far. */
+uint64_t StreamMatcher::offset() const {
+    return base + pending.size();
+}
+
+
+/* Returns the number of bytes the matcher is keeping. */
+size_t StreamMatcher::bufferedBytes() const {
+    return pending.size();
+}
+
+
+/* Search the bytes [data, data + length), which follow the bytes fed so far
+ * in the stream, and report each match that is complete.
+ */
+void StreamMatcher::feed(const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        // While no match is being tried, skip to the next byte that can
+        // begin one.
+        if (clist.empty() && matchStart == -1) {
+            size_t next = prog.starts.next(data, i, length);
+            base += next - i;
+            i = next;
+            if (i >= length)
+                break;
+        }
+
+        step(data[i++]);
+        if (clist.empty() && matchStart != -1)
+            resolve(string());
+    }
+}
+
+
+/* Signal the end of the stream, and report the matches that could not be
+ * reported before it was known that no more bytes would follow.
+ */
+void StreamMatcher::finish() {
+    while (!clist.empty() || matchStart != -1) {
+        // At the end of the stream, only the MATCH threads can do anything.
+        for (const NFAThread &t : clist) {
+            if (prog.insts[t.pc].opcode == NFAInst::MATCH) {
+                matchStart = t.start;
+                matchEnd = (ptrdiff_t) pending.size();
+                break;
+            }
+        }
+        clist.clear();
+        if (matchStart == -1)
+            break;
+
+        resolve(report());
+    }
+
+    base += pending.size();
+    pending.clear();
+}
+
+
+/* Run the NFA over the next byte of the stream, c, as one step of nfaFind()
+ * does:  a new thread starts at the byte unless a match has been found, and
+ * a MATCH thread cuts off all of the threads of lower priority.
+ */
+void StreamMatcher::step(char c) {
+    ptrdiff_t i = (ptrdiff_t) pending.size();
+    if (matchStart == -1)
+        addThread(prog, clist, onList, stack, generation, 0, i);
+
+    for (const NFAThread &t : clist) {
+        const NFAInst &inst = prog.insts[t.pc];
+        if (inst.opcode == NFAInst::MATCH) {
+            matchStart = t.start;
+            matchEnd = i;
+            break;
+        }
+
+        if (inst.op->matchChar(c))
+            addThread(prog, nlist, onList, stack, generation + 1, t.pc + 1,
+                      t.start);
+    }
+
+    clist.swap(nlist);
+    nlist.clear();
+    pending.push_back(c);
+    generation++;
+    trim();
+}
+
+
+/* Report each match that is complete, and search the bytes after it again,
+ * followed by the bytes in replay, which have not been searched yet.
+ */
+void StreamMatcher::resolve(string replay) {
+    size_t next = 0;
+    while (true) {
+        if (clist.empty() && matchStart != -1) {
+            replay = report() + replay.substr(next);
+            next = 0;
+        }
+        if (next >= replay.size())
+            break;
+        step(replay[next++]);
+    }
+}
+
+
+/* Pass the match that was found to the callback, and forget the match and
+ * the bytes kept for it.  Returns the bytes after the match, from the index
+ * where a MatchIterator would search next, since they must be searched
+ * again.
+ */
+string StreamMatcher::report() {
+    StreamMatch match = {base + matchStart, base + matchEnd,
+                         string(pending.begin() + matchStart,
+                                pending.begin() + matchEnd)};
+    ptrdiff_t resume = (matchEnd > matchStart) ? matchEnd : matchEnd + 1;
+    string rest;
+    if (resume < (ptrdiff_t) pending.size())
+        rest.assign(pending.begin() + resume, pending.end());
+
+    base += resume;
+    pending.clear();
+    matchStart = matchEnd = -1;
+
+    callback(match);
+    return rest;
+}
+
+
+/* Drop the kept bytes that come before every match still being tried,
+ * after every byte, so that only the candidate match is kept.  Each byte is
+ * dropped from the front of the deque once, without moving the others.
+ */
+void StreamMatcher::trim() {
+    if (clist.empty() && matchStart == -1) {
+        base += pending.size();
+        pending.clear();
+        return;
+    }
+
+    // Threads that started earlier come first.
+    ptrdiff_t size = (ptrdiff_t) pending.size();
+    ptrdiff_t live = clist.empty() ? size : clist.front().start;
+    if (matchStart != -1 && matchStart < live)
+        live = matchStart;
+    if (live == 0)
+        return;
+
+    pending.erase(pending.begin(), pending.begin() + live);
+    base += live;
+    for (NFAThread &t : clist)
+        t.start -= live;
+    if (matchStart != -1) {
+        matchStart -= live;
+        matchEnd -= live;
+    }
+}
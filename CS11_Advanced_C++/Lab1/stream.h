@@ -0,0 +1,81 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "nfa.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+
+/* A match found in a stream:  its absolute offsets in the stream, with the
+ * start inclusive and the end exclusive, and the text it matched.
+ */
+struct StreamMatch {
+    uint64_t start;
+    uint64_t end;
+    string text;
+};
+
+
+/* Finds the matches of a regex in a stream of bytes that arrives in chunks,
+ * without the whole stream ever being in memory at once.  The matches are
+ * the same non-overlapping matches that a MatchIterator would report for the
+ * whole stream as one string, and each is passed to the callback as soon as
+ * it is known to be the leftmost-longest match.  A match may straddle any
+ * number of chunks.
+ *
+ * The NFA threads are carried from one chunk to the next.  The only bytes
+ * kept are those from the start of the earliest match still being tried, so
+ * that its text can be reported, and so that the bytes after a match can be
+ * searched again once the match is reported.  The bytes before it are
+ * dropped as soon as the threads that needed them die, so the bytes kept are
+ * exactly that candidate match; while no match is being tried, nothing is
+ * kept, and the matcher skips ahead to bytes that can begin one.
+ *
+ * The matcher runs the regex as an NFA, so it only supports regexes that
+ * do not need the backtracking engine.  The regex's operators must outlive
+ * the matcher.
+ */
+class StreamMatcher {
+public:
+    typedef function<void(const StreamMatch &)> Callback;
+
+    StreamMatcher(const vector<RegexOperator *> &regex, Callback callback);
+
+    static bool supports(const vector<RegexOperator *> &regex);
+
+    void feed(const char *data, size_t length);
+    void finish();
+
+    uint64_t offset() const;
+    size_t bufferedBytes() const;
+
+private:
+    NFAProgram prog;
+    Callback callback;
+
+    // The running NFA threads, in priority order, with their start indexes
+    // relative to base.  onList, stack and generation are as for
+    // addThread().
+    vector<NFAThread> clist, nlist;
+    vector<ptrdiff_t> onList;
+    vector<int> stack;
+    ptrdiff_t generation;
+
+    // The bytes kept from the stream, and the stream offset of the first.
+    // Bytes are added at the back and dropped from the front, so a deque
+    // never moves the bytes that are kept.
+    deque<char> pending;
+    uint64_t base;
+
+    // The best match found so far, relative to base, or -1 if none.
+    ptrdiff_t matchStart, matchEnd;
+
+    void step(char c);
+    void resolve(string replay);
+    string report();
+    void trim();
+};
+
+#endif // STREAM_H
@@ -1,9 +1,22 @@
 #include "testbase.h"
 #include "engine.h"
+#include "compiled.h"
+#include "dfa.h"
+#include "regexcache.h"
+#include "regexset.h"
+#include "staticregex.h"
+#include "stream.h"
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <list>
+#include <sstream>
+#include <thread>
+
+#include <sys/mman.h>
 
 
 using namespace std;
@@ -17,434 +30,2046 @@ using namespace std;
 
 
 /*! Test simple character-match regex operations. */
-void test_simple_regex(TestContext &ctx) {
+void test_simple_regex(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("abc");
     Range r;
 
     ctx.DESC("Simple regex with find()");
 
-    r = find(regex, "abc");
+    r = find(regex, "abc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "abcd");
+    r = find(regex, "abcd", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "dabc");
+    r = find(regex, "dabc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dabcd");
+    r = find(regex, "dabcd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Simple regex with match()");
 
-    ctx.CHECK(match(regex, "abc"));
+    ctx.CHECK(match(regex, "abc", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "abcd"));
-    ctx.CHECK(!match(regex, "dabc"));
-    ctx.CHECK(!match(regex, "dabcd"));
+    ctx.CHECK(!match(regex, "abcd", engine));
+    ctx.CHECK(!match(regex, "dabc", engine));
+    ctx.CHECK(!match(regex, "dabcd", engine));
     
     ctx.result();
-
-    clearRegex(regex);
 }
 
 
 /*! Test wildcard-match operations. */
-void test_simple_wildcards(TestContext &ctx) {
+void test_simple_wildcards(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("a.c");
     Range r;
 
     ctx.DESC("Simple wildcard regex with find()");
 
-    r = find(regex, "abc");
+    r = find(regex, "abc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "adc");
+    r = find(regex, "adc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "a!c");
+    r = find(regex, "a!c", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
     // Should find the first occurrence.
-    r = find(regex, "aacc");
+    r = find(regex, "aacc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "daqc");
+    r = find(regex, "daqc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dazcd");
+    r = find(regex, "dazcd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Simple wildcard regex with match()");
 
-    ctx.CHECK(match(regex, "abc"));
+    ctx.CHECK(match(regex, "abc", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "abcd"));
-    ctx.CHECK(!match(regex, "dabc"));
-    ctx.CHECK(!match(regex, "dabcd"));
+    ctx.CHECK(!match(regex, "abcd", engine));
+    ctx.CHECK(!match(regex, "dabc", engine));
+    ctx.CHECK(!match(regex, "dabcd", engine));
     
     ctx.result();
-
-    clearRegex(regex);
 }
 
 
 /*! Test character classes. */
-void test_char_classes(TestContext &ctx) {
+void test_char_classes(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("a[aegi]c");
     Range r;
 
     ctx.DESC("Simple character-class regex with find()");
 
-    r = find(regex, "aac");
+    r = find(regex, "aac", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "adc");
+    r = find(regex, "adc", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "aic");
+    r = find(regex, "aic", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "aaic");
+    r = find(regex, "aaic", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dagc");
+    r = find(regex, "dagc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "daecd");
+    r = find(regex, "daecd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Simple character-class regex with match()");
 
-    ctx.CHECK(match(regex, "aac"));
-    ctx.CHECK(match(regex, "agc"));
+    ctx.CHECK(match(regex, "aac", engine));
+    ctx.CHECK(match(regex, "agc", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "aaic"));
-    ctx.CHECK(!match(regex, "dagc"));
-    ctx.CHECK(!match(regex, "daacd"));
+    ctx.CHECK(!match(regex, "aaic", engine));
+    ctx.CHECK(!match(regex, "dagc", engine));
+    ctx.CHECK(!match(regex, "daacd", engine));
 
     ctx.result();
-
-    // clearRegex(regex);
 }
 
 
 /*! Test inverted character classes. */
-void test_inv_char_classes(TestContext &ctx) {
+void test_inv_char_classes(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("a[^aegi]c");
     Range r;
 
     ctx.DESC("Inverted character-class regex with find()");
 
-    r = find(regex, "abc");
+    r = find(regex, "abc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "agc");
+    r = find(regex, "agc", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "acc");
+    r = find(regex, "acc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "aabc");
+    r = find(regex, "aabc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dafc");
+    r = find(regex, "dafc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "damcd");
+    r = find(regex, "damcd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Inverted character-class regex with match()");
 
-    ctx.CHECK(match(regex, "abc"));
-    ctx.CHECK(match(regex, "afc"));
+    ctx.CHECK(match(regex, "abc", engine));
+    ctx.CHECK(match(regex, "afc", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "aabc"));
-    ctx.CHECK(!match(regex, "dafc"));
-    ctx.CHECK(!match(regex, "damcd"));
+    ctx.CHECK(!match(regex, "aabc", engine));
+    ctx.CHECK(!match(regex, "dafc", engine));
+    ctx.CHECK(!match(regex, "damcd", engine));
 
     ctx.result();
+}
+
+
+/*! Test character classes with ranges of characters. */
+void test_char_ranges(TestContext &ctx, RegexEngine engine) {
+    vector<RegexOperator *> regex = parseRegex("[a-cx-z0-9_]+[^a-z-]");
+    Range r;
+
+    ctx.DESC("Character-class ranges with find()");
+
+    r = find(regex, "abc9_Q", engine);
+    ctx.CHECK(r.start == 0 && r.end == 6);
 
-    // clearRegex(regex);
+    r = find(regex, "--yz-", engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(regex, "mmmz0!", engine);
+    ctx.CHECK(r.start == 3 && r.end == 6);
+
+    r = find(regex, "dz[", engine);
+    ctx.CHECK(r.start == 1 && r.end == 3);
+
+    ctx.CHECK(match(regex, "x.", engine));
+    ctx.CHECK(!match(regex, "w.", engine));
+    ctx.CHECK(!match(regex, "[.", engine));
+
+    ctx.result();
 }
 
 
 /*! Test the * repeat-modifier. */
-void test_kleene_star(TestContext &ctx) {
+void test_kleene_star(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("a.*c");
     Range r;
 
     ctx.DESC("Kleene star * with find()");
 
-    r = find(regex, "ac");
+    r = find(regex, "ac", engine);
     ctx.CHECK(r.start == 0 && r.end == 2);
 
-    r = find(regex, "adc");
+    r = find(regex, "adc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "aasdfasdfasdfc");
+    r = find(regex, "aasdfasdfasdfc", engine);
     ctx.CHECK(r.start == 0 && r.end == 14);
 
-    r = find(regex, "aasdfasdfasdfcghiqmlbarzqtdvy");
+    r = find(regex, "aasdfasdfasdfcghiqmlbarzqtdvy", engine);
     ctx.CHECK(r.start == 0 && r.end == 14);
 
-    r = find(regex, "ab");
+    r = find(regex, "ab", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
     // Should consume all "c" characters.  The .* should consume "bc".
-    r = find(regex, "abcc");
+    r = find(regex, "abcc", engine);
     ctx.CHECK(r.start == 0 && r.end == 4);
 
-    r = find(regex, "dac");
+    r = find(regex, "dac", engine);
     ctx.CHECK(r.start == 1 && r.end == 3);
 
-    r = find(regex, "dafc");
+    r = find(regex, "dafc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dacd");
+    r = find(regex, "dacd", engine);
     ctx.CHECK(r.start == 1 && r.end == 3);
 
-    r = find(regex, "damcd");
+    r = find(regex, "damcd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Kleene star * with match()");
 
-    ctx.CHECK(match(regex, "abc"));
-    ctx.CHECK(match(regex, "afc"));
-    ctx.CHECK(match(regex, "ac"));
+    ctx.CHECK(match(regex, "abc", engine));
+    ctx.CHECK(match(regex, "afc", engine));
+    ctx.CHECK(match(regex, "ac", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "dac"));
-    ctx.CHECK(!match(regex, "dafc"));
-    ctx.CHECK(!match(regex, "damcd"));
+    ctx.CHECK(!match(regex, "dac", engine));
+    ctx.CHECK(!match(regex, "dafc", engine));
+    ctx.CHECK(!match(regex, "damcd", engine));
 
     ctx.result();
-
-    // clearRegex(regex);
 }
 
 
 /*! Test the + repeat-modifier. */
-void test_plus(TestContext &ctx) {
+void test_plus(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("a.+c");
     Range r;
 
     ctx.DESC("Plus + with find()");
 
     // Need at least one character separating a and c
-    r = find(regex, "ac");
+    r = find(regex, "ac", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "adc");
+    r = find(regex, "adc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "aasdfasdfasdfc");
+    r = find(regex, "aasdfasdfasdfc", engine);
     ctx.CHECK(r.start == 0 && r.end == 14);
 
-    r = find(regex, "aasdfasdfasdfcghiqmlbarzqtdvy");
+    r = find(regex, "aasdfasdfasdfcghiqmlbarzqtdvy", engine);
     ctx.CHECK(r.start == 0 && r.end == 14);
 
     // Should consume all "c" characters.  The .* should consume middle "c".
-    r = find(regex, "acc");
+    r = find(regex, "acc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
     // Should consume all "c" characters.  The .* should consume "bc".
-    r = find(regex, "abcc");
+    r = find(regex, "abcc", engine);
     ctx.CHECK(r.start == 0 && r.end == 4);
 
-    r = find(regex, "dac");
+    r = find(regex, "dac", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "dafc");
+    r = find(regex, "dafc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dacd");
+    r = find(regex, "dacd", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "damcd");
+    r = find(regex, "damcd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Plus + with match()");
 
-    ctx.CHECK(match(regex, "abc"));
-    ctx.CHECK(match(regex, "afc"));
-    ctx.CHECK(!match(regex, "ac"));
+    ctx.CHECK(match(regex, "abc", engine));
+    ctx.CHECK(match(regex, "afc", engine));
+    ctx.CHECK(!match(regex, "ac", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "daasdfasdfasdfc"));
-    ctx.CHECK(!match(regex, "dafc"));
-    ctx.CHECK(!match(regex, "damcd"));
+    ctx.CHECK(!match(regex, "daasdfasdfasdfc", engine));
+    ctx.CHECK(!match(regex, "dafc", engine));
+    ctx.CHECK(!match(regex, "damcd", engine));
 
     ctx.result();
-
-    // clearRegex(regex);
 }
 
 
 /*! Test the ? optional-modifier. */
-void test_optional(TestContext &ctx) {
+void test_optional(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("ab?c");
     Range r;
 
     ctx.DESC("Optional operator ? with find()");
 
-    r = find(regex, "ac");
+    r = find(regex, "ac", engine);
     ctx.CHECK(r.start == 0 && r.end == 2);
 
-    r = find(regex, "abc");
+    r = find(regex, "abc", engine);
     ctx.CHECK(r.start == 0 && r.end == 3);
 
-    r = find(regex, "adc");
+    r = find(regex, "adc", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "dac");
+    r = find(regex, "dac", engine);
     ctx.CHECK(r.start == 1 && r.end == 3);
 
-    r = find(regex, "dabc");
+    r = find(regex, "dabc", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
 
-    r = find(regex, "dadc");
+    r = find(regex, "dadc", engine);
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "dacd");
+    r = find(regex, "dacd", engine);
     ctx.CHECK(r.start == 1 && r.end == 3);
 
-    r = find(regex, "dabcd");
+    r = find(regex, "dabcd", engine);
     ctx.CHECK(r.start == 1 && r.end == 4);
     
     ctx.result();
 
     ctx.DESC("Optional operator ? with match()");
 
-    ctx.CHECK(match(regex, "ac"));
-    ctx.CHECK(match(regex, "abc"));
-    ctx.CHECK(!match(regex, "afc"));
+    ctx.CHECK(match(regex, "ac", engine));
+    ctx.CHECK(match(regex, "abc", engine));
+    ctx.CHECK(!match(regex, "afc", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
     
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "dac"));
-    ctx.CHECK(!match(regex, "dabc"));
-    ctx.CHECK(!match(regex, "dacd"));
-    ctx.CHECK(!match(regex, "dabcd"));
+    ctx.CHECK(!match(regex, "dac", engine));
+    ctx.CHECK(!match(regex, "dabc", engine));
+    ctx.CHECK(!match(regex, "dacd", engine));
+    ctx.CHECK(!match(regex, "dabcd", engine));
+
+    ctx.result();
+}
+
+
+/*! Test the {n}, {n,} and {n,m} counted repeat-modifiers. */
+void test_counted_repeat(TestContext &ctx, RegexEngine engine) {
+    vector<RegexOperator *> regex = parseRegex("ab{2}c");
+    Range r;
+
+    ctx.DESC("Counted repeat-modifier {n,m} with find()");
+
+    ctx.CHECK(regex[1]->getMinRepeat() == 2 && regex[1]->getMaxRepeat() == 2);
+
+    r = find(regex, "xabbc", engine);
+    ctx.CHECK(r.start == 1 && r.end == 5);
+
+    r = find(regex, "abc", engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(regex, "abbbc", engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    vector<RegexOperator *> atLeast = parseRegex("x[0-9]{2,}");
+    r = find(atLeast, "x1x123x", engine);
+    ctx.CHECK(r.start == 2 && r.end == 6);
+
+    vector<RegexOperator *> between = parseRegex("a{1,3}");
+    r = find(between, "baaaaa", engine);
+    ctx.CHECK(r.start == 1 && r.end == 4);
+
+    // A long run is matched without a step for each repetition.
+    vector<RegexOperator *> digits = parseRegex("[0-9]{1,4000}");
+    r = find(digits, "x" + string(5000, '7'), engine);
+    ctx.CHECK(r.start == 1 && r.end == 4001);
+
+    // Anything that is not a valid count matches literally.
+    vector<RegexOperator *> literal = parseRegex("a{,2}b{3,1}c{x");
+    ctx.CHECK(literal.size() == 14);
+    r = find(literal, "-a{,2}b{3,1}c{x", engine);
+    ctx.CHECK(r.start == 1 && r.end == 15);
 
     ctx.result();
 
-    // clearRegex(regex);
+    ctx.DESC("Counted repeat-modifier {n,m} with match()");
+
+    ctx.CHECK(match(between, "aaa", engine));
+    ctx.CHECK(!match(between, "aaaa", engine));
+    ctx.CHECK(match(atLeast, "x" + string(100, '0'), engine));
+    ctx.CHECK(!match(atLeast, "x0", engine));
+
+    ctx.result();
+
+    for (vector<RegexOperator *> *ops :
+             {&regex, &atLeast, &between, &digits, &literal}) {
+        for (RegexOperator *op : *ops)
+            delete op;
+    }
+}
+
+
+/*! Test the possessive repeat-modifiers *+, ++, ?+ and {n,m}+. */
+void test_possessive(TestContext &ctx, RegexEngine engine) {
+    vector<RegexOperator *> fields = parseRegex("[^,]*+,");
+    vector<RegexOperator *> star = parseRegex("a*+a");
+    vector<RegexOperator *> optional = parseRegex("a?+a");
+    vector<RegexOperator *> counted = parseRegex("x{1,3}+x");
+    Range r;
+
+    ctx.DESC("Possessive repeat-modifiers with find()");
+
+    r = find(fields, "abc,def", engine);
+    ctx.CHECK(r.start == 0 && r.end == 4);
+
+    r = find(fields, string(200, 'a'), engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    // A possessive operator does not give back what the next one needs.
+    r = find(star, "aaa", engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(optional, "a", engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(optional, "baa", engine);
+    ctx.CHECK(r.start == 1 && r.end == 3);
+
+    r = find(counted, "xxxx", engine);
+    ctx.CHECK(r.start == 0 && r.end == 4);
+
+    r = find(counted, "xxx", engine);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    ctx.result();
+
+    ctx.DESC("Possessive repeat-modifiers with match()");
+
+    ctx.CHECK(match(fields, "abc,", engine));
+    ctx.CHECK(!match(star, "aaaa", engine));
+    ctx.CHECK(match(optional, "aa", engine));
+    ctx.CHECK(!match(counted, "xxx", engine));
+
+    ctx.result();
+
+    for (vector<RegexOperator *> *ops : {&fields, &star, &optional, &counted}) {
+        for (RegexOperator *op : *ops)
+            delete op;
+    }
 }
 
 
 /*! Test more complex regular expressions. */
-void test_complex_regex(TestContext &ctx) {
+void test_complex_regex(TestContext &ctx, RegexEngine engine) {
     vector<RegexOperator *> regex = parseRegex("ab+c?d*[ef]+g[^ghi]*j.+k");
     Range r;
 
     ctx.DESC("Complex regular expression with find()");
 
-    r = find(regex, "aegjkk");  // Missing "b"
+    r = find(regex, "aegjkk", engine);  // Missing "b"
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "abejkk");  // Missing "g"
+    r = find(regex, "abejkk", engine);  // Missing "g"
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "abegijkk");  // Shouldn't have the "i"
+    r = find(regex, "abegijkk", engine);  // Shouldn't have the "i"
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "abegkk");  // Missing "j"
+    r = find(regex, "abegkk", engine);  // Missing "j"
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "abegjk");  // Missing letter between "j" and "k"
+    r = find(regex, "abegjk", engine);  // Missing letter between "j" and "k"
     ctx.CHECK(r.start == -1 && r.end == -1);
 
-    r = find(regex, "abegjkk");
+    r = find(regex, "abegjkk", engine);
     ctx.CHECK(r.start == 0 && r.end == 7);
 
-    r = find(regex, "abfgjkk");
+    r = find(regex, "abfgjkk", engine);
     ctx.CHECK(r.start == 0 && r.end == 7);
 
-    r = find(regex, "abegjjk");
+    r = find(regex, "abegjjk", engine);
     ctx.CHECK(r.start == 0 && r.end == 7);
 
-    r = find(regex, "aaabegjkk");
+    r = find(regex, "aaabegjkk", engine);
     ctx.CHECK(r.start == 2 && r.end == 9);
 
-    r = find(regex, "abegjkkmmmm");
+    r = find(regex, "abegjkkmmmm", engine);
     ctx.CHECK(r.start == 0 && r.end == 7);
 
-    r = find(regex, "aaabegjkkmmmm");
+    r = find(regex, "aaabegjkkmmmm", engine);
     ctx.CHECK(r.start == 2 && r.end == 9);
 
-    r = find(regex, "abbbbbbbbegjkk");
+    r = find(regex, "abbbbbbbbegjkk", engine);
     ctx.CHECK(r.start == 0 && r.end == 14);
 
-    r = find(regex, "aaabbbbbbbbegjkk");
+    r = find(regex, "aaabbbbbbbbegjkk", engine);
     ctx.CHECK(r.start == 2 && r.end == 16);
 
-    r = find(regex, "abegjkk");
+    r = find(regex, "abegjkk", engine);
     ctx.CHECK(r.start == 0 && r.end == 7);
 
     ctx.result();
 
     ctx.DESC("Complex regular expression with match()");
 
-    ctx.CHECK(match(regex, "abegjkk"));
-    ctx.CHECK(match(regex, "abbbbbbbbegjkk"));
-    ctx.CHECK(!match(regex, "abegijkk"));
+    ctx.CHECK(match(regex, "abegjkk", engine));
+    ctx.CHECK(match(regex, "abbbbbbbbegjkk", engine));
+    ctx.CHECK(!match(regex, "abegijkk", engine));
 
-    ctx.CHECK(!match(regex, ""));
-    ctx.CHECK(!match(regex, "a"));
+    ctx.CHECK(!match(regex, "", engine));
+    ctx.CHECK(!match(regex, "a", engine));
 
     // These will successfully generate a "find", but it isn't a "match"
     // because it doesn't use the entire string.
-    ctx.CHECK(!match(regex, "aaabegjkk"));
-    ctx.CHECK(!match(regex, "aaabegjkkmmmm"));
-    ctx.CHECK(!match(regex, "aaabbbbbbbbegjkk"));
+    ctx.CHECK(!match(regex, "aaabegjkk", engine));
+    ctx.CHECK(!match(regex, "aaabegjkkmmmm", engine));
+    ctx.CHECK(!match(regex, "aaabbbbbbbbegjkk", engine));
+
+    ctx.result();
+}
+
+
+/*! Test iterating over all of the matches in a string. */
+void test_find_all(TestContext &ctx, RegexEngine engine) {
+    CompiledRegex plus("a+");
+    CompiledRegex star("b*");
+    CompiledRegex lit("x[0-9]y");
+    MatchContext mctx;
+    vector<Range> found;
+    auto record = [&found](const Range &r) { found.push_back(r); };
+
+    ctx.DESC("Finding all matches");
+
+    found.clear();
+    ctx.CHECK(plus.findAll("aa b aaa", mctx, record, engine) == 2);
+    ctx.CHECK(found.size() == 2);
+    ctx.CHECK(found[0].start == 0 && found[0].end == 2);
+    ctx.CHECK(found[1].start == 5 && found[1].end == 8);
+
+    // Empty matches must not stop the iteration.
+    found.clear();
+    ctx.CHECK(star.findAll("abba", mctx, record, engine) == 3);
+    ctx.CHECK(found.size() == 3);
+    ctx.CHECK(found[0].start == 0 && found[0].end == 0);
+    ctx.CHECK(found[1].start == 1 && found[1].end == 3);
+    ctx.CHECK(found[2].start == 3 && found[2].end == 3);
+
+    string s = "x1y x2 x3yx4y";
+    MatchIterator iter(lit, s, mctx, engine);
+    Range r;
+    ctx.CHECK(iter.next(r) && r.start == 0 && r.end == 3);
+    ctx.CHECK(iter.next(r) && r.start == 7 && r.end == 10);
+    ctx.CHECK(iter.next(r) && r.start == 10 && r.end == 13);
+    ctx.CHECK(!iter.next(r));
+    ctx.CHECK(!iter.next(r));
+
+    ctx.CHECK(plus.countMatches("a", mctx, engine) == 1);
+    ctx.CHECK(plus.countMatches("", mctx, engine) == 0);
+    ctx.CHECK(plus.countMatches("bab aba", mctx, engine) == 3);
+    ctx.CHECK(lit.countMatches("x1yx2yx3", mctx, engine) == 2);
+
+    ctx.result();
+}
+
+
+/*! Test the scanner that skips to indexes where a match can begin, for
+ *  each of the ways it can search:  memchr(), SIMD comparisons and bitmap
+ *  lookups.  The wanted character is moved across block boundaries.
+ */
+void test_first_char_scan(TestContext &ctx) {
+    CharSet one, few, many;
+    one.add('x');
+    few.addAll("xyz");
+    many.addRange('p', 'z');
+    const ByteScanner scanners[] = {
+        ByteScanner(one), ByteScanner(few), ByteScanner(many)
+    };
+
+    ctx.DESC("ByteScanner finds the next wanted character");
+
+    for (const ByteScanner &scanner : scanners) {
+        for (size_t pos = 0; pos < 100; pos++) {
+            string s(100, 'a');
+            s[pos] = 'x';
+            ctx.CHECK(scanner.next(s.data(), 0, s.length()) == pos);
+            ctx.CHECK(scanner.next(s.data(), pos + 1, s.length()) == 100);
+            ctx.CHECK(scanner.next(s.data(), 0, pos) == pos);
+        }
+    }
+
+    ctx.result();
+
+    ctx.DESC("find() skips indexes where no match can begin");
+
+    vector<RegexOperator *> regex = parseRegex("q?r*z");
+    for (RegexEngine engine : { ENGINE_BACKTRACK, ENGINE_NFA }) {
+        string s = string(70, 'a') + "rrz" + string(40, 'a');
+        Range r = find(regex, s, engine);
+        ctx.CHECK(r.start == 70 && r.end == 73);
+
+        r = find(regex, string(70, 'a') + "q" + string(40, 'a') + "z", engine);
+        ctx.CHECK(r.start == 111 && r.end == 112);
+
+        r = find(regex, string(200, 'q'), engine);
+        ctx.CHECK(r.start == -1 && r.end == -1);
+    }
+
+    ctx.CHECK(firstCharScanner(parseRegex("a?b*")).scansAll());
+    ctx.CHECK(!firstCharScanner(parseRegex("a?b*c")).scansAll());
+    ctx.CHECK(firstCharScanner(parseRegex(".c")).scansAll());
+
+    ctx.result();
+}
+
+
+/*! Test finding the literal that every match must contain, and the
+ *  Boyer-Moore-Horspool search for it.
+ */
+void test_required_literal(TestContext &ctx) {
+    ctx.DESC("Required literal extraction");
+
+    ctx.CHECK(requiredLiteral(parseRegex("ERROR.*timeout[0-9]+")) ==
+              "timeout");
+    ctx.CHECK(requiredLiteral(parseRegex("ab+c")) == "ab");
+    ctx.CHECK(requiredLiteral(parseRegex("x[y]+zz?w")) == "xy");
+    ctx.CHECK(requiredLiteral(parseRegex("x[y]+zzz?w")) == "yzz");
+    ctx.CHECK(requiredLiteral(parseRegex("a?b*.")) == "");
+    ctx.CHECK(requiredLiteral(parseRegex("q.a\\.bcd")) == "a.bcd");
+
+    ctx.result();
+
+    ctx.DESC("Boyer-Moore-Horspool literal search");
+
+    LiteralSearcher searcher("timeout");
+    string s = "connection timed out; timeout=30; timeout";
+    ctx.CHECK(searcher.find(s.data(), 0, s.length()) == 22);
+    ctx.CHECK(searcher.find(s.data(), 23, s.length()) == 34);
+    ctx.CHECK(searcher.find(s.data(), 35, s.length()) == s.length());
+    ctx.CHECK(searcher.find(s.data(), 0, 28) == 28);
+    ctx.CHECK(!searcher.occursIn("timeou"));
+    ctx.CHECK(LiteralSearcher("").occursIn("abc"));
+    ctx.CHECK(LiteralSearcher("=").find(s.data(), 0, s.length()) == 29);
+
+    vector<RegexOperator *> regex = parseRegex("ERROR.*timeout[0-9]+");
+    for (RegexEngine engine : { ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA }) {
+        Range r = find(regex, "xx ERROR: read timeout42 ms", engine);
+        ctx.CHECK(r.start == 3 && r.end == 24);
+        r = find(regex, "xx ERROR: read timed out 42 ms", engine);
+        ctx.CHECK(r.start == -1 && r.end == -1);
+    }
+
+    ctx.result();
+}
+
+
+/*! Test the Shift-And engine on a regex with the largest number of
+ *  operators it supports, and one operator too many.
+ */
+void test_shift_and_limits(TestContext &ctx) {
+    ctx.DESC("Shift-And engine with 64 and 65 operators");
+
+    string expr = "x?" + string(62, 'a') + "b*";
+    vector<RegexOperator *> regex = parseRegex(expr);
+    ctx.CHECK(ShiftAndMatcher::supports(regex));
+
+    string s = "xx" + string(62, 'a') + "bbc";
+    Range r = find(regex, s, ENGINE_SHIFTAND);
+    ctx.CHECK(r.start == 1 && r.end == 66);
+    ctx.CHECK(match(regex, s.substr(1, 65), ENGINE_SHIFTAND));
+    ctx.CHECK(!match(regex, s.substr(1, 60), ENGINE_SHIFTAND));
+
+    vector<RegexOperator *> bigger = parseRegex(expr + "c");
+    ctx.CHECK(!ShiftAndMatcher::supports(bigger));
+    r = find(bigger, s, ENGINE_SHIFTAND);
+    ctx.CHECK(r.start == 1 && r.end == 67);
+
+    ctx.result();
+}
+
+
+/*! Test regexes whose counted repeats are too large to unroll into an NFA,
+ *  which are left to the backtracking engine.
+ */
+void test_nfa_limits(TestContext &ctx) {
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+
+    ctx.DESC("NFA program size limit");
+
+    // A short pattern that would unroll into 100 million instructions.
+    string huge;
+    for (int i = 0; i < 500; i++)
+        huge += ".{100000}";
+    vector<RegexOperator *> regex = parseRegex(huge);
+    ctx.CHECK(!NFAProgram::supports(regex));
+    NFAProgram prog(regex);
+    ctx.CHECK(!prog.complete() && prog.size() == 1);
+    ctx.CHECK(nfaFind(prog, string(1000, 'a')).start == -1);
+
+    CompiledRegex compiled(huge);
+    ctx.CHECK(compiled.memoryUsage() < (1 << 20));
+    ctx.CHECK(!compiled.supportsSinglePass());
+    for (RegexEngine engine : engines)
+        ctx.CHECK(compiled.find(string(1000, 'a'), engine).start == -1);
+
+    // Just past the limit, every engine still finds the match, with the
+    // backtracking engine.
+    string wideExpr = "x";
+    for (int i = 0; i < 11; i++)
+        wideExpr += "[ab]{100000}";
+    wideExpr += "y";
+    vector<RegexOperator *> wide = parseRegex(wideExpr);
+    ctx.CHECK(!NFAProgram::supports(wide));
+    string s = "zx" + string(1100000, 'a') + "y";
+    CompiledRegex compiledWide(wideExpr);
+    for (RegexEngine engine : engines) {
+        Range r = find(wide, s, engine);
+        ctx.CHECK(r.start == 1 && r.end == 1100003);
+        r = compiledWide.find(s, engine);
+        ctx.CHECK(r.start == 1 && r.end == 1100003);
+    }
+    ctx.CHECK(!StreamMatcher::supports(wide));
+
+    RegexSet set({wideExpr, "z"});
+    ctx.CHECK(set.matches(s) == vector<int>({0, 1}));
+
+    for (RegexOperator *op : regex)
+        delete op;
+    for (RegexOperator *op : wide)
+        delete op;
+    ctx.result();
+}
+
+
+/*! Test a regex that takes the backtracking engine exponential time.  Only
+ *  the NFA engine is given a long enough string to show the difference.
+ */
+void test_nfa_pathological(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("a*a*a*a*a*a*b");
+    string s(2000, 'a');
+    Range r;
+
+    ctx.DESC("Pathological regex with NFA find()");
+
+    r = find(regex, s, ENGINE_NFA);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(regex, s + "b", ENGINE_NFA);
+    ctx.CHECK(r.start == 0 && r.end == 2001);
+
+    r = find(regex, "c" + s + "b", ENGINE_NFA);
+    ctx.CHECK(r.start == 1 && r.end == 2002);
+
+    ctx.CHECK(match(regex, s + "b", ENGINE_NFA));
+    ctx.CHECK(!match(regex, s + "bb", ENGINE_NFA));
+
+    // A long chain of optional operators is a long chain of SPLITs, which
+    // must not be followed by recursion.
+    vector<RegexOperator *> optional;
+    for (int i = 0; i < 200000; i++) {
+        optional.push_back(new MatchChar('a'));
+        optional.back()->setMinRepeat(0);
+    }
+    optional.push_back(new MatchChar('b'));
+    r = find(optional, "xaab", ENGINE_NFA);
+    ctx.CHECK(r.start == 1 && r.end == 4);
+    ctx.CHECK(match(optional, "aab", ENGINE_NFA));
+
+    for (RegexOperator *op : regex)
+        delete op;
+    for (RegexOperator *op : optional)
+        delete op;
+    ctx.result();
+}
+
+
+/*! Test that a string too long for the backtracking engines to remember
+ *  the states they explore is searched by the NFA instead, so that an
+ *  exponential regex stays linear.
+ */
+void test_memo_overflow(TestContext &ctx) {
+    string expr;
+    for (int i = 0; i < 20; i++)
+        expr += "a?";
+    for (int i = 0; i < 20; i++)
+        expr += "[ab]";
+    expr += "[xy]";
+    vector<RegexOperator *> regex = parseRegex(expr);
+    CompiledRegex compiled(expr);
+    MatchContext mctx;
+    MatchLimits limits;
+    limits.maxSteps = 10000000;
+    Range r;
+
+    ctx.DESC("Backtracking past the size of the memo");
+
+    // Each start index would take the backtracker 2^19 steps without the
+    // memo, which cannot hold (length + 1) * 41 states.
+    string s;
+    for (int i = 0; i < 180000; i++)
+        s += string(19, 'a') + "c";
+    ctx.CHECK((s.length() + 1) * regex.size() > BACKTRACK_MEMO_MAX_STATES);
+    ctx.CHECK(find(regex, s, mctx, limits, r) == MATCH_NOT_FOUND);
+    ctx.CHECK(compiled.find(s, mctx, limits, r) == MATCH_NOT_FOUND);
+
+    s += string(20, 'a') + "x";
+    Range expected(s.length() - 21, s.length());
+    r = find(regex, s, mctx);
+    ctx.CHECK(r.start == expected.start && r.end == expected.end);
+    r = compiled.find(s, mctx);
+    ctx.CHECK(r.start == expected.start && r.end == expected.end);
+    r = backtrackFind(regex, s, mctx, ByteScanner());
+    ctx.CHECK(r.start == expected.start && r.end == expected.end);
+    deque<char> text(s.begin(), s.end());
+    r = compiled.find(text.begin(), text.end(), mctx);
+    ctx.CHECK(r.start == expected.start && r.end == expected.end);
+
+    for (RegexOperator *op : regex)
+        delete op;
+    ctx.result();
+}
+
+
+/*! Test compiling regexes to bytecode, and running the bytecode against
+ *  backtracking over the regex operators themselves.
+ */
+void test_bytecode(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("a.[xy][^z]b*[q]?");
+    BytecodeProgram prog(regex);
+    MatchContext mctx;
+
+    ctx.DESC("Bytecode programs");
+
+    ctx.CHECK(prog.size() == 6);
+    ctx.CHECK(prog.insts[0].opcode == BytecodeInst::CHAR &&
+              prog.insts[0].ch == 'a');
+    ctx.CHECK(prog.insts[1].opcode == BytecodeInst::ANY);
+    ctx.CHECK(prog.insts[2].opcode == BytecodeInst::CLASS &&
+              prog.insts[2].cls == 0);
+    ctx.CHECK(prog.insts[3].opcode == BytecodeInst::CLASS &&
+              prog.insts[3].cls == 1);
+    ctx.CHECK(prog.insts[4].minRepeat == 0 && prog.insts[4].maxRepeat == -1);
+    ctx.CHECK(prog.insts[5].opcode == BytecodeInst::CHAR &&
+              prog.insts[5].minRepeat == 0 && prog.insts[5].maxRepeat == 1);
+    ctx.CHECK(prog.classes.size() == 2);
+    ctx.CHECK(prog.classes[1].count() == 255);
+
+    // Compare against the operator backtracker over many strings.
+    const char *exprs[] = { "a.[xy][^z]b*[q]?", "x?a*[ab]+.b?", ".*a.*b" };
+    bool same = true;
+    srand(31);
+    for (const char *expr : exprs) {
+        vector<RegexOperator *> ops = parseRegex(expr);
+        BytecodeProgram code(ops);
+        ByteScanner starts = firstCharScanner(ops);
+        for (int i = 0; i < 1000; i++) {
+            string s;
+            int length = rand() % 12;
+            for (int j = 0; j < length; j++)
+                s += "abxyzq"[rand() % 6];
+            int from = length > 0 ? rand() % length : 0;
+
+            Range expected = backtrackFind(ops, s, mctx, starts, from);
+            Range r = bytecodeFind(code, s, mctx.backtrack, from);
+            if (r.start != expected.start || r.end != expected.end)
+                same = false;
+        }
+        for (RegexOperator *op : ops)
+            delete op;
+    }
+    ctx.CHECK(same);
+
+    for (RegexOperator *op : regex)
+        delete op;
+
+    ctx.result();
+}
+
+
+/*! Test regexes that took the backtracking engine exponential time before
+ *  it remembered the states it had already explored.
+ */
+void test_backtrack_memo(TestContext &ctx) {
+    const int n = 40;
+    string expr;
+    for (int i = 0; i < n; i++)
+        expr += "a?";
+    expr += string(n, 'a');
+    vector<RegexOperator *> optional = parseRegex(expr);
+    vector<RegexOperator *> stars = parseRegex("a*a*a*a*a*a*b");
+    MatchContext mctx;
+    Range r;
+
+    ctx.DESC("Backtracking on pathological regexes");
+
+    r = find(optional, string(n, 'a'), mctx);
+    ctx.CHECK(r.start == 0 && r.end == n);
+
+    r = find(optional, string(2 * n, 'a'), mctx);
+    ctx.CHECK(r.start == 0 && r.end == 2 * n);
+
+    r = find(optional, string(n - 1, 'a'), mctx);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(stars, string(500, 'a'), mctx);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = find(stars, "c" + string(500, 'a') + "b", mctx);
+    ctx.CHECK(r.start == 1 && r.end == 502);
+
+    // The states remembered for one string must not leak into the next.
+    r = findAtIndex(optional, string(n, 'a'), 0, mctx);
+    ctx.CHECK(r.start == 0 && r.end == n);
+
+    r = backtrackFind(optional, string(2 * n, 'a'), mctx, ByteScanner());
+    ctx.CHECK(r.start == 0 && r.end == 2 * n);
+
+    for (RegexOperator *op : optional)
+        delete op;
+    for (RegexOperator *op : stars)
+        delete op;
+
+    ctx.result();
+}
+
+
+/*! Test that backtracking keeps a count of repetitions for each operator,
+ *  rather than a range for each repetition, and only remembers the states
+ *  it has explored for a regex that can give back repetitions.
+ */
+void test_backtrack_counts(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("a.*;x");
+    MatchContext mctx;
+    Range r;
+
+    ctx.DESC("Backtracking state as repetition counts");
+
+    // Giving back the characters of a .* over a long line needs one choice
+    // point per operator, not one per character.
+    string line = "a" + string(1 << 20, 'b') + ";x;";
+    r = findAtIndex(regex, line, 0, mctx);
+    ctx.CHECK(r.start == 0 && r.end == (1 << 20) + 3);
+    ctx.CHECK(mctx.backtrack.frames.size() == regex.size());
+    ctx.CHECK(mctx.backtrack.frames.capacity() < 16);
+
+    // Since .* can give back repetitions, the explored states are
+    // remembered, one bit for each operator at each index:  O(ops * length).
+    size_t states = (line.length() + 1) * regex.size();
+    ctx.CHECK(mctx.backtrack.visited.size() * 64 >= states);
+    ctx.CHECK(mctx.backtrack.visited.size() * 64 < states + 64);
+
+    r = findAtIndex(regex, "a" + string(1000, ';'), 0, mctx);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    // A regex that never gives back a repetition, like [^;]*, which is made
+    // possessive, never reaches a state twice, and remembers none of them.
+    vector<RegexOperator *> disjoint = parseRegex("a[^;]*;x");
+    MatchContext fresh;
+    r = findAtIndex(disjoint, line, 0, fresh);
+    ctx.CHECK(r.start == 0 && r.end == (1 << 20) + 3);
+    r = backtrackFind(disjoint, line, fresh, ByteScanner());
+    ctx.CHECK(r.start == 0 && r.end == (1 << 20) + 3);
+    r = find(disjoint, line, fresh);
+    ctx.CHECK(r.start == 0 && r.end == (1 << 20) + 3);
+    ctx.CHECK(fresh.backtrack.visited.empty());
+
+    for (RegexOperator *op : regex)
+        delete op;
+    for (RegexOperator *op : disjoint)
+        delete op;
+
+    ctx.result();
+}
+
+
+/*! Test making repeated operators possessive where that cannot change the
+ *  matches, and running regexes where it can.
+ */
+void test_possessify(TestContext &ctx) {
+    vector<RegexOperator *> disjoint = parseRegex("a*b[0-9]?c+[^c]");
+    vector<RegexOperator *> overlapping = parseRegex("[ab]*b.?x");
+    vector<RegexOperator *> explicitly = parseRegex("a*+a");
+    MatchContext mctx;
+
+    ctx.DESC("Automatically possessive operators");
+
+    // Only the operators whose characters cannot come next are possessive.
+    ctx.CHECK(disjoint[0]->isPossessive());
+    ctx.CHECK(!disjoint[1]->isPossessive());
+    ctx.CHECK(disjoint[2]->isPossessive());
+    ctx.CHECK(disjoint[3]->isPossessive());
+    ctx.CHECK(!disjoint[4]->isPossessive());
+    ctx.CHECK(!overlapping[0]->isPossessive());
+    ctx.CHECK(!overlapping[2]->isPossessive());
+    ctx.CHECK(!needsBacktracking(disjoint));
+    ctx.CHECK(needsBacktracking(explicitly));
+
+    // An explicitly possessive regex gives the same result on every engine
+    // of a compiled regex and in a regex set.
+    CompiledRegex compiled("[a-z]*+[a-z0-9]");
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+    bool same = true;
+    for (RegexEngine engine : engines) {
+        Range r = compiled.find("abc1", mctx, engine);
+        if (r.start != 0 || r.end != 4)
+            same = false;
+        if (compiled.find("abcd", mctx, engine).start != -1)
+            same = false;
+        if (compiled.match("abcd", mctx, engine))
+            same = false;
+    }
+    ctx.CHECK(same);
+
+    RegexSet set({"a*+a", "b", "[^,]*+,"});
+    ctx.CHECK(set.matches("aab", mctx) == vector<int>({1}));
+    ctx.CHECK(set.matches("aa,", mctx) == vector<int>({2}));
+
+    // The characters that can follow each operator are found in one pass,
+    // so a long run of optional operators does not take quadratic time.
+    string chain;
+    for (int i = 0; i < 20000; i++)
+        chain += "a?";
+    vector<RegexOperator *> optional = parseRegex(chain + "b*c");
+    ctx.CHECK(!optional[0]->isPossessive());
+    ctx.CHECK(!optional[19998]->isPossessive());
+    ctx.CHECK(optional[19999]->isPossessive());
+    ctx.CHECK(optional[20000]->isPossessive());
+    ctx.CHECK(!needsBacktracking(optional));
+
+    for (vector<RegexOperator *> *ops :
+             {&disjoint, &overlapping, &explicitly, &optional}) {
+        for (RegexOperator *op : *ops)
+            delete op;
+    }
+
+    ctx.result();
+}
+
+
+/*! Test that searches with limits give up once they have done too much
+ *  work, and say so, without leaving anything behind in the context.
+ */
+void test_match_limits(TestContext &ctx) {
+    CompiledRegex stars("a*a*a*a*[bc]");
+    vector<RegexOperator *> regex = parseRegex("a*a*a*a*[bc]");
+    string line = string(2000, 'a');
+    MatchContext mctx;
+    MatchLimits limits;
+    MatchStatus status;
+    Range r;
+
+    ctx.DESC("Step budgets and deadlines");
+
+    // Without limits, the search runs to the end.
+    status = stars.find(line, mctx, limits, r);
+    ctx.CHECK(status == MATCH_NOT_FOUND && r.start == -1 && r.end == -1);
+    status = stars.find(line + "b", mctx, limits, r);
+    ctx.CHECK(status == MATCH_FOUND && r.start == 0 && r.end == 2001);
+
+    // Running out of steps is not the same as finding no match.
+    limits.maxSteps = 100;
+    status = stars.find(line, mctx, limits, r);
+    ctx.CHECK(status == MATCH_BUDGET_EXCEEDED);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    // Nothing is left behind for the next search with the same context.
+    ctx.CHECK(mctx.backtrack.frames.empty());
+    ctx.CHECK(mctx.backtrack.visitedLow >= mctx.backtrack.visitedHigh);
+    r = stars.find(line + "c", mctx);
+    ctx.CHECK(r.start == 0 && r.end == 2001);
+    status = stars.find("aab", mctx, limits, r);
+    ctx.CHECK(status == MATCH_FOUND && r.start == 0 && r.end == 3);
+
+    // Backtracks are limited separately.
+    limits = MatchLimits();
+    limits.maxBacktracks = 0;
+    status = find(regex, "aab", mctx, limits, r);
+    ctx.CHECK(status == MATCH_FOUND && r.start == 0 && r.end == 3);
+    status = find(regex, "aaaa", mctx, limits, r);
+    ctx.CHECK(status == MATCH_BUDGET_EXCEEDED);
+
+    // The engine that backtracks over the operators honors the same limits.
+    limits = MatchLimits();
+    limits.maxSteps = 100;
+    status = backtrackFind(regex, line, mctx, ByteScanner(), limits, r);
+    ctx.CHECK(status == MATCH_BUDGET_EXCEEDED);
+    ctx.CHECK(mctx.backtrack.frames.empty());
+    r = backtrackFind(regex, line + "b", mctx, ByteScanner());
+    ctx.CHECK(r.start == 0 && r.end == 2001);
+
+    // A deadline that has passed stops the search.
+    limits = MatchLimits();
+    limits.setTimeout(chrono::seconds(0));
+    status = stars.find(line, mctx, limits, r);
+    ctx.CHECK(status == MATCH_BUDGET_EXCEEDED);
+    limits.setTimeout(chrono::seconds(60));
+    status = stars.find(line, mctx, limits, r);
+    ctx.CHECK(status == MATCH_NOT_FOUND);
+
+    // The automaton engines take linear time, and never give up.
+    limits = MatchLimits();
+    limits.maxSteps = 1;
+    status = stars.find(line, mctx, limits, r, ENGINE_DFA);
+    ctx.CHECK(status == MATCH_NOT_FOUND);
+    status = stars.find(line + "b", mctx, limits, r, ENGINE_NFA);
+    ctx.CHECK(status == MATCH_FOUND && r.start == 0 && r.end == 2001);
+
+    for (RegexOperator *op : regex)
+        delete op;
+
+    ctx.result();
+}
+
+
+/*! Test the counters of the work done by the backtracking engines, for
+ *  one search and in total for a compiled regex.
+ */
+void test_match_stats(TestContext &ctx) {
+    CompiledRegex regex("a.*;x");
+    MatchContext mctx;
+    MatchStats stats;
+    Range r;
+
+    ctx.DESC("Backtracking statistics");
+
+    // Nothing is counted unless the context asks for it.
+    r = regex.find("xa;x", mctx);
+    ctx.CHECK(r.start == 1 && r.end == 4);
+    ctx.CHECK(regex.stats().searches == 0);
+
+    // The .* takes ";x", and gives both characters back, one at a time,
+    // before the ";" can match.
+    mctx.backtrack.collectStats = true;
+    r = regex.find("xa;x", mctx);
+    ctx.CHECK(r.start == 1 && r.end == 4);
+    stats = mctx.backtrack.stats;
+    ctx.CHECK(stats.searches == 1);
+    ctx.CHECK(stats.starts == 1);
+    ctx.CHECK(stats.steps == 6);
+    ctx.CHECK(stats.backtracks == 2);
+    ctx.CHECK(stats.maxDepth == 1);
+    ctx.CHECK(stats.bytesScanned == 5);
+
+    r = regex.find("a;x;a;x", mctx);
+    ctx.CHECK(r.start == 0 && r.end == 7);
+    stats = mctx.backtrack.stats;
+    ctx.CHECK(stats.starts == 1);
+    ctx.CHECK(stats.backtracks == 2);
+    ctx.CHECK(stats.bytesScanned == 9);
+
+    r = regex.find("ab;xb;ab", mctx);
+    ctx.CHECK(r.start == 0 && r.end == 4);
+    stats = mctx.backtrack.stats;
+    ctx.CHECK(stats.backtracks == 6);
+    ctx.CHECK(stats.maxDepth == 1);
+
+    // The regex adds up the searches that counted.
+    stats = regex.stats();
+    ctx.CHECK(stats.searches == 3);
+    ctx.CHECK(stats.starts == 3);
+    ctx.CHECK(stats.steps == 23);
+    ctx.CHECK(stats.backtracks == 10);
+    ctx.CHECK(stats.maxDepth == 1);
+    ctx.CHECK(stats.bytesScanned == 25);
+
+    regex.resetStats();
+    ctx.CHECK(regex.stats().searches == 0);
+
+    // The engine that backtracks over the operators counts the same way.
+    vector<RegexOperator *> ops = parseRegex("a.*;x");
+    MatchLimits limits;
+    backtrackFind(ops, "ab;xb;ab", mctx, ByteScanner(), limits, r);
+    ctx.CHECK(r.start == 0 && r.end == 4);
+    ctx.CHECK(mctx.backtrack.stats.backtracks == 6);
+
+    // It keeps a choice point for every operator, not only for the ones
+    // that can give repetitions back.
+    ctx.CHECK(mctx.backtrack.stats.maxDepth == 4);
+    for (RegexOperator *op : ops)
+        delete op;
+
+    ctx.result();
+}
+
+
+/*! Test that the DFA finds where a match starts by running the reversed
+ *  regex backward from the earliest end of a match.
+ */
+void test_dfa_reverse(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("a[ab]*b+c?");
+    LazyDFA dfa(regex);
+    Range r;
+
+    ctx.DESC("LazyDFA finding match starts in reverse");
+
+    // The earliest end is after "ab", but the match starts at the first
+    // "a" and goes on past it.
+    r = dfa.find("xaaabbbcab");
+    ctx.CHECK(r.start == 1 && r.end == 8);
+
+    r = dfa.find("xaaabbbcab", 2);
+    ctx.CHECK(r.start == 2 && r.end == 8);
+
+    r = dfa.find("bbbab");
+    ctx.CHECK(r.start == 3 && r.end == 5);
+
+    r = dfa.find("bbbaaaa");
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    // A long run where a match could start at every index is crossed once
+    // forward and once backward.
+    string line = string(100000, 'a') + "bc";
+    r = dfa.find(line);
+    ctx.CHECK(r.start == 0 && r.end == 100002);
+    r = dfa.find(line, 99999);
+    ctx.CHECK(r.start == 99999 && r.end == 100002);
+
+    for (RegexOperator *op : regex)
+        delete op;
+
+    ctx.result();
+}
+
+
+/*! Test the byte classes and the minimized DFAs, and the matcher that runs
+ *  them.
+ */
+void test_dense_dfa(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("a[ab]*b+c?");
+    NFAProgram prog(regex);
+    Range r;
+
+    ctx.DESC("Minimized DFA with byte classes");
+
+    // The operators tell apart 'a', 'b', 'c' and every other byte.
+    ByteClasses classes(regex);
+    ctx.CHECK(classes.count == 4);
+    ctx.CHECK(classes.classOf['a'] != classes.classOf['b']);
+    ctx.CHECK(classes.classOf['x'] == classes.classOf['\0']);
+    ctx.CHECK(classes.classOf['x'] == classes.classOf[255]);
+
+    DenseDFA anchored(prog, classes, false);
+    ctx.CHECK(anchored.complete());
+    ctx.CHECK(anchored.numClasses() == 4);
+    ctx.CHECK(anchored.numStates() == 5);
+    ctx.CHECK(anchored.step(anchored.start(), 'b') == DENSE_DFA_DEAD);
+    ctx.CHECK(!anchored.isMatch(anchored.start()));
+
+    DenseMatcher matcher(regex);
+    ctx.CHECK(matcher.complete());
+    r = matcher.find("xaaabbbcab");
+    ctx.CHECK(r.start == 1 && r.end == 8);
+    r = matcher.find("xaaabbbcab", 2);
+    ctx.CHECK(r.start == 2 && r.end == 8);
+    r = matcher.find("bbbab");
+    ctx.CHECK(r.start == 3 && r.end == 5);
+    r = matcher.find("bbbaaaa");
+    ctx.CHECK(r.start == -1 && r.end == -1);
+    ctx.CHECK(matcher.match("aabbc"));
+    ctx.CHECK(!matcher.match("aabbcc"));
+    for (RegexOperator *op : regex)
+        delete op;
+
+    // The states for one, two and three 'a's before the end of the match
+    // are merged when minimizing, since they all need a 'b' next.
+    regex = parseRegex("a{1,3}b");
+    NFAProgram mergedProg(regex);
+    DenseDFA merged(mergedProg, ByteClasses(regex), true);
+    ctx.CHECK(merged.complete() && merged.numStates() == 4);
+    for (RegexOperator *op : regex)
+        delete op;
+
+    // A DFA that must remember the last 16 characters is too large to
+    // build, and a CompiledRegex falls back to the LazyDFA.
+    regex = parseRegex("[ab]*a[ab]{15}");
+    DenseMatcher large(regex);
+    ctx.CHECK(!large.complete());
+    for (RegexOperator *op : regex)
+        delete op;
+
+    CompiledRegex fallback("[ab]*a[ab]{15}");
+    string text = string(20, 'b') + "a" + string(15, 'b');
+    r = fallback.find(text, ENGINE_DFA);
+    ctx.CHECK(r.start == 0 && r.end == 36);
+
+    ctx.result();
+}
+
+
+/*! Test that find() with the DFA engine keeps its DFA in the match context,
+ *  as the other engines do with their programs and the searcher for the
+ *  required literal, and builds new ones when the regex changes.
+ */
+void test_dfa_context(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("ab+c");
+    vector<RegexOperator *> other = parseRegex("x[yz]*");
+    MatchContext mctx;
+    Range r;
+
+    ctx.DESC("DFA kept in the match context");
+
+    r = find(regex, "xabbc", mctx, ENGINE_DFA);
+    ctx.CHECK(r.start == 1 && r.end == 5);
+    LazyDFA *dfa = mctx.dfa.get();
+    int states = dfa->numStates();
+
+    // The same regex reuses the DFA and the states it has built.
+    r = find(regex, "xabbc", mctx, ENGINE_DFA);
+    ctx.CHECK(r.start == 1 && r.end == 5);
+    ctx.CHECK(match(regex, "abbbc", mctx, ENGINE_DFA));
+    ctx.CHECK(mctx.dfa.get() == dfa);
+    ctx.CHECK(dfa->numStates() >= states);
+    LiteralSearcher *literal = mctx.literal.get();
+    ctx.CHECK(literal->literal() == "ab");
+    ctx.CHECK(find(regex, "xabbc", mctx, ENGINE_NFA).start == 1);
+    ctx.CHECK(find(regex, "xacbc", mctx).start == -1);
+    ctx.CHECK(mctx.literal.get() == literal);
+    ctx.CHECK(find(regex, "xabbc", mctx).start == 1);
+    NFAProgram *prog = mctx.prog.get();
+    BytecodeProgram *code = mctx.code.get();
+    ctx.CHECK(prog != nullptr && code != nullptr && !mctx.shiftAnd);
+    ctx.CHECK(find(regex, "xabbc", mctx, ENGINE_SHIFTAND).start == 1);
+    ctx.CHECK(find(regex, "xabbc", mctx, ENGINE_NFA).start == 1);
+    ctx.CHECK(find(regex, "xabbc", mctx).start == 1);
+    ctx.CHECK(mctx.prog.get() == prog && mctx.code.get() == code);
+    ctx.CHECK(mctx.shiftAnd != nullptr);
+
+    // Changing an operator, or searching for another regex, builds a new
+    // DFA.
+    regex[1]->setMaxRepeat(2);
+    ctx.CHECK(!match(regex, "abbbc", mctx, ENGINE_DFA));
+    ctx.CHECK(match(regex, "abbc", mctx, ENGINE_DFA));
+    r = find(other, "abxzyq", mctx, ENGINE_DFA);
+    ctx.CHECK(r.start == 2 && r.end == 5);
+    ctx.CHECK(mctx.literal->literal() == "x");
+
+    // A compiled regex takes the context's DFA over, and find() builds its
+    // own again afterwards.
+    CompiledRegex compiled("a[^b]+");
+    compiled.find("zzaxy", mctx, ENGINE_DFA);
+    r = find(other, "abxzyq", mctx, ENGINE_DFA);
+    ctx.CHECK(r.start == 2 && r.end == 5);
+
+    for (RegexOperator *op : regex)
+        delete op;
+    for (RegexOperator *op : other)
+        delete op;
+    ctx.result();
+}
+
+
+/*! Test that a LazyDFA keeps finding the right matches when its state cache
+ *  is too small for the regex and has to be flushed.
+ */
+void test_dfa_cache_flush(TestContext &ctx) {
+    vector<RegexOperator *> regex = parseRegex("ab+c?d*[ef]+g[^ghi]*j.+k");
+    LazyDFA dfa(regex, 1);
+    Range r;
+
+    ctx.DESC("LazyDFA with a flushed state cache");
+
+    r = dfa.find("aaabbbbbbbbegjkk");
+    ctx.CHECK(r.start == 2 && r.end == 16);
+
+    r = dfa.find("abegijkk");
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    ctx.CHECK(dfa.match("abbbbbbbbegjkk"));
+    ctx.CHECK(!dfa.match("aaabegjkk"));
+    ctx.CHECK(dfa.numFlushes() > 0);
+
+    ctx.result();
+}
+
+
+/*! Test finding matches in a stream that arrives in chunks. */
+void test_stream_matcher(TestContext &ctx) {
+    CompiledRegex regex("ab+c?");
+    vector<StreamMatch> found;
+    auto record = [&](const StreamMatch &m) { found.push_back(m); };
+
+    ctx.DESC("Streaming matcher");
+
+    // The same matches as for the whole string, however it is split up.
+    string s = "xxabbbcabbxabcab";
+    vector<Range> expected;
+    MatchContext mctx;
+    regex.findAll(s, mctx, [&](const Range &r) { expected.push_back(r); });
+    ctx.CHECK(expected.size() == 4);
+
+    for (size_t chunk = 1; chunk <= s.length(); chunk++) {
+        found.clear();
+        StreamMatcher stream(regex.operators(), record);
+        for (size_t i = 0; i < s.length(); i += chunk)
+            stream.feed(s.data() + i, min(chunk, s.length() - i));
+        stream.finish();
+
+        bool same = (found.size() == expected.size());
+        for (size_t i = 0; same && i < found.size(); i++) {
+            same = found[i].start == (uint64_t) expected[i].start &&
+                found[i].end == (uint64_t) expected[i].end &&
+                found[i].text == s.substr(expected[i].start,
+                                          expected[i].end - expected[i].start);
+        }
+        ctx.CHECK(same);
+    }
+
+    // A match that straddles chunks is reported once it cannot grow, and
+    // the bytes before it are not kept.
+    found.clear();
+    StreamMatcher stream(regex.operators(), record);
+    stream.feed("xxxxa", 5);
+    ctx.CHECK(stream.bufferedBytes() == 1);
+    stream.feed("bbb", 3);
+    ctx.CHECK(found.empty());
+    ctx.CHECK(stream.bufferedBytes() == 4);
+    stream.feed("bcd", 3);
+    ctx.CHECK(found.size() == 1);
+    ctx.CHECK(found[0].start == 4 && found[0].end == 10);
+    ctx.CHECK(found[0].text == "abbbbc");
+    ctx.CHECK(stream.bufferedBytes() == 0);
+    ctx.CHECK(stream.offset() == 11);
+
+    // A match at the end of the stream is only known to be complete once
+    // the stream is finished.
+    stream.feed("ab", 2);
+    ctx.CHECK(found.size() == 1);
+    stream.finish();
+    ctx.CHECK(found.size() == 2);
+    ctx.CHECK(found[1].start == 11 && found[1].end == 13);
+
+    // The bytes kept are exactly the candidate match, from the start of the
+    // earliest thread still alive, even when earlier threads die one at a
+    // time in the middle of it.
+    CompiledRegex window("a[ab][ab][ab][ab]c");
+    found.clear();
+    StreamMatcher overlap(window.operators(), record);
+    overlap.feed("aa", 2);
+    ctx.CHECK(overlap.bufferedBytes() == 2);
+    overlap.feed("aab", 3);
+    ctx.CHECK(overlap.bufferedBytes() == 5);
+    overlap.feed("b", 1);
+    ctx.CHECK(overlap.bufferedBytes() == 5);
+    overlap.feed("bb", 2);
+    ctx.CHECK(overlap.bufferedBytes() == 5);
+    ctx.CHECK(overlap.offset() - overlap.bufferedBytes() == 3);
+    overlap.feed("cx", 2);
+    ctx.CHECK(found.size() == 1);
+    ctx.CHECK(found[0].start == 3 && found[0].text == "abbbbc");
+    ctx.CHECK(overlap.bufferedBytes() == 0);
+
+    // Offsets past 4 GB, with nothing kept while no match is being tried.
+    found.clear();
+    StreamMatcher big(regex.operators(), record);
+    string filler(1 << 20, 'x');
+    for (int i = 0; i < 4097; i++)
+        big.feed(filler.data(), filler.length());
+    ctx.CHECK(big.bufferedBytes() == 0);
+    big.feed("xab", 3);
+    big.feed("cx", 2);
+    ctx.CHECK(found.size() == 1);
+    ctx.CHECK(found[0].start == ((uint64_t) 4097 << 20) + 1);
+    ctx.CHECK(found[0].end == ((uint64_t) 4097 << 20) + 4);
+
+    ctx.CHECK(!StreamMatcher::supports(parseRegex("a*+a")));
+
+    ctx.result();
+}
+
+
+/*! Test matching a string_view into a larger buffer, and a subject too
+ *  long for int offsets.
+ */
+void test_string_view(TestContext &ctx) {
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+    CompiledRegex regex("ab+c");
+    MatchContext mctx;
+    Range r;
+
+    ctx.DESC("Matching string_views and huge subjects");
+
+    // Only the viewed part of the buffer is searched, and the ranges are
+    // relative to the start of the view.
+    const char *buffer = "abbcxxabcxabbbc";
+    string_view view(buffer + 5, 9);
+    for (RegexEngine engine : engines) {
+        r = regex.find(view, mctx, engine);
+        ctx.CHECK(r.start == 1 && r.end == 4);
+        r = regex.findFrom(view, 2, mctx, engine);
+        ctx.CHECK(r.start == -1 && r.end == -1);
+        ctx.CHECK(regex.match(string_view(buffer + 6, 3), mctx, engine));
+        ctx.CHECK(!regex.match(view, mctx, engine));
+    }
+
+    vector<Range> groups;
+    CaptureRegex captures("a(b+)c");
+    ctx.CHECK(captures.find(string_view(buffer + 1, 14), groups));
+    ctx.CHECK(groups[0].start == 5 && groups[0].end == 8);
+    ctx.CHECK(groups[1].start == 6 && groups[1].end == 7);
+
+    // A match more than 2 GB into a subject of zeros, which are skipped
+    // with memchr() since only 'x' can begin a match.  Only the page the
+    // match is written to takes any memory.
+    CompiledRegex digits("x[0-9]+");
+    size_t length = ((size_t) 1 << 31) + 16;
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ctx.CHECK(map != MAP_FAILED);
+    if (map != MAP_FAILED) {
+        char *data = (char *) map;
+        memcpy(data + length - 8, "x1234", 5);
+        string_view huge(data, length);
+        ptrdiff_t start = (ptrdiff_t) length - 8;
+
+        r = digits.find(huge, mctx, ENGINE_BACKTRACK);
+        ctx.CHECK(r.start == start && r.end == start + 5);
+        r = digits.find(huge, mctx, ENGINE_NFA);
+        ctx.CHECK(r.start == start && r.end == start + 5);
+        ctx.CHECK(digits.match(huge.substr(start, 5), mctx));
+        munmap(map, length);
+    }
+
+    ctx.result();
+}
+
+
+/*! Test searching text that is not in a string, through iterators. */
+void test_iterator_find(TestContext &ctx) {
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+    CompiledRegex regex("a[ab]*b+c?");
+    MatchContext mctx;
+    Range r;
+
+    ctx.DESC("Searching through iterators");
+
+    string text = "xaaabbbcab";
+    deque<char> chunks(text.begin(), text.end());
+    list<char> linked(text.begin(), text.end());
+    for (RegexEngine engine : engines) {
+        r = regex.find(text.begin(), text.end(), mctx, engine);
+        ctx.CHECK(r.start == 1 && r.end == 8);
+        r = regex.find(chunks.begin(), chunks.end(), mctx, engine);
+        ctx.CHECK(r.start == 1 && r.end == 8);
+        r = regex.find(linked.begin(), linked.end(), mctx, engine);
+        ctx.CHECK(r.start == 1 && r.end == 8);
+        r = regex.find(chunks.begin() + 2, chunks.begin() + 5, mctx, engine);
+        ctx.CHECK(r.start == 0 && r.end == 3);
+        r = regex.find(chunks.begin() + 4, chunks.end() - 3, mctx, engine);
+        ctx.CHECK(r.start == -1 && r.end == -1);
+    }
+
+    // A possessive regex that needs the backtracker, and one that gives back
+    // repetitions.
+    CompiledRegex possessive("a[ab]*+b");
+    ctx.CHECK(!possessive.supportsSinglePass());
+    r = possessive.find(chunks.begin(), chunks.end(), mctx);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+    CompiledRegex greedy("x.*b.c");
+    r = greedy.find(linked.begin(), linked.end(), mctx);
+    ctx.CHECK(r.start == 0 && r.end == 8);
+
+    // A stream is read once, and only up to the end of the match.
+    istringstream in("xxaabbbcabz");
+    ctx.CHECK(regex.supportsSinglePass());
+    r = regex.find(istreambuf_iterator<char>(in), istreambuf_iterator<char>(),
+                   mctx);
+    ctx.CHECK(r.start == 2 && r.end == 8);
+    ctx.CHECK(in.get() == 'a');
+
+    istringstream none("xxxbbc");
+    r = regex.find(istreambuf_iterator<char>(none),
+                   istreambuf_iterator<char>(), mctx);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    // A regex that the NFA cannot run reads the whole stream into memory,
+    // and is searched there by the backtracker.
+    CompiledRegex giveNothing("a*+ab");
+    istringstream aab("xaab");
+    r = giveNothing.find(istreambuf_iterator<char>(aab),
+                         istreambuf_iterator<char>(), mctx);
+    ctx.CHECK(r.start == -1 && r.end == -1);
+    CompiledRegex word("[a-z]*+[a-z0-9]");
+    istringstream words("--abc1--");
+    r = word.find(istreambuf_iterator<char>(words),
+                  istreambuf_iterator<char>(), mctx);
+    ctx.CHECK(r.start == 2 && r.end == 6);
+
+    ctx.result();
+}
+
+
+/*! Test that one CompiledRegex can be shared by several threads, each
+ *  searching with its own MatchContext.
+ */
+void test_compiled_threads(TestContext &ctx) {
+    shared_ptr<const CompiledRegex> regex =
+        compileRegex("ab+c?d*[ef]+g[^ghi]*j.+k");
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+    const int numThreads = 4;
+    bool ok[numThreads];
+
+    ctx.DESC("CompiledRegex shared between threads");
+
+    vector<thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.push_back(thread([&regex, &engines, &ok, t]() {
+            MatchContext mctx;
+            RegexEngine engine = engines[t % 4];
+            ok[t] = true;
+            for (int i = 0; i < 1000; i++) {
+                string pad(i % 7, 'a');
+                Range r = regex->find(pad + "abbbbbbbbegjkk", mctx, engine);
+                if (r.start != (int) pad.length() ||
+                    r.end != (int) pad.length() + 14)
+                    ok[t] = false;
+                if (regex->find(pad + "abegijkk", mctx, engine).start != -1)
+                    ok[t] = false;
+                if (!regex->match("abegjkk", mctx, engine))
+                    ok[t] = false;
+            }
+        }));
+    }
+    for (thread &th : threads)
+        th.join();
+
+    for (int t = 0; t < numThreads; t++)
+        ctx.CHECK(ok[t]);
+
+    ctx.result();
+}
+
+
+/*! Test the cache of compiled regexes. */
+void test_regex_cache(TestContext &ctx) {
+    RegexCache cache;
+
+    ctx.DESC("Regex cache");
+
+    // A repeated pattern is compiled once, and the same regex is returned.
+    shared_ptr<const CompiledRegex> first = cache.get("ab+c");
+    shared_ptr<const CompiledRegex> second = cache.get("ab+c");
+    ctx.CHECK(first == second);
+    ctx.CHECK(first->pattern() == "ab+c");
+    ctx.CHECK(cache.hits() == 1 && cache.misses() == 1);
+    ctx.CHECK(cache.size() == 1);
+    ctx.CHECK(cache.bytes() == first->memoryUsage());
+
+    // With room for only two regexes, the least recently used one goes.
+    shared_ptr<const CompiledRegex> other = cache.get("x*y");
+    cache.setMaxBytes(first->memoryUsage() + other->memoryUsage());
+    cache.get("ab+c");
+    cache.get("[0-9]z");
+    ctx.CHECK(cache.size() == 2);
+    ctx.CHECK(cache.evictions() == 1);
+    ctx.CHECK(cache.get("ab+c") == first);
+    ctx.CHECK(cache.get("x*y") != other);
+    ctx.CHECK(cache.misses() == 4);
+
+    // An evicted regex still works for those that hold it.
+    ctx.CHECK(other->find("zxxy").start == 1);
+
+    // A regex larger than the whole budget is returned but not kept, and is
+    // counted as rejected rather than evicted.  While a caller holds it, it
+    // is returned again instead of being compiled again.
+    cache.setMaxBytes(1);
+    ctx.CHECK(cache.size() == 0 && cache.bytes() == 0);
+    unsigned long evictions = cache.evictions();
+    ctx.CHECK(cache.get("abc")->match("abc"));
+    ctx.CHECK(cache.size() == 0);
+    ctx.CHECK(cache.rejected() == 1 && cache.evictions() == evictions);
+    shared_ptr<const CompiledRegex> large = cache.get("abc");
+    ctx.CHECK(cache.rejected() == 2 && cache.misses() == 6);
+    ctx.CHECK(cache.get("abc") == large);
+    ctx.CHECK(cache.rejected() == 2 && cache.misses() == 6);
+    ctx.CHECK(cache.size() == 0);
+    large.reset();
+    cache.get("abc");
+    ctx.CHECK(cache.rejected() == 3 && cache.misses() == 7);
+
+    // Many threads asking for the same patterns compile each one once.
+    cache.setMaxBytes(REGEX_CACHE_DEFAULT_BYTES);
+    cache.clear();
+    unsigned long misses = cache.misses();
+    const int numThreads = 8;
+    shared_ptr<const CompiledRegex> found[numThreads][10];
+    vector<thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.push_back(thread([&cache, &found, t]() {
+            for (int i = 0; i < 10; i++)
+                found[t][i] = cache.get("q[0-9]+" + to_string(i));
+        }));
+    }
+    for (thread &th : threads)
+        th.join();
+
+    bool same = true;
+    for (int t = 0; t < numThreads; t++) {
+        for (int i = 0; i < 10; i++) {
+            if (found[t][i] != found[0][i])
+                same = false;
+        }
+    }
+    ctx.CHECK(same);
+    ctx.CHECK(cache.misses() - misses == 10);
+    ctx.CHECK(cache.size() == 10);
+
+    ctx.result();
+}
+
+
+/*! Test searching for a set of regexes at once, against searching for each
+ *  regex on its own.
+ */
+void test_regex_set(TestContext &ctx) {
+    const vector<string> exprs = {
+        "abc", "a+b", "x?y*z", ".*q", "[0-9]+", "b*", "[^abc]c", "zz"
+    };
+    RegexSet set(exprs);
+    vector<vector<RegexOperator *> > regexes;
+    for (const string &expr : exprs)
+        regexes.push_back(parseRegex(expr));
+    MatchContext mctx;
+    vector<int> found;
+
+    ctx.DESC("Regex set");
+
+    ctx.CHECK(set.size() == 8);
+    ctx.CHECK(set.pattern(3) == ".*q");
+
+    found = set.matches("xxabcq", mctx);
+    ctx.CHECK(found == vector<int>({0, 1, 3, 5}));
+
+    found = set.matches("z", mctx);
+    ctx.CHECK(found == vector<int>({2, 5}));
+
+    found = set.matches("", mctx);
+    ctx.CHECK(found.empty());
+
+    // Compare against each regex on its own, over many strings.
+    bool same = true;
+    srand(17);
+    for (int i = 0; i < 2000; i++) {
+        string s;
+        int length = rand() % 12;
+        for (int j = 0; j < length; j++)
+            s += "abcqxyz9"[rand() % 8];
+
+        vector<int> expected;
+        for (int j = 0; j < (int) regexes.size(); j++) {
+            if (find(regexes[j], s).start != -1)
+                expected.push_back(j);
+        }
+        if (set.matches(s, mctx) != expected)
+            same = false;
+    }
+    ctx.CHECK(same);
+
+    // An empty set never matches.
+    RegexSet empty((vector<string>()));
+    ctx.CHECK(empty.matches("abc", mctx).empty());
+
+    for (vector<RegexOperator *> &regex : regexes) {
+        for (RegexOperator *op : regex)
+            delete op;
+    }
+
+    ctx.result();
+}
+
+
+// Patterns for the compile-time regex tests.
+constexpr char staticSimple[] = "abc";
+constexpr char staticRoute[] = "/api/v[0-9]+/users/[^/]+";
+constexpr char staticRepeats[] = "x?a*[bc]+.d?";
+constexpr char staticCounted[] = "x?a{2,3}[bc]{1,}d{2}";
+constexpr char staticPossessive[] = "x?+a*+[abc]++.?+b{1,2}+";
+constexpr char staticEscaped[] = "\\.[a-c-]*\\++";
+constexpr char staticOptional[] = "a*b?";
+constexpr char staticStars[] = "a*a*a*a*a*b";
+
+
+/*! Returns true if the compile-time regex for Pattern reports the same
+ *  results as the same pattern parsed by parseRegex(), on every string.
+ */
+template <const char *Pattern>
+bool staticMatchesEngine(const vector<string> &strings) {
+    vector<RegexOperator *> regex = parseRegex(Pattern);
+    bool same = true;
+    for (const string &s : strings) {
+        Range expected = find(regex, s);
+        Range r = StaticRegex<Pattern>::find(s);
+        if (r.start != expected.start || r.end != expected.end)
+            same = false;
+        if (StaticRegex<Pattern>::match(s) != match(regex, s))
+            same = false;
+    }
+    for (RegexOperator *op : regex)
+        delete op;
+    return same;
+}
+
+
+/*! Test the regexes parsed at compile time. */
+void test_static_regex(TestContext &ctx) {
+    Range r;
+
+    ctx.DESC("Compile-time regex");
+
+    r = StaticRegex<staticSimple>::find("xxabcx");
+    ctx.CHECK(r.start == 2 && r.end == 5);
+    ctx.CHECK(StaticRegex<staticSimple>::match("abc"));
+    ctx.CHECK(!StaticRegex<staticSimple>::match("abcd"));
+
+    r = StaticRegex<staticRoute>::find("GET /api/v12/users/bob/posts");
+    ctx.CHECK(r.start == 4 && r.end == 22);
+    r = StaticRegex<staticRoute>::find("GET /api/v/users/bob");
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    r = StaticRegex<staticOptional>::find("ccab");
+    ctx.CHECK(r.start == 0 && r.end == 0);
+    ctx.CHECK(!StaticRegex<staticOptional>::match(""));
+
+    // Compare against the engines over many strings.
+    vector<string> strings;
+    srand(23);
+    for (int i = 0; i < 2000; i++) {
+        string s;
+        int length = rand() % 10;
+        for (int j = 0; j < length; j++)
+            s += "abcdx.+-"[rand() % 8];
+        strings.push_back(s);
+    }
+    ctx.CHECK(staticMatchesEngine<staticSimple>(strings));
+    ctx.CHECK(staticMatchesEngine<staticRepeats>(strings));
+    ctx.CHECK(staticMatchesEngine<staticEscaped>(strings));
+    ctx.CHECK(staticMatchesEngine<staticOptional>(strings));
+    ctx.CHECK(staticMatchesEngine<staticCounted>(strings));
+    ctx.CHECK(staticMatchesEngine<staticPossessive>(strings));
+    ctx.CHECK(staticMatchesEngine<staticStars>(strings));
+
+    // Every start index in the run of a's fails, after trying every way of
+    // splitting the run between the stars; the explored states are
+    // remembered, so this does not take exponential time.
+    r = StaticRegex<staticStars>::find(string(2000, 'a') + "cb");
+    ctx.CHECK(r.start == 2001 && r.end == 2002);
+    ctx.CHECK(StaticRegex<staticStars>::match(string(2000, 'a') + "b"));
+
+    // The memo is kept in the caller's scratch space, and only the words a
+    // search touched are cleared, so later searches start from a clean one.
+    BacktrackScratch scratch;
+    r = StaticRegex<staticStars>::find(string(2000, 'a') + "cb", scratch);
+    ctx.CHECK(r.start == 2001 && r.end == 2002);
+    size_t words = scratch.visited.size();
+    ctx.CHECK(words * 64 >= 2003 * 6);
+    ctx.CHECK(count(scratch.visited.begin(), scratch.visited.end(), 0) ==
+              (ptrdiff_t) words);
+    ctx.CHECK(StaticRegex<staticStars>::match("aab", scratch));
+    ctx.CHECK(scratch.visited.size() == words);
+    r = StaticRegex<staticRoute>::find("/api/v" + string(2000, '1') + "/x");
+    ctx.CHECK(r.start == -1 && r.end == -1);
+
+    ctx.result();
+}
+
+
+/*! Test groups, alternation and captures with the Pike VM. */
+void test_captures(TestContext &ctx) {
+    MatchContext mctx;
+    vector<Range> groups;
+
+    ctx.DESC("Captures");
+
+    // Fields of a log line.
+    CaptureRegex log("([0-9]+)-([0-9]+)-([0-9]+) ([A-Z]+) (.*)");
+    ctx.CHECK(log.numGroups() == 5);
+    ctx.CHECK(log.find("2024-05-17 ERROR disk full", groups, mctx));
+    ctx.CHECK(groups.size() == 6);
+    ctx.CHECK(groups[0].start == 0 && groups[0].end == 26);
+    ctx.CHECK(groups[1].start == 0 && groups[1].end == 4);
+    ctx.CHECK(groups[3].start == 8 && groups[3].end == 10);
+    ctx.CHECK(groups[4].start == 11 && groups[4].end == 16);
+    ctx.CHECK(groups[5].start == 17 && groups[5].end == 26);
+    ctx.CHECK(!log.find("no date here", groups, mctx));
+    ctx.CHECK(groups[0].start == -1 && groups[5].start == -1);
+
+    // The first alternative that matches is preferred by a search, but a
+    // full match may need a later one.
+    CaptureRegex alt("a|ab");
+    ctx.CHECK(alt.find("abc", groups, mctx));
+    ctx.CHECK(groups[0].start == 0 && groups[0].end == 1);
+    ctx.CHECK(alt.match("ab", groups, mctx));
+    ctx.CHECK(!alt.match("abc", groups, mctx));
+
+    CaptureRegex pair("(a|ab)(c|bcd)");
+    ctx.CHECK(pair.find("xabcd", groups, mctx));
+    ctx.CHECK(groups[0].start == 1 && groups[0].end == 5);
+    ctx.CHECK(groups[1].start == 1 && groups[1].end == 2);
+    ctx.CHECK(groups[2].start == 2 && groups[2].end == 5);
+
+    // A repeated group reports its last repetition, and a group that takes
+    // no part in the match has no range.
+    CaptureRegex nested("((a)|b)+c");
+    ctx.CHECK(nested.find("abbac", groups, mctx));
+    ctx.CHECK(groups[0].start == 0 && groups[0].end == 5);
+    ctx.CHECK(groups[1].start == 3 && groups[1].end == 4);
+    ctx.CHECK(groups[2].start == 3 && groups[2].end == 4);
+
+    CaptureRegex counted("(ab){2}");
+    ctx.CHECK(counted.find("xababab", groups, mctx));
+    ctx.CHECK(groups[0].start == 1 && groups[0].end == 5);
+    ctx.CHECK(groups[1].start == 3 && groups[1].end == 5);
+
+    CaptureRegex optional("(x)?y");
+    ctx.CHECK(optional.find("zy", groups, mctx));
+    ctx.CHECK(groups[0].start == 1 && groups[0].end == 2);
+    ctx.CHECK(groups[1].start == -1 && groups[1].end == -1);
+
+    // Escaped parentheses and bars are literals.
+    CaptureRegex escaped("\\(a\\|b\\)");
+    ctx.CHECK(escaped.numGroups() == 0);
+    ctx.CHECK(escaped.match("(a|b)", groups, mctx));
+
+    // Nested counted repeats that would expand to a billion instructions are
+    // rejected as the program grows, and never match.
+    ctx.CHECK(log.complete());
+    CaptureRegex huge("((a{1000}){1000}){1000}");
+    ctx.CHECK(!huge.complete());
+    ctx.CHECK(huge.numGroups() == 2);
+    ctx.CHECK(!huge.find(string(5000, 'a'), groups, mctx));
+    ctx.CHECK(groups.size() == 3 && groups[0].start == -1);
+    ctx.CHECK(!huge.match("", groups, mctx));
+    // A deeply repeated group that can be skipped is followed without
+    // recursion, both when the program is compiled and when it runs.
+    CaptureRegex deep("(a?){100000}");
+    ctx.CHECK(deep.complete());
+    ctx.CHECK(deep.find("aaa", groups, mctx));
+    ctx.CHECK(groups[0].start == 0 && groups[0].end == 3);
+    ctx.CHECK(groups[1].start == 3 && groups[1].end == 3);
+    CaptureRegex wide("(a{1000}){1000}");
+    ctx.CHECK(wide.complete());
+    ctx.CHECK(wide.match(string(1000000, 'a'), groups, mctx));
+
+    // Too many groups, or groups nested too deeply, are rejected by the
+    // parser before their capture slots or its recursion can grow.
+    string many, parens;
+    for (int i = 0; i < REGEX_MAX_GROUPS; i++)
+        many += "(a)";
+    ctx.CHECK(CaptureRegex(many).complete());
+    ctx.CHECK(!CaptureRegex(many + "(a)").complete());
+    for (int i = 0; i < 10000; i++)
+        many += "(a)";
+    CaptureRegex tooMany(many);
+    ctx.CHECK(!tooMany.complete());
+    ctx.CHECK(!tooMany.find(string(20000, 'a'), groups, mctx));
+    parens = string(REGEX_MAX_DEPTH, '(') + "a" + string(REGEX_MAX_DEPTH, ')');
+    ctx.CHECK(CaptureRegex(parens).complete());
+    ctx.CHECK(!CaptureRegex("(" + parens + ")").complete());
+    parens = string(100000, '(') + "a" + string(100000, ')');
+    CaptureRegex tooDeep(parens);
+    ctx.CHECK(!tooDeep.complete());
+    ctx.CHECK(!tooDeep.find("a", groups, mctx));
+    // Many groups hold the program to fewer instructions, so that a thread
+    // list never needs more than PIKE_MAX_SLOTS capture slots.
+    many.resize(300);
+    ctx.CHECK(CaptureRegex(many + "a{10000}").complete());
+    ctx.CHECK(!CaptureRegex(many + "a{30000}").complete());
+
+    // Possessive repeats are rejected rather than run as two greedy ones.
+    CaptureRegex possessive("[^,]*+,");
+    ctx.CHECK(!possessive.complete());
+    ctx.CHECK(!possessive.find(",x", groups, mctx));
+    const char *possessives[] = { "a++", "a?+b", "(ab)*+", "a{2,3}+" };
+    for (const char *expr : possessives)
+        ctx.CHECK(!CaptureRegex(expr).complete());
+    ctx.CHECK(!CaptureRegex("+a+b?+").complete());
+    ctx.CHECK(CaptureRegex("+a+b+").complete());
+    ctx.CHECK(CaptureRegex("a{2}b+").complete());
+
+    // Without groups or alternation, the whole match is the same as find().
+    const char *exprs[] = { "a.[xy][^z]b*[q]?", "x?a*[ab]+.b?", ".*a.*b" };
+    bool same = true;
+    srand(37);
+    for (const char *expr : exprs) {
+        vector<RegexOperator *> ops = parseRegex(expr);
+        CaptureRegex regex(expr);
+        for (int i = 0; i < 1000; i++) {
+            string s;
+            int length = rand() % 12;
+            for (int j = 0; j < length; j++)
+                s += "abxyzq"[rand() % 6];
+
+            Range expected = find(ops, s);
+            regex.find(s, groups, mctx);
+            if (groups[0].start != expected.start ||
+                groups[0].end != expected.end)
+                same = false;
+            if (regex.match(s, groups, mctx) != match(ops, s))
+                same = false;
+        }
+        for (RegexOperator *op : ops)
+            delete op;
+    }
+    ctx.CHECK(same);
 
     ctx.result();
-    
-    // clearRegex(regex);
 }
 
 
@@ -455,14 +2080,52 @@ int main() {
 
     TestContext ctx(cout);
 
-    test_simple_regex(ctx);
-    test_simple_wildcards(ctx);
-    test_char_classes(ctx);
-    test_inv_char_classes(ctx);
-    test_kleene_star(ctx);
-    test_plus(ctx);
-    test_optional(ctx);
-    test_complex_regex(ctx);
+    // Every engine must pass the same tests.
+    const RegexEngine engines[] = {
+        ENGINE_BACKTRACK, ENGINE_NFA, ENGINE_DFA, ENGINE_SHIFTAND
+    };
+    for (RegexEngine engine : engines) {
+        cout << endl << "Engine: " << engineName(engine) << endl;
+
+        test_simple_regex(ctx, engine);
+        test_simple_wildcards(ctx, engine);
+        test_char_classes(ctx, engine);
+        test_inv_char_classes(ctx, engine);
+        test_char_ranges(ctx, engine);
+        test_kleene_star(ctx, engine);
+        test_plus(ctx, engine);
+        test_optional(ctx, engine);
+        test_counted_repeat(ctx, engine);
+        test_possessive(ctx, engine);
+        test_complex_regex(ctx, engine);
+        test_find_all(ctx, engine);
+    }
+
+    cout << endl;
+    test_first_char_scan(ctx);
+    test_required_literal(ctx);
+    test_shift_and_limits(ctx);
+    test_nfa_limits(ctx);
+    test_nfa_pathological(ctx);
+    test_memo_overflow(ctx);
+    test_bytecode(ctx);
+    test_backtrack_memo(ctx);
+    test_backtrack_counts(ctx);
+    test_possessify(ctx);
+    test_match_limits(ctx);
+    test_match_stats(ctx);
+    test_dfa_reverse(ctx);
+    test_dfa_context(ctx);
+    test_dfa_cache_flush(ctx);
+    test_dense_dfa(ctx);
+    test_stream_matcher(ctx);
+    test_string_view(ctx);
+    test_iterator_find(ctx);
+    test_compiled_threads(ctx);
+    test_regex_cache(ctx);
+    test_regex_set(ctx);
+    test_static_regex(ctx);
+    test_captures(ctx);
     
     // Return 0 if everything passed, nonzero if something failed.
     return !ctx.ok();